@@ -0,0 +1,100 @@
+#include "alloc_stats.h"
+
+#include <cstdlib>
+#include <new>
+
+// Replaces the global allocation functions to count every heap allocation of the program. Each block carries a small
+// header with its size so frees can be accounted for as well; the header keeps the 16 byte alignment malloc gives.
+
+namespace {
+    const size_t kHeaderSize = 16;
+
+    void* CountedAllocate(size_t size)
+    {
+        void* block = malloc(size + kHeaderSize);
+        if (!block)
+            return nullptr;
+        *static_cast<size_t*>(block) = size;
+
+        AllocationCounters& counters = GetAllocationCounters();
+        counters.allocations++;
+        counters.allocatedBytes += size;
+        size_t live = counters.liveBytes += size;
+        size_t peak = counters.peakLiveBytes.load();
+        while (live > peak && !counters.peakLiveBytes.compare_exchange_weak(peak, live))
+            ;
+        return static_cast<char*>(block) + kHeaderSize;
+    }
+
+    void CountedFree(void* pointer)
+    {
+        if (!pointer)
+            return;
+        void* block = static_cast<char*>(pointer) - kHeaderSize;
+        AllocationCounters& counters = GetAllocationCounters();
+        counters.frees++;
+        counters.liveBytes -= *static_cast<size_t*>(block);
+        free(block);
+    }
+}
+
+AllocationCounters& GetAllocationCounters()
+{
+    // constructed on first use, operator new can run before any other static initializer
+    static AllocationCounters counters;
+    return counters;
+}
+
+void* operator new(size_t size)
+{
+    if (void* pointer = CountedAllocate(size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    if (void* pointer = CountedAllocate(size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    CountedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    CountedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    CountedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    CountedFree(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+    CountedFree(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+    CountedFree(pointer);
+}
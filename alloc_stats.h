@@ -0,0 +1,99 @@
+#pragma once
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+// Heap allocation counters, fed by the global operator new/delete replacements in alloc_stats.cpp.
+struct AllocationCounters {
+    std::atomic<size_t> allocations{ 0 };
+    std::atomic<size_t> frees{ 0 };
+    std::atomic<size_t> allocatedBytes{ 0 };
+    std::atomic<size_t> liveBytes{ 0 };
+    std::atomic<size_t> peakLiveBytes{ 0 };
+};
+
+AllocationCounters& GetAllocationCounters();
+
+// a copy of the counters at one point in time, subtract two to get what happened in between
+struct AllocationSnapshot {
+    size_t allocations;
+    size_t frees;
+    size_t allocatedBytes;
+    size_t liveBytes;
+    size_t peakLiveBytes;
+
+    static AllocationSnapshot Take()
+    {
+        AllocationCounters& counters = GetAllocationCounters();
+        return AllocationSnapshot{ counters.allocations.load(), counters.frees.load(), counters.allocatedBytes.load(),
+            counters.liveBytes.load(), counters.peakLiveBytes.load() };
+    }
+};
+
+// restarts peak tracking from the current live size, so the peak of a single phase (like loading one model) can be read
+inline void ResetPeakLiveBytes()
+{
+    AllocationCounters& counters = GetAllocationCounters();
+    counters.peakLiveBytes = counters.liveBytes.load();
+}
+
+#ifndef _WIN32
+// reads a "Name:  1234 kB" line of /proc/self/status
+inline size_t ReadProcStatusBytes(const char* field)
+{
+    FILE* file = fopen("/proc/self/status", "r");
+    if (!file)
+        return 0;
+    char line[256];
+    size_t kilobytes = 0;
+    size_t length = strlen(field);
+    while (fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, field, length) == 0)
+        {
+            sscanf(line + length, "%zu", &kilobytes);
+            break;
+        }
+    }
+    fclose(file);
+    return kilobytes * 1024;
+}
+#endif
+
+// resident set size of the process in bytes, current and peak; 0 where the platform doesn't tell
+inline size_t CurrentResidentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS info;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info)))
+        return info.WorkingSetSize;
+    return 0;
+#else
+    return ReadProcStatusBytes("VmRSS:");
+#endif
+}
+
+inline size_t PeakResidentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS info;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info)))
+        return info.PeakWorkingSetSize;
+    return 0;
+#else
+    return ReadProcStatusBytes("VmHWM:");
+#endif
+}
+
+#endif
@@ -8,14 +8,24 @@
 #include "bone.h"
 #include <functional>
 #include "animdata.h"
+#include "arena.h"
+#include "alloc_stats.h"
 #include "model.h"
+#include "profiler.h"
 
+// node of the animation's hierarchy, names and children live in the animation's arena
 struct AssimpNodeData
 {
 	glm::mat4 transformation;
-	std::string name;
+	const char* name;
 	int childrenCount;
-	std::vector<AssimpNodeData> children;
+	AssimpNodeData* children;
+	// resolved once the bones are read, so posing looks nothing up by name: the node's keyframes, -1 for a node the
+	// animation doesn't move, and its slot in the final bone matrices with the offset into bone space, -1 if no
+	// vertex is skinned to it
+	int channel = -1;
+	int boneId = -1;
+	glm::mat4 boneOffset = glm::mat4(1.0f);
 };
 
 class Animation
@@ -25,6 +35,8 @@ public:
 
 	Animation(const std::string& animationPath, Model* model)
 	{
+		ProfileScope profile("Animation", animationPath);
+		AllocationSnapshot before = AllocationSnapshot::Take();
 		Assimp::Importer importer;
 		const aiScene* scene = importer.ReadFile(animationPath, aiProcess_Triangulate);
 		assert(scene && scene->mRootNode);
@@ -33,27 +45,46 @@ public:
 		m_TicksPerSecond = animation->mTicksPerSecond;
 		aiMatrix4x4 globalTransformation = scene->mRootNode->mTransformation;
 		globalTransformation = globalTransformation.Inverse();
+
+		// size the arena for the whole hierarchy and all keyframes, so the animation is a single allocation
+		size_t nodeCount = 0, nameBytes = 0;
+		CountHierarchy(scene->mRootNode, nodeCount, nameBytes);
+		size_t arenaBytes = nodeCount * (sizeof(AssimpNodeData) + alignof(AssimpNodeData)) + nameBytes
+			+ LinearArena::InternTableBytes(nodeCount + animation->mNumChannels)
+			+ animation->mNumChannels * sizeof(Bone) + alignof(Bone);
+		for (unsigned int i = 0; i < animation->mNumChannels; i++)
+			arenaBytes += Bone::ArenaBytes(animation->mChannels[i]) + animation->mChannels[i]->mNodeName.length + 1;
+		m_Arena.Reserve(arenaBytes);
+
 		ReadHierarchyData(m_RootNode, scene->mRootNode);
 		ReadMissingBones(animation, *model);
+		ResolveBones(m_RootNode);
+
+		AllocationSnapshot after = AllocationSnapshot::Take();
+		cout << "ANIMATION::LOAD:: " << animationPath << " heap allocations " << after.allocations - before.allocations
+			<< ", arena blocks " << m_Arena.BlockCount() << ", arena used " << m_Arena.UsedBytes() / 1024
+			<< " KB of " << m_Arena.CapacityBytes() / 1024 << " KB" << endl;
 	}
 
 	~Animation()
 	{
 	}
 
-	Bone* FindBone(const std::string& name)
+	// names are interned in the animation's arena, so a name coming from its own hierarchy matches by pointer
+	Bone* FindBone(const char* name)
 	{
-		auto iter = std::find_if(m_Bones.begin(), m_Bones.end(),
-			[&](const Bone& Bone)
-			{
-				return Bone.GetBoneName() == name;
-			}
-		);
-		if (iter == m_Bones.end()) return nullptr;
-		else return &(*iter);
+		for (int i = 0; i < m_BoneCount; i++)
+			if (m_Bones[i].GetBoneName() == name)
+				return &m_Bones[i];
+		for (int i = 0; i < m_BoneCount; i++)
+			if (strcmp(m_Bones[i].GetBoneName(), name) == 0)
+				return &m_Bones[i];
+		return nullptr;
 	}
 
 
+	Bone& GetBone(int channel) { return m_Bones[channel]; }
+
 	inline float GetTicksPerSecond() { return m_TicksPerSecond; }
 	inline float GetDuration() { return m_Duration; }
 	inline const AssimpNodeData& GetRootNode() { return m_RootNode; }
@@ -71,6 +102,8 @@ private:
 		int& boneCount = model.GetBoneCount(); //getting the m_BoneCounter from Model class
 
 		//reading channels(bones engaged in an animation and their keyframes)
+		m_Bones = m_Arena.AllocateArray<Bone>(size);
+		m_BoneCount = size;
 		for (int i = 0; i < size; i++)
 		{
 			auto channel = animation->mChannels[i];
@@ -81,31 +114,53 @@ private:
 				boneInfoMap[boneName].id = boneCount;
 				boneCount++;
 			}
-			m_Bones.push_back(Bone(channel->mNodeName.data,
-				boneInfoMap[channel->mNodeName.data].id, channel));
+			m_Bones[i] = Bone(m_Arena, channel->mNodeName.data,
+				boneInfoMap[boneName].id, channel);
 		}
 
 		m_BoneInfoMap = boneInfoMap;
 	}
 
+	void ResolveBones(AssimpNodeData& node)
+	{
+		Bone* bone = FindBone(node.name);
+		node.channel = bone ? int(bone - m_Bones) : -1;
+		auto boneInfo = m_BoneInfoMap.find(node.name);
+		if (boneInfo != m_BoneInfoMap.end())
+		{
+			node.boneId = boneInfo->second.id;
+			node.boneOffset = boneInfo->second.offset;
+		}
+		for (int i = 0; i < node.childrenCount; i++)
+			ResolveBones(node.children[i]);
+	}
+
+	void CountHierarchy(const aiNode* src, size_t& nodeCount, size_t& nameBytes)
+	{
+		nodeCount++;
+		nameBytes += src->mName.length + 1;
+		for (unsigned int i = 0; i < src->mNumChildren; i++)
+			CountHierarchy(src->mChildren[i], nodeCount, nameBytes);
+	}
+
 	void ReadHierarchyData(AssimpNodeData& dest, const aiNode* src)
 	{
 		assert(src);
 
-		dest.name = src->mName.data;
+		dest.name = m_Arena.Intern(src->mName.data);
 		dest.transformation = AssimpGLMHelpers::ConvertMatrixToGLMFormat(src->mTransformation);
 		dest.childrenCount = src->mNumChildren;
+		dest.children = m_Arena.AllocateArray<AssimpNodeData>(src->mNumChildren);
 
 		for (int i = 0; i < src->mNumChildren; i++)
-		{
-			AssimpNodeData newData;
-			ReadHierarchyData(newData, src->mChildren[i]);
-			dest.children.push_back(newData);
-		}
+			ReadHierarchyData(dest.children[i], src->mChildren[i]);
 	}
+	// owns the hierarchy and the keyframes, freed in one go with the animation
+	LinearArena m_Arena;
 	float m_Duration;
 	int m_TicksPerSecond;
-	std::vector<Bone> m_Bones;
+	Bone* m_Bones = nullptr;
+	int m_BoneCount = 0;
 	AssimpNodeData m_RootNode;
 	std::map<std::string, BoneInfo> m_BoneInfoMap;
 };
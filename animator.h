@@ -34,40 +34,44 @@ public:
 		}
 	}
 
+	// poses the bones seconds into the animation, wrapping around like UpdateAnimation
+	void SampleAt(float seconds)
+	{
+		if (m_CurrentAnimation)
+		{
+			m_CurrentTime = fmod(m_CurrentAnimation->GetTicksPerSecond() * seconds, m_CurrentAnimation->GetDuration());
+			CalculateBoneTransform(&m_CurrentAnimation->GetRootNode(), glm::mat4(1.0f));
+		}
+	}
+
 	void PlayAnimation(Animation* pAnimation)
 	{
 		m_CurrentAnimation = pAnimation;
 		m_CurrentTime = 0.0f;
 	}
 
+	// the nodes know their keyframes and bone slots, see AssimpNodeData
 	void CalculateBoneTransform(const AssimpNodeData* node, glm::mat4 parentTransform)
 	{
-		std::string nodeName = node->name;
 		glm::mat4 nodeTransform = node->transformation;
 
-		Bone* Bone = m_CurrentAnimation->FindBone(nodeName);
-
-		if (Bone)
+		if (node->channel >= 0)
 		{
-			Bone->Update(m_CurrentTime);
-			nodeTransform = Bone->GetLocalTransform();
+			Bone& bone = m_CurrentAnimation->GetBone(node->channel);
+			bone.Update(m_CurrentTime);
+			nodeTransform = bone.GetLocalTransform();
 		}
 
 		glm::mat4 globalTransformation = parentTransform * nodeTransform;
 
-		auto boneInfoMap = m_CurrentAnimation->GetBoneIDMap();
-		if (boneInfoMap.find(nodeName) != boneInfoMap.end())
-		{
-			int index = boneInfoMap[nodeName].id;
-			glm::mat4 offset = boneInfoMap[nodeName].offset;
-			m_FinalBoneMatrices[index] = globalTransformation * offset;
-		}
+		if (node->boneId >= 0)
+			m_FinalBoneMatrices[node->boneId] = globalTransformation * node->boneOffset;
 
 		for (int i = 0; i < node->childrenCount; i++)
 			CalculateBoneTransform(&node->children[i], globalTransformation);
 	}
 
-	std::vector<glm::mat4> GetFinalBoneMatrices()
+	const std::vector<glm::mat4>& GetFinalBoneMatrices() const
 	{
 		return m_FinalBoneMatrices;
 	}
@@ -0,0 +1,173 @@
+#pragma once
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// A linear (bump) allocator owning the CPU-side data of one asset. Allocations are never freed one by one, the whole
+// arena is released at once when its owner goes away. Sized with Reserve before loading, an asset costs a single heap
+// allocation; if the estimate was short the arena chains another block rather than failing.
+// Strings can be interned, so every distinct name of an asset is stored once and names compare by pointer.
+class LinearArena
+{
+public:
+    explicit LinearArena(size_t blockSize = 64 * 1024) : m_BlockSize(blockSize)
+    {
+    }
+
+    ~LinearArena()
+    {
+        Release();
+    }
+
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+
+    // makes sure the next size bytes fit without another block
+    void Reserve(size_t size)
+    {
+        if (!m_Current || size > size_t(m_End - m_Current))
+            AddBlock(size);
+    }
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(m_Current) + alignment - 1) & ~uintptr_t(alignment - 1);
+        if (!m_Current || aligned + size > reinterpret_cast<uintptr_t>(m_End))
+        {
+            AddBlock(size + alignment);
+            aligned = (reinterpret_cast<uintptr_t>(m_Current) + alignment - 1) & ~uintptr_t(alignment - 1);
+        }
+        m_Current = reinterpret_cast<char*>(aligned + size);
+        m_Used += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    // default constructed array, the destructors are never run so T must not own resources
+    template <typename T>
+    T* AllocateArray(size_t count)
+    {
+        if (count == 0)
+            return nullptr;
+        T* array = static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+        for (size_t i = 0; i < count; i++)
+            new (&array[i]) T();
+        return array;
+    }
+
+    // returns the arena's copy of text, the same pointer for equal strings
+    const char* Intern(const char* text)
+    {
+        size_t length = strlen(text);
+        size_t hash = 2166136261u;
+        for (size_t i = 0; i < length; i++)
+            hash = (hash ^ static_cast<unsigned char>(text[i])) * 16777619u;
+
+        // open addressing table kept at most half full, it lives in the arena as well
+        if ((m_InternCount + 1) * 2 > m_InternCapacity)
+            GrowInternTable();
+        size_t slot = hash & (m_InternCapacity - 1);
+        while (m_InternTable[slot])
+        {
+            if (strcmp(m_InternTable[slot], text) == 0)
+                return m_InternTable[slot];
+            slot = (slot + 1) & (m_InternCapacity - 1);
+        }
+        char* copy = static_cast<char*>(Allocate(length + 1, 1));
+        memcpy(copy, text, length + 1);
+        m_InternTable[slot] = copy;
+        m_InternCount++;
+        return copy;
+    }
+
+    // bytes needed to intern count strings, for Reserve estimates
+    static size_t InternTableBytes(size_t count)
+    {
+        size_t capacity = 16;
+        size_t total = 0;
+        while ((count + 1) * 2 > capacity)
+        {
+            total += capacity * sizeof(const char*);
+            capacity *= 2;
+        }
+        return total + capacity * sizeof(const char*);
+    }
+
+    // frees every block in one go
+    void Release()
+    {
+        while (m_LastBlock)
+        {
+            BlockHeader* previous = m_LastBlock->previous;
+            free(m_LastBlock);
+            m_LastBlock = previous;
+        }
+        m_BlockCount = 0;
+        m_Current = m_End = nullptr;
+        m_Used = m_Capacity = 0;
+        m_InternTable = nullptr;
+        m_InternCount = m_InternCapacity = 0;
+    }
+
+    size_t BlockCount() const { return m_BlockCount; }
+    size_t UsedBytes() const { return m_Used; }
+    size_t CapacityBytes() const { return m_Capacity; }
+
+private:
+    // blocks are chained through a header at their start, so the arena needs no bookkeeping allocations of its own
+    struct BlockHeader {
+        BlockHeader* previous;
+    };
+
+    BlockHeader* m_LastBlock = nullptr;
+    size_t m_BlockCount = 0;
+    char* m_Current = nullptr;
+    char* m_End = nullptr;
+    size_t m_BlockSize;
+    size_t m_Used = 0;
+    size_t m_Capacity = 0;
+
+    const char** m_InternTable = nullptr;
+    size_t m_InternCount = 0;
+    size_t m_InternCapacity = 0;
+
+    void AddBlock(size_t minimumSize)
+    {
+        size_t size = (minimumSize > m_BlockSize ? minimumSize : m_BlockSize) + sizeof(BlockHeader);
+        BlockHeader* block = static_cast<BlockHeader*>(malloc(size));
+        if (!block)
+            throw std::bad_alloc();
+        block->previous = m_LastBlock;
+        m_LastBlock = block;
+        m_BlockCount++;
+        m_Current = reinterpret_cast<char*>(block + 1);
+        m_End = reinterpret_cast<char*>(block) + size;
+        m_Capacity += size - sizeof(BlockHeader);
+    }
+
+    void GrowInternTable()
+    {
+        size_t capacity = m_InternCapacity ? m_InternCapacity * 2 : 16;
+        const char** table = static_cast<const char**>(Allocate(capacity * sizeof(const char*), alignof(const char*)));
+        memset(table, 0, capacity * sizeof(const char*));
+        for (size_t i = 0; i < m_InternCapacity; i++)
+        {
+            if (!m_InternTable[i])
+                continue;
+            size_t hash = 2166136261u;
+            for (const char* c = m_InternTable[i]; *c; c++)
+                hash = (hash ^ static_cast<unsigned char>(*c)) * 16777619u;
+            size_t slot = hash & (capacity - 1);
+            while (table[slot])
+                slot = (slot + 1) & (capacity - 1);
+            table[slot] = m_InternTable[i];
+        }
+        m_InternTable = table;
+        m_InternCapacity = capacity;
+    }
+};
+#endif
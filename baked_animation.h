@@ -0,0 +1,78 @@
+#pragma once
+#ifndef BAKED_ANIMATION_H
+#define BAKED_ANIMATION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "animation.h"
+#include "animator.h"
+#include "gl_state.h"
+#include "profiler.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+// An animation sampled at a fixed rate into a float texture, for the instanced skinning shader. Each row is one frame
+// and holds the four columns of every bone matrix, so an instance finds its pose from its own animation time and a
+// crowd needs neither a bone upload nor an Animator per member; the shader blends the two frames around that time.
+class BakedAnimation
+{
+public:
+    static const int kMaxBones = 100;
+    // above the units a Material binds
+    static const int kTextureUnit = 8;
+
+    BakedAnimation(Animation& animation, float framesPerSecond = 30.0f) : m_FramesPerSecond(framesPerSecond)
+    {
+        ProfileScope profile("Bake animation");
+        m_Duration = animation.GetTicksPerSecond() > 0.0f ? animation.GetDuration() / animation.GetTicksPerSecond() : 0.0f;
+        m_FrameCount = std::max(1, int(ceil(m_Duration * framesPerSecond)));
+
+        Animator animator(&animation);
+        vector<glm::mat4> frames(size_t(m_FrameCount) * kMaxBones);
+        for (int frame = 0; frame < m_FrameCount; frame++)
+        {
+            animator.SampleAt(frame / framesPerSecond);
+            vector<glm::mat4> bones = animator.GetFinalBoneMatrices();
+            std::copy(bones.begin(), bones.begin() + std::min(int(bones.size()), kMaxBones), frames.begin() + size_t(frame) * kMaxBones);
+        }
+
+        glGenTextures(1, &m_Texture);
+        GLState::Instance().BindTexture(GL_TEXTURE_2D, m_Texture);
+        // glm matrices are column major, each one lands as four RGBA texels
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, kMaxBones * 4, m_FrameCount, 0, GL_RGBA, GL_FLOAT, frames.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    BakedAnimation(const BakedAnimation&) = delete;
+    BakedAnimation& operator=(const BakedAnimation&) = delete;
+
+    // the shader must be in use
+    void Bind(Shader& shader) const
+    {
+        GLState::Instance().BindTexture(kTextureUnit, GL_TEXTURE_2D, m_Texture);
+        shader.setInt("boneFrames", kTextureUnit);
+        shader.setInt("boneFrameCount", m_FrameCount);
+        shader.setFloat("boneFramesPerSecond", m_FramesPerSecond);
+        // a zero length animation stays on its only frame
+        shader.setFloat("boneDuration", std::max(m_Duration, 1.0f / m_FramesPerSecond));
+    }
+
+    int FrameCount() const { return m_FrameCount; }
+    float Duration() const { return m_Duration; }
+
+private:
+    unsigned int m_Texture = 0;
+    int m_FrameCount = 1;
+    float m_FramesPerSecond;
+    // seconds
+    float m_Duration = 0.0f;
+};
+#endif
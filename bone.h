@@ -10,6 +10,7 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/quaternion.hpp>
 #include "assimp_glm_helpers.h"
+#include "arena.h"
 
 struct KeyPosition
 {
@@ -32,47 +33,56 @@ struct KeyScale
 class Bone
 {
 public:
-	Bone(const std::string& name, int ID, const aiNodeAnim* channel)
+	Bone() = default;
+
+	// the keyframes are stored in arena, which also interns name; the bone only points into it
+	Bone(LinearArena& arena, const char* name, int ID, const aiNodeAnim* channel)
 		:
-		m_Name(name),
+		m_Name(arena.Intern(name)),
 		m_ID(ID),
 		m_LocalTransform(1.0f)
 	{
 		m_NumPositions = channel->mNumPositionKeys;
-
+		m_Positions = arena.AllocateArray<KeyPosition>(m_NumPositions);
 		for (int positionIndex = 0; positionIndex < m_NumPositions; ++positionIndex)
 		{
 			aiVector3D aiPosition = channel->mPositionKeys[positionIndex].mValue;
 			float timeStamp = channel->mPositionKeys[positionIndex].mTime;
-			KeyPosition data;
+			KeyPosition& data = m_Positions[positionIndex];
 			data.position = AssimpGLMHelpers::GetGLMVec(aiPosition);
 			data.timeStamp = timeStamp;
-			m_Positions.push_back(data);
 		}
 
 		m_NumRotations = channel->mNumRotationKeys;
+		m_Rotations = arena.AllocateArray<KeyRotation>(m_NumRotations);
 		for (int rotationIndex = 0; rotationIndex < m_NumRotations; ++rotationIndex)
 		{
 			aiQuaternion aiOrientation = channel->mRotationKeys[rotationIndex].mValue;
 			float timeStamp = channel->mRotationKeys[rotationIndex].mTime;
-			KeyRotation data;
+			KeyRotation& data = m_Rotations[rotationIndex];
 			data.orientation = AssimpGLMHelpers::GetGLMQuat(aiOrientation);
 			data.timeStamp = timeStamp;
-			m_Rotations.push_back(data);
 		}
 
 		m_NumScalings = channel->mNumScalingKeys;
+		m_Scales = arena.AllocateArray<KeyScale>(m_NumScalings);
 		for (int keyIndex = 0; keyIndex < m_NumScalings; ++keyIndex)
 		{
 			aiVector3D scale = channel->mScalingKeys[keyIndex].mValue;
 			float timeStamp = channel->mScalingKeys[keyIndex].mTime;
-			KeyScale data;
+			KeyScale& data = m_Scales[keyIndex];
 			data.scale = AssimpGLMHelpers::GetGLMVec(scale);
 			data.timeStamp = timeStamp;
-			m_Scales.push_back(data);
 		}
 	}
 
+	// arena bytes the bone for channel takes, without its name
+	static size_t ArenaBytes(const aiNodeAnim* channel)
+	{
+		return channel->mNumPositionKeys * sizeof(KeyPosition) + channel->mNumRotationKeys * sizeof(KeyRotation)
+			+ channel->mNumScalingKeys * sizeof(KeyScale) + 3 * alignof(std::max_align_t);
+	}
+
 	void Update(float animationTime)
 	{
 		glm::mat4 translation = InterpolatePosition(animationTime);
@@ -81,7 +91,7 @@ public:
 		m_LocalTransform = translation * rotation * scale;
 	}
 	glm::mat4 GetLocalTransform() { return m_LocalTransform; }
-	std::string GetBoneName() const { return m_Name; }
+	const char* GetBoneName() const { return m_Name; }
 	int GetBoneID() { return m_ID; }
 
 
@@ -175,14 +185,14 @@ private:
 		return glm::scale(glm::mat4(1.0f), finalScale);
 	}
 
-	std::vector<KeyPosition> m_Positions;
-	std::vector<KeyRotation> m_Rotations;
-	std::vector<KeyScale> m_Scales;
-	int m_NumPositions;
-	int m_NumRotations;
-	int m_NumScalings;
+	KeyPosition* m_Positions = nullptr;
+	KeyRotation* m_Rotations = nullptr;
+	KeyScale* m_Scales = nullptr;
+	int m_NumPositions = 0;
+	int m_NumRotations = 0;
+	int m_NumScalings = 0;
 
+	const char* m_Name = nullptr;
+	int m_ID = -1;
 	glm::mat4 m_LocalTransform;
-	std::string m_Name;
-	int m_ID;
 };
@@ -0,0 +1,415 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+#include "frustum_culler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+// how the proxies moved since the counters were last reset
+struct BvhStats {
+    // the new box still fit the padded one
+    size_t unchanged = 0;
+    // the padded box was moved in place and its ancestors refit
+    size_t refits = 0;
+    // the proxy was taken out and inserted again
+    size_t reinserts = 0;
+};
+
+// A dynamic bounding volume hierarchy over boxes, for finding the objects in a region without testing them all. Each
+// proxy is a leaf holding its box padded by fatMargin, so small movements don't touch the tree at all. An object that
+// leaves its padded box but still overlaps it is refit: its leaf takes the new box and the boxes above it are
+// recomputed, like for the slowly turning statue or the swimming fish. One that jumped further is reinserted. Leaves
+// go where they grow the surface area of the tree least, and the tree is kept balanced with AVL rotations on the way
+// back up, so queries visit O(log n) nodes plus the ones they report. Nodes live in one array, freed ones are reused.
+class DynamicBvh
+{
+public:
+    // padding on every side of a leaf, as a fraction of the box size
+    float fatMargin = 0.1f;
+
+    // returns the proxy, valid until Remove
+    int Insert(const BoundingBox& box, int userData)
+    {
+        int leaf = AllocateNode();
+        m_Nodes[leaf].box = Fatten(box);
+        m_Nodes[leaf].userData = userData;
+        m_Nodes[leaf].height = 0;
+        InsertLeaf(leaf);
+        m_Leaves++;
+        return leaf;
+    }
+
+    void Remove(int proxy)
+    {
+        RemoveLeaf(proxy);
+        FreeNode(proxy);
+        m_Leaves--;
+    }
+
+    // the object of proxy is now at box; true when the tree changed
+    bool Move(int proxy, const BoundingBox& box)
+    {
+        Node& leaf = m_Nodes[proxy];
+        if (leaf.box.Contains(box))
+        {
+            m_Stats.unchanged++;
+            return false;
+        }
+        BoundingBox fat = Fatten(box);
+        if (leaf.box.Overlaps(fat))
+        {
+            leaf.box = fat;
+            Refit(leaf.parent);
+            m_Stats.refits++;
+            return true;
+        }
+        RemoveLeaf(proxy);
+        m_Nodes[proxy].box = fat;
+        InsertLeaf(proxy);
+        m_Stats.reinserts++;
+        return true;
+    }
+
+    int UserData(int proxy) const { return m_Nodes[proxy].userData; }
+    const BoundingBox& FatBox(int proxy) const { return m_Nodes[proxy].box; }
+    size_t Count() const { return m_Leaves; }
+    int Height() const { return m_Root < 0 ? 0 : m_Nodes[m_Root].height; }
+
+    const BvhStats& Stats() const { return m_Stats; }
+    void ResetStats() { m_Stats = BvhStats(); }
+
+    // calls visit(userData) for every proxy whose padded box intersects the frustum; subtrees fully inside are
+    // reported without testing their nodes
+    template <typename Visit>
+    void QueryFrustum(const Frustum& frustum, Visit visit) const
+    {
+        if (m_Root < 0)
+            return;
+        int stack[kMaxStack];
+        int count = 0;
+        stack[count++] = m_Root;
+        while (count > 0)
+        {
+            int index = stack[--count];
+            const Node& node = m_Nodes[index];
+            if (!frustum.IntersectsBox(node.box.minimum, node.box.maximum))
+                continue;
+            if (node.IsLeaf())
+                visit(node.userData);
+            else if (frustum.ContainsBox(node.box.minimum, node.box.maximum))
+                VisitAll(index, visit);
+            else
+            {
+                stack[count++] = node.left;
+                stack[count++] = node.right;
+            }
+        }
+    }
+
+    // calls visit(userData) for every proxy whose padded box is within radius of center
+    template <typename Visit>
+    void QuerySphere(const glm::vec3& center, float radius, Visit visit) const
+    {
+        if (m_Root < 0)
+            return;
+        int stack[kMaxStack];
+        int count = 0;
+        stack[count++] = m_Root;
+        while (count > 0)
+        {
+            const Node& node = m_Nodes[stack[--count]];
+            // squared distance from the center to the closest point of the box
+            glm::vec3 closest = glm::clamp(center, node.box.minimum, node.box.maximum);
+            glm::vec3 offset = closest - center;
+            if (glm::dot(offset, offset) > radius * radius)
+                continue;
+            if (node.IsLeaf())
+                visit(node.userData);
+            else
+            {
+                stack[count++] = node.left;
+                stack[count++] = node.right;
+            }
+        }
+    }
+
+    // calls visit(userData, distance) for the proxies whose padded box the ray enters within maxDistance, the nearer
+    // child first; visit returns how far the ray still goes, maxDistance to see everything along it, the distance it
+    // was given to find the nearest hit, 0 to stop
+    template <typename Visit>
+    void QueryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Visit visit) const
+    {
+        if (m_Root < 0)
+            return;
+        glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        int stack[kMaxStack];
+        int count = 0;
+        stack[count++] = m_Root;
+        while (count > 0 && maxDistance > 0.0f)
+        {
+            const Node& node = m_Nodes[stack[--count]];
+            float distance;
+            if (!RayEnters(node.box, origin, inverse, maxDistance, distance))
+                continue;
+            if (node.IsLeaf())
+            {
+                maxDistance = std::min(maxDistance, visit(node.userData, distance));
+                continue;
+            }
+            float leftDistance, rightDistance;
+            bool left = RayEnters(m_Nodes[node.left].box, origin, inverse, maxDistance, leftDistance);
+            bool right = RayEnters(m_Nodes[node.right].box, origin, inverse, maxDistance, rightDistance);
+            // the nearer one goes on top
+            if (left && right && leftDistance < rightDistance)
+            {
+                stack[count++] = node.right;
+                stack[count++] = node.left;
+            }
+            else
+            {
+                if (left)
+                    stack[count++] = node.left;
+                if (right)
+                    stack[count++] = node.right;
+            }
+        }
+    }
+
+private:
+    static const int kNull = -1;
+    // a balanced tree of a billion leaves is about 45 high, every level leaves at most one node on the stack
+    static const int kMaxStack = 128;
+
+    struct Node {
+        BoundingBox box;
+        int parent = kNull;
+        // kNull for leaves; free nodes chain through left
+        int left = kNull, right = kNull;
+        // 0 for leaves, -1 for free nodes
+        int height = -1;
+        int userData = -1;
+
+        bool IsLeaf() const { return left == kNull; }
+    };
+
+    vector<Node> m_Nodes;
+    int m_Root = kNull;
+    int m_FreeList = kNull;
+    size_t m_Leaves = 0;
+    BvhStats m_Stats;
+
+    BoundingBox Fatten(const BoundingBox& box) const
+    {
+        glm::vec3 padding = (box.maximum - box.minimum) * fatMargin;
+        return BoundingBox{ box.minimum - padding, box.maximum + padding };
+    }
+
+    int AllocateNode()
+    {
+        if (m_FreeList == kNull)
+        {
+            m_Nodes.push_back(Node());
+            return int(m_Nodes.size()) - 1;
+        }
+        int index = m_FreeList;
+        m_FreeList = m_Nodes[index].left;
+        m_Nodes[index] = Node();
+        return index;
+    }
+
+    void FreeNode(int index)
+    {
+        m_Nodes[index].left = m_FreeList;
+        m_Nodes[index].height = -1;
+        m_FreeList = index;
+    }
+
+    void InsertLeaf(int leaf)
+    {
+        if (m_Root == kNull)
+        {
+            m_Root = leaf;
+            m_Nodes[leaf].parent = kNull;
+            return;
+        }
+
+        // walk down to the sibling that makes the cheapest parent, counting the growth of every box on the way
+        BoundingBox box = m_Nodes[leaf].box;
+        int index = m_Root;
+        while (!m_Nodes[index].IsLeaf())
+        {
+            const Node& node = m_Nodes[index];
+            float area = node.box.SurfaceArea();
+            float combinedArea = node.box.Union(box).SurfaceArea();
+            // a new parent of this node and the leaf
+            float cost = 2.0f * combinedArea;
+            // what descending adds to this node
+            float inheritance = 2.0f * (combinedArea - area);
+            float leftCost = DescendCost(node.left, box) + inheritance;
+            float rightCost = DescendCost(node.right, box) + inheritance;
+            if (cost < leftCost && cost < rightCost)
+                break;
+            index = leftCost < rightCost ? node.left : node.right;
+        }
+
+        int sibling = index;
+        int oldParent = m_Nodes[sibling].parent;
+        int newParent = AllocateNode();
+        m_Nodes[newParent].parent = oldParent;
+        m_Nodes[newParent].box = box.Union(m_Nodes[sibling].box);
+        m_Nodes[newParent].height = m_Nodes[sibling].height + 1;
+        m_Nodes[newParent].left = sibling;
+        m_Nodes[newParent].right = leaf;
+        m_Nodes[sibling].parent = newParent;
+        m_Nodes[leaf].parent = newParent;
+        if (oldParent == kNull)
+            m_Root = newParent;
+        else if (m_Nodes[oldParent].left == sibling)
+            m_Nodes[oldParent].left = newParent;
+        else
+            m_Nodes[oldParent].right = newParent;
+
+        Refit(m_Nodes[leaf].parent);
+    }
+
+    float DescendCost(int child, const BoundingBox& box) const
+    {
+        const Node& node = m_Nodes[child];
+        float combinedArea = node.box.Union(box).SurfaceArea();
+        return node.IsLeaf() ? combinedArea : combinedArea - node.box.SurfaceArea();
+    }
+
+    void RemoveLeaf(int leaf)
+    {
+        if (leaf == m_Root)
+        {
+            m_Root = kNull;
+            return;
+        }
+        int parent = m_Nodes[leaf].parent;
+        int grandParent = m_Nodes[parent].parent;
+        int sibling = m_Nodes[parent].left == leaf ? m_Nodes[parent].right : m_Nodes[parent].left;
+        // the sibling takes the place of the parent
+        m_Nodes[sibling].parent = grandParent;
+        if (grandParent == kNull)
+            m_Root = sibling;
+        else
+        {
+            if (m_Nodes[grandParent].left == parent)
+                m_Nodes[grandParent].left = sibling;
+            else
+                m_Nodes[grandParent].right = sibling;
+        }
+        FreeNode(parent);
+        Refit(grandParent);
+    }
+
+    // rebalances and recomputes the boxes and heights from index up to the root
+    void Refit(int index)
+    {
+        while (index != kNull)
+        {
+            index = Balance(index);
+            Node& node = m_Nodes[index];
+            node.box = m_Nodes[node.left].box.Union(m_Nodes[node.right].box);
+            node.height = 1 + std::max(m_Nodes[node.left].height, m_Nodes[node.right].height);
+            index = node.parent;
+        }
+    }
+
+    // rotates the taller child of a up if the heights of its children differ by more than one, returns the node now
+    // in a's place
+    int Balance(int a)
+    {
+        Node& nodeA = m_Nodes[a];
+        if (nodeA.IsLeaf() || nodeA.height < 2)
+            return a;
+        int b = nodeA.left;
+        int c = nodeA.right;
+        int balance = m_Nodes[c].height - m_Nodes[b].height;
+        if (balance > 1)
+            return Rotate(a, c, b, false);
+        if (balance < -1)
+            return Rotate(a, b, c, true);
+        return a;
+    }
+
+    // up takes a's place, a keeps other and the lower child of up, up keeps a and its higher child
+    int Rotate(int a, int up, int other, bool upIsLeft)
+    {
+        Node& nodeA = m_Nodes[a];
+        Node& nodeUp = m_Nodes[up];
+        int f = nodeUp.left;
+        int g = nodeUp.right;
+
+        nodeUp.parent = nodeA.parent;
+        nodeA.parent = up;
+        if (nodeUp.parent == kNull)
+            m_Root = up;
+        else if (m_Nodes[nodeUp.parent].left == a)
+            m_Nodes[nodeUp.parent].left = up;
+        else
+            m_Nodes[nodeUp.parent].right = up;
+
+        int higher = m_Nodes[f].height > m_Nodes[g].height ? f : g;
+        int lower = higher == f ? g : f;
+        nodeUp.left = a;
+        nodeUp.right = higher;
+        // the lower child goes where up came from
+        if (upIsLeft)
+            nodeA.left = lower;
+        else
+            nodeA.right = lower;
+        m_Nodes[lower].parent = a;
+
+        nodeA.box = m_Nodes[other].box.Union(m_Nodes[lower].box);
+        nodeA.height = 1 + std::max(m_Nodes[other].height, m_Nodes[lower].height);
+        nodeUp.box = nodeA.box.Union(m_Nodes[higher].box);
+        nodeUp.height = 1 + std::max(nodeA.height, m_Nodes[higher].height);
+        return up;
+    }
+
+    template <typename Visit>
+    void VisitAll(int root, Visit& visit) const
+    {
+        int stack[kMaxStack];
+        int count = 0;
+        stack[count++] = root;
+        while (count > 0)
+        {
+            const Node& node = m_Nodes[stack[--count]];
+            if (node.IsLeaf())
+                visit(node.userData);
+            else
+            {
+                stack[count++] = node.left;
+                stack[count++] = node.right;
+            }
+        }
+    }
+
+    // slab test; distance is where the ray enters the box, 0 when it starts inside
+    static bool RayEnters(const BoundingBox& box, const glm::vec3& origin, const glm::vec3& inverse, float maxDistance, float& distance)
+    {
+        float enter = 0.0f, leave = maxDistance;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t0 = (box.minimum[axis] - origin[axis]) * inverse[axis];
+            float t1 = (box.maximum[axis] - origin[axis]) * inverse[axis];
+            // a ray parallel to a slab it starts outside of gets two infinities of the same sign and is rejected
+            enter = std::max(enter, std::min(t0, t1));
+            leave = std::min(leave, std::max(t0, t1));
+        }
+        distance = enter;
+        return enter <= leave;
+    }
+};
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+#ifndef FRAME_DATA_H
+#define FRAME_DATA_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_state.h"
+
+#include <cstddef>
+#include <cstring>
+using namespace std;
+
+// The FrameData uniform block of commonShaders/FrameData.txt in std140 layout: every vec3 starts on 16 bytes and a
+// float after it fills the rest of its row, structs start and end on 16 bytes. The padding members keep the offsets
+// of the GLSL block, the asserts below check them.
+struct FrameDirLight {
+    glm::vec3 direction; float pad0;
+    glm::vec3 color; float pad1;
+    glm::vec3 ambient; float pad2;
+    glm::vec3 diffuse; float pad3;
+    glm::vec3 specular; float pad4;
+};
+
+struct FramePointLight {
+    glm::vec3 position; float pad0;
+    glm::vec3 color;
+    float linear;
+    float quadratic; float pad1[3];
+    glm::vec3 ambient; float pad2;
+    glm::vec3 diffuse; float pad3;
+    glm::vec3 specular; float pad4;
+};
+
+struct FrameSpotLight {
+    glm::vec3 position; float pad0;
+    glm::vec3 color; float pad1;
+    glm::vec3 direction;
+    float cutOff;
+    float outerCutOff;
+    float linear;
+    float quadratic; float pad2;
+    glm::vec3 ambient; float pad3;
+    glm::vec3 diffuse; float pad4;
+    glm::vec3 specular; float pad5;
+};
+
+struct FrameData {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 viewPos; float pad0;
+    FrameDirLight dirLight;
+    FramePointLight pointLight;
+    FrameSpotLight spotLight;
+};
+
+static_assert(sizeof(FrameDirLight) == 80, "std140 DirLight is 80 bytes");
+static_assert(offsetof(FramePointLight, linear) == 28 && offsetof(FramePointLight, ambient) == 48 && sizeof(FramePointLight) == 96, "std140 PointLight layout");
+static_assert(offsetof(FrameSpotLight, cutOff) == 44 && offsetof(FrameSpotLight, ambient) == 64 && sizeof(FrameSpotLight) == 112, "std140 SpotLight layout");
+static_assert(offsetof(FrameData, dirLight) == 144 && offsetof(FrameData, pointLight) == 224 && offsetof(FrameData, spotLight) == 320, "std140 FrameData layout");
+
+// The uniform buffer holding FrameData, bound to kBindingPoint where every Shader that declares the block reads it.
+// Update uploads only when the data differs from the last upload, so a frame without camera or light changes costs
+// no buffer write at all.
+class FrameUniforms
+{
+public:
+    static const GLuint kBindingPoint = 0;
+
+    // true when the buffer was written
+    bool Update(const FrameData& data)
+    {
+        if (!m_Buffer)
+        {
+            glGenBuffers(1, &m_Buffer);
+            GLState::Instance().BindBuffer(GL_UNIFORM_BUFFER, m_Buffer);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), nullptr, GL_DYNAMIC_DRAW);
+            glBindBufferBase(GL_UNIFORM_BUFFER, kBindingPoint, m_Buffer);
+        }
+        else if (m_Uploaded && memcmp(&m_Data, &data, sizeof(FrameData)) == 0)
+            return false;
+        GLState::Instance().BindBuffer(GL_UNIFORM_BUFFER, m_Buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &data);
+        m_Data = data;
+        m_Uploaded = true;
+        m_Uploads++;
+        return true;
+    }
+
+    size_t Uploads() const { return m_Uploads; }
+
+private:
+    unsigned int m_Buffer = 0;
+    FrameData m_Data;
+    bool m_Uploaded = false;
+    size_t m_Uploads = 0;
+};
+#endif
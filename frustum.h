@@ -0,0 +1,69 @@
+#pragma once
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// The six clip planes of a projection, extracted from a (model-)view-projection matrix (Gribb & Hartmann). Extracted from
+// projection * view the planes are in world space, from projection * view * model they are in that model's space.
+// Plane normals point inside and are normalized, so plane . (p, 1) is a signed distance.
+struct Frustum {
+    enum { LEFT = 0, RIGHT, BOTTOM, TOP, NEAR, FAR };
+    glm::vec4 planes[6];
+
+    static Frustum FromMatrix(const glm::mat4& m)
+    {
+        Frustum frustum;
+        // glm matrices are column major, row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        frustum.planes[LEFT] = row3 + row0;
+        frustum.planes[RIGHT] = row3 - row0;
+        frustum.planes[BOTTOM] = row3 + row1;
+        frustum.planes[TOP] = row3 - row1;
+        frustum.planes[NEAR] = row3 + row2;
+        frustum.planes[FAR] = row3 - row2;
+        for (int i = 0; i < 6; i++)
+            frustum.planes[i] = frustum.planes[i] / glm::length(glm::vec3(frustum.planes[i]));
+        return frustum;
+    }
+
+    bool IntersectsSphere(const glm::vec3& center, float radius) const
+    {
+        for (int i = 0; i < 6; i++)
+            if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+                return false;
+        return true;
+    }
+
+    bool IntersectsBox(const glm::vec3& minimum, const glm::vec3& maximum) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            // the box corner furthest along the plane normal
+            glm::vec3 positive(planes[i].x >= 0.0f ? maximum.x : minimum.x,
+                planes[i].y >= 0.0f ? maximum.y : minimum.y,
+                planes[i].z >= 0.0f ? maximum.z : minimum.z);
+            if (glm::dot(glm::vec3(planes[i]), positive) + planes[i].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    // true when the whole box is inside, the nearest corner along every plane normal being on the inner side
+    bool ContainsBox(const glm::vec3& minimum, const glm::vec3& maximum) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            glm::vec3 negative(planes[i].x >= 0.0f ? minimum.x : maximum.x,
+                planes[i].y >= 0.0f ? minimum.y : maximum.y,
+                planes[i].z >= 0.0f ? minimum.z : maximum.z);
+            if (glm::dot(glm::vec3(planes[i]), negative) + planes[i].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,169 @@
+#pragma once
+#ifndef FRUSTUM_CULLER_H
+#define FRUSTUM_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_CULLER_AVX 1
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_CULLER_SSE 1
+#endif
+
+// an axis aligned box, in object or world space
+struct BoundingBox {
+    glm::vec3 minimum = glm::vec3(0.0f), maximum = glm::vec3(0.0f);
+
+    // the box around this one moved by model
+    BoundingBox Transformed(const glm::mat4& model) const
+    {
+        glm::vec3 center = glm::vec3(model * glm::vec4((minimum + maximum) * 0.5f, 1.0f));
+        glm::vec3 extent = (maximum - minimum) * 0.5f;
+        // each axis reaches as far as the absolute columns of the matrix carry the extent
+        glm::vec3 worldExtent = glm::abs(glm::vec3(model[0])) * extent.x + glm::abs(glm::vec3(model[1])) * extent.y
+            + glm::abs(glm::vec3(model[2])) * extent.z;
+        return BoundingBox{ center - worldExtent, center + worldExtent };
+    }
+
+    // grown or shrunk by factor around its center
+    BoundingBox Scaled(float factor) const
+    {
+        glm::vec3 center = (minimum + maximum) * 0.5f;
+        glm::vec3 extent = (maximum - minimum) * 0.5f * factor;
+        return BoundingBox{ center - extent, center + extent };
+    }
+
+    BoundingBox Union(const BoundingBox& other) const
+    {
+        return BoundingBox{ glm::min(minimum, other.minimum), glm::max(maximum, other.maximum) };
+    }
+
+    bool Contains(const BoundingBox& other) const
+    {
+        return minimum.x <= other.minimum.x && minimum.y <= other.minimum.y && minimum.z <= other.minimum.z
+            && other.maximum.x <= maximum.x && other.maximum.y <= maximum.y && other.maximum.z <= maximum.z;
+    }
+
+    bool Overlaps(const BoundingBox& other) const
+    {
+        return minimum.x <= other.maximum.x && other.minimum.x <= maximum.x && minimum.y <= other.maximum.y
+            && other.minimum.y <= maximum.y && minimum.z <= other.maximum.z && other.minimum.z <= maximum.z;
+    }
+
+    float SurfaceArea() const
+    {
+        glm::vec3 size = maximum - minimum;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+};
+
+// what the last Cull did
+struct FrustumCullingStats {
+    size_t tested = 0;
+    size_t culled = 0;
+};
+
+// Tests the world space boxes of a frame against the view frustum all at once. The boxes are kept as six arrays, one
+// per coordinate, so a plane is tested against four boxes per SSE instruction (eight with AVX): per plane only the
+// corner furthest along its normal matters, and which of min and max that is doesn't depend on the box, so it picks
+// the arrays to load rather than a lane mask. Add the boxes, Cull, then read Visible by the index Add returned.
+class FrustumCuller
+{
+public:
+    void Clear()
+    {
+        m_MinX.clear(); m_MinY.clear(); m_MinZ.clear();
+        m_MaxX.clear(); m_MaxY.clear(); m_MaxZ.clear();
+        m_Visible.clear();
+    }
+
+    // a box in world space
+    size_t Add(const BoundingBox& bounds)
+    {
+        m_MinX.push_back(bounds.minimum.x); m_MinY.push_back(bounds.minimum.y); m_MinZ.push_back(bounds.minimum.z);
+        m_MaxX.push_back(bounds.maximum.x); m_MaxY.push_back(bounds.maximum.y); m_MaxZ.push_back(bounds.maximum.z);
+        return m_MinX.size() - 1;
+    }
+
+    // an object space box placed by model
+    size_t Add(const BoundingBox& bounds, const glm::mat4& model)
+    {
+        return Add(bounds.Transformed(model));
+    }
+
+    size_t Size() const { return m_MinX.size(); }
+
+    // frustum in world space, from projection * view; returns how many boxes are outside
+    size_t Cull(const Frustum& frustum)
+    {
+        size_t count = Size();
+        m_Visible.assign(count, 1);
+        size_t i = 0;
+#if defined(FRUSTUM_CULLER_AVX)
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < 6; p++)
+            {
+                const glm::vec4& plane = frustum.planes[p];
+                __m256 x = _mm256_loadu_ps((plane.x >= 0.0f ? m_MaxX : m_MinX).data() + i);
+                __m256 y = _mm256_loadu_ps((plane.y >= 0.0f ? m_MaxY : m_MinY).data() + i);
+                __m256 z = _mm256_loadu_ps((plane.z >= 0.0f ? m_MaxZ : m_MinZ).data() + i);
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)), _mm256_mul_ps(y, _mm256_set1_ps(plane.y))),
+                    _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+            }
+            StoreMask(_mm256_movemask_ps(inside), i, 8);
+        }
+#elif defined(FRUSTUM_CULLER_SSE)
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+            for (int p = 0; p < 6; p++)
+            {
+                const glm::vec4& plane = frustum.planes[p];
+                __m128 x = _mm_loadu_ps((plane.x >= 0.0f ? m_MaxX : m_MinX).data() + i);
+                __m128 y = _mm_loadu_ps((plane.y >= 0.0f ? m_MaxY : m_MinY).data() + i);
+                __m128 z = _mm_loadu_ps((plane.z >= 0.0f ? m_MaxZ : m_MinZ).data() + i);
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                    _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+            }
+            StoreMask(_mm_movemask_ps(inside), i, 4);
+        }
+#endif
+        for (; i < count; i++)
+            m_Visible[i] = frustum.IntersectsBox(glm::vec3(m_MinX[i], m_MinY[i], m_MinZ[i]), glm::vec3(m_MaxX[i], m_MaxY[i], m_MaxZ[i])) ? 1 : 0;
+
+        m_Stats.tested = count;
+        m_Stats.culled = 0;
+        for (uint8_t visible : m_Visible)
+            m_Stats.culled += visible ? 0 : 1;
+        return m_Stats.culled;
+    }
+
+    bool Visible(size_t index) const { return index >= m_Visible.size() || m_Visible[index] != 0; }
+
+    const FrustumCullingStats& Stats() const { return m_Stats; }
+
+private:
+    vector<float> m_MinX, m_MinY, m_MinZ, m_MaxX, m_MaxY, m_MaxZ;
+    vector<uint8_t> m_Visible;
+    FrustumCullingStats m_Stats;
+
+    void StoreMask(int mask, size_t first, int lanes)
+    {
+        for (int lane = 0; lane < lanes; lane++)
+            m_Visible[first + lane] = uint8_t((mask >> lane) & 1);
+    }
+};
+#endif
@@ -0,0 +1,269 @@
+#pragma once
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+using namespace std;
+
+// Shadows the GL state the renderer changes all the time: the program, the vertex array, the textures per unit and
+// target, the buffer bindings, the capabilities and the depth and blend settings. A call that wouldn't change
+// anything is dropped. Only state changed through here is known, so every bind of these kinds goes through it; code
+// that changes them behind its back calls Invalidate. Everything starts out unknown, the first call always goes to GL.
+class GLState
+{
+public:
+    enum Kind { PROGRAM = 0, VERTEX_ARRAY, ACTIVE_TEXTURE, TEXTURE, BUFFER, CAPABILITY, DEPTH, BLEND, KIND_COUNT };
+
+    struct Counters {
+        size_t issued[KIND_COUNT] = {};
+        size_t elided[KIND_COUNT] = {};
+
+        size_t Issued() const { return Sum(issued); }
+        size_t Elided() const { return Sum(elided); }
+
+    private:
+        static size_t Sum(const size_t* counts)
+        {
+            size_t total = 0;
+            for (int kind = 0; kind < KIND_COUNT; kind++)
+                total += counts[kind];
+            return total;
+        }
+    };
+
+    static const int kTextureUnits = 16;
+
+    static GLState& Instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    static const char* KindName(Kind kind)
+    {
+        static const char* names[KIND_COUNT] = { "program", "vertex array", "active texture", "texture", "buffer", "capability", "depth", "blend" };
+        return names[kind];
+    }
+
+    // the Use and Bind calls return whether they went to GL
+    bool UseProgram(GLuint program)
+    {
+        if (!Changes(PROGRAM, m_Program, program))
+            return false;
+        glUseProgram(program);
+        return true;
+    }
+
+    bool BindVertexArray(GLuint vertexArray)
+    {
+        if (!Changes(VERTEX_ARRAY, m_VertexArray, vertexArray))
+            return false;
+        glBindVertexArray(vertexArray);
+        // the element buffer binding belongs to the vertex array
+        m_Buffers[ELEMENT_ARRAY_SLOT] = kUnknown;
+        return true;
+    }
+
+    void ActiveTexture(int unit)
+    {
+        if (Changes(ACTIVE_TEXTURE, m_ActiveUnit, GLuint(unit)))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    bool BindTexture(int unit, GLenum target, GLuint texture)
+    {
+        GLuint* bound = TextureSlot(unit, target);
+        if (bound && *bound == texture)
+        {
+            m_Counters.elided[TEXTURE]++;
+            return false;
+        }
+        ActiveTexture(unit);
+        glBindTexture(target, texture);
+        m_Counters.issued[TEXTURE]++;
+        if (bound)
+            *bound = texture;
+        return true;
+    }
+
+    // binds to the active unit, for texture uploads
+    bool BindTexture(GLenum target, GLuint texture)
+    {
+        if (m_ActiveUnit == kUnknown)
+            ActiveTexture(0);
+        return BindTexture(int(m_ActiveUnit), target, texture);
+    }
+
+    bool BindBuffer(GLenum target, GLuint buffer)
+    {
+        int slot = BufferSlot(target);
+        if (slot < 0)
+        {
+            m_Counters.issued[BUFFER]++;
+            glBindBuffer(target, buffer);
+            return true;
+        }
+        if (!Changes(BUFFER, m_Buffers[slot], buffer))
+            return false;
+        glBindBuffer(target, buffer);
+        return true;
+    }
+
+    void SetCapability(GLenum capability, bool enabled)
+    {
+        int slot = CapabilitySlot(capability);
+        if (slot >= 0 && !Changes(CAPABILITY, m_Capabilities[slot], GLuint(enabled)))
+            return;
+        if (slot < 0)
+            m_Counters.issued[CAPABILITY]++;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+    void Enable(GLenum capability) { SetCapability(capability, true); }
+    void Disable(GLenum capability) { SetCapability(capability, false); }
+
+    void DepthMask(bool write)
+    {
+        if (Changes(DEPTH, m_DepthMask, GLuint(write)))
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    void DepthFunc(GLenum function)
+    {
+        if (Changes(DEPTH, m_DepthFunc, function))
+            glDepthFunc(function);
+    }
+
+    void BlendFunc(GLenum source, GLenum destination)
+    {
+        if (m_BlendSource == source && m_BlendDestination == destination)
+        {
+            m_Counters.elided[BLEND]++;
+            return;
+        }
+        glBlendFunc(source, destination);
+        m_Counters.issued[BLEND]++;
+        m_BlendSource = source;
+        m_BlendDestination = destination;
+    }
+
+    // GL unbinds deleted objects, and a new object may get the same name; call these before the glDelete
+    void ForgetTexture(GLuint texture)
+    {
+        for (int unit = 0; unit < kTextureUnits; unit++)
+            for (GLuint& bound : m_Textures[unit])
+                if (bound == texture)
+                    bound = kUnknown;
+    }
+
+    void ForgetVertexArray(GLuint vertexArray)
+    {
+        if (m_VertexArray == vertexArray)
+            m_VertexArray = kUnknown;
+        m_Buffers[ELEMENT_ARRAY_SLOT] = kUnknown;
+    }
+
+    void ForgetBuffer(GLuint buffer)
+    {
+        for (GLuint& bound : m_Buffers)
+            if (bound == buffer)
+                bound = kUnknown;
+    }
+
+    // after GL calls that went around the cache
+    void Invalidate()
+    {
+        m_Program = m_VertexArray = m_ActiveUnit = kUnknown;
+        InvalidateTextures();
+        for (GLuint& bound : m_Buffers)
+            bound = kUnknown;
+        for (GLuint& capability : m_Capabilities)
+            capability = kUnknown;
+        m_DepthMask = m_DepthFunc = m_BlendSource = m_BlendDestination = kUnknown;
+    }
+
+    void InvalidateTextures()
+    {
+        for (int unit = 0; unit < kTextureUnits; unit++)
+            for (GLuint& bound : m_Textures[unit])
+                bound = kUnknown;
+    }
+
+    const Counters& GetCounters() const { return m_Counters; }
+    void ResetCounters() { m_Counters = Counters(); }
+
+private:
+    static const GLuint kUnknown = ~0u;
+    // the texture targets and buffer targets that are tracked, others always go to GL
+    enum { TEXTURE_TARGETS = 3, BUFFER_TARGETS = 4, ELEMENT_ARRAY_SLOT = 1, CAPABILITIES = 3 };
+
+    GLuint m_Program = kUnknown;
+    GLuint m_VertexArray = kUnknown;
+    GLuint m_ActiveUnit = kUnknown;
+    GLuint m_Textures[kTextureUnits][TEXTURE_TARGETS];
+    GLuint m_Buffers[BUFFER_TARGETS];
+    GLuint m_Capabilities[CAPABILITIES];
+    GLuint m_DepthMask = kUnknown, m_DepthFunc = kUnknown;
+    GLuint m_BlendSource = kUnknown, m_BlendDestination = kUnknown;
+    Counters m_Counters;
+
+    GLState()
+    {
+        Invalidate();
+    }
+
+    // records the new value and counts the call, false if it is already in place
+    bool Changes(Kind kind, GLuint& current, GLuint value)
+    {
+        if (current == value)
+        {
+            m_Counters.elided[kind]++;
+            return false;
+        }
+        current = value;
+        m_Counters.issued[kind]++;
+        return true;
+    }
+
+    GLuint* TextureSlot(int unit, GLenum target)
+    {
+        if (unit < 0 || unit >= kTextureUnits)
+            return nullptr;
+        switch (target)
+        {
+        case GL_TEXTURE_2D: return &m_Textures[unit][0];
+        case GL_TEXTURE_2D_ARRAY: return &m_Textures[unit][1];
+        case GL_TEXTURE_CUBE_MAP: return &m_Textures[unit][2];
+        default: return nullptr;
+        }
+    }
+
+    static int BufferSlot(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_ELEMENT_ARRAY_BUFFER: return ELEMENT_ARRAY_SLOT;
+        case GL_PIXEL_UNPACK_BUFFER: return 2;
+        case GL_UNIFORM_BUFFER: return 3;
+        default: return -1;
+        }
+    }
+
+    static int CapabilitySlot(GLenum capability)
+    {
+        switch (capability)
+        {
+        case GL_DEPTH_TEST: return 0;
+        case GL_BLEND: return 1;
+        case GL_CULL_FACE: return 2;
+        default: return -1;
+        }
+    }
+};
+#endif
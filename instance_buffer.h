@@ -0,0 +1,114 @@
+#pragma once
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_state.h"
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// what changes from one copy of a model to the next, read by the instanced shaders from locations 7 to 12
+struct InstanceData {
+    glm::mat4 model = glm::mat4(1.0f);
+    // multiplies the shaded colour, white leaves it as it is
+    glm::vec4 tint = glm::vec4(1.0f);
+    // seconds into the baked animation, for skinned models
+    float animationTime = 0.0f;
+};
+
+// The per instance vertex buffer of an instanced draw. Update streams the instances of this frame into it and Attach
+// points the instance attributes of the bound vertex array at it, advancing once per instance instead of per vertex,
+// so a whole crowd of one model is a single glDrawElementsInstanced. The attributes belong to the vertex array, so
+// Attach only sets them up when the vertex array last drew from another buffer.
+class InstanceBuffer
+{
+public:
+    static const GLuint kFirstLocation = 7;
+
+    void Update(const vector<InstanceData>& instances)
+    {
+        if (!m_Buffer)
+        {
+            glGenBuffers(1, &m_Buffer);
+            m_Id = NextId();
+        }
+        GLState::Instance().BindBuffer(GL_ARRAY_BUFFER, m_Buffer);
+        size_t size = instances.size() * sizeof(InstanceData);
+        if (size > m_Capacity)
+        {
+            glBufferData(GL_ARRAY_BUFFER, size, instances.data(), GL_STREAM_DRAW);
+            m_Capacity = size;
+        }
+        else
+        {
+            // orphan the storage the last frame may still be drawing from, then fill the new one
+            glBufferData(GL_ARRAY_BUFFER, m_Capacity, NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances.data());
+        }
+        m_Count = GLsizei(instances.size());
+    }
+
+    // sets up the instance attributes on vertexArray, which is bound, unless they already point here
+    void Attach(GLuint vertexArray) const
+    {
+        unsigned int& attached = AttachedIds()[vertexArray];
+        if (attached == m_Id)
+            return;
+        attached = m_Id;
+        GLState::Instance().BindBuffer(GL_ARRAY_BUFFER, m_Buffer);
+        // a mat4 takes four vec4 locations
+        for (GLuint column = 0; column < 4; column++)
+        {
+            glEnableVertexAttribArray(kFirstLocation + column);
+            glVertexAttribPointer(kFirstLocation + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(kFirstLocation + column, 1);
+        }
+        glEnableVertexAttribArray(kFirstLocation + 4);
+        glVertexAttribPointer(kFirstLocation + 4, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, tint));
+        glVertexAttribDivisor(kFirstLocation + 4, 1);
+        glEnableVertexAttribArray(kFirstLocation + 5);
+        glVertexAttribPointer(kFirstLocation + 5, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, animationTime));
+        glVertexAttribDivisor(kFirstLocation + 5, 1);
+    }
+
+    GLsizei Count() const { return m_Count; }
+
+    // call before deleting a vertex array, a new one may get the same name
+    static void ForgetVertexArray(GLuint vertexArray) { AttachedIds().erase(vertexArray); }
+
+    void Release()
+    {
+        GLState::Instance().ForgetBuffer(m_Buffer);
+        glDeleteBuffers(1, &m_Buffer);
+        m_Buffer = 0;
+        m_Id = 0;
+        m_Capacity = 0;
+        m_Count = 0;
+    }
+
+private:
+    unsigned int m_Buffer = 0;
+    // tells buffers apart where GL names are reused, 0 before the first Update
+    unsigned int m_Id = 0;
+    size_t m_Capacity = 0;
+    GLsizei m_Count = 0;
+
+    // the buffer each vertex array's instance attributes point at, by id
+    static unordered_map<GLuint, unsigned int>& AttachedIds()
+    {
+        static unordered_map<GLuint, unsigned int> attached;
+        return attached;
+    }
+
+    static unsigned int NextId()
+    {
+        static unsigned int last = 0;
+        return ++last;
+    }
+};
+#endif
@@ -0,0 +1,256 @@
+#pragma once
+#ifndef JSON_H
+#define JSON_H
+
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// A parsed JSON document, just enough for the scene files: objects keep their members in file order and are searched
+// linearly, numbers are doubles, and \u escapes outside ASCII are written out as UTF-8.
+class JsonValue
+{
+public:
+    enum Type { NUL = 0, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0.0;
+    string text;
+    vector<JsonValue> items;
+    vector<pair<string, JsonValue>> members;
+
+    bool IsNumber() const { return type == NUMBER; }
+    bool IsString() const { return type == STRING; }
+    bool IsArray() const { return type == ARRAY; }
+    bool IsObject() const { return type == OBJECT; }
+
+    // the member called key, nullptr if this isn't an object or has no such member
+    const JsonValue* Find(const string& key) const
+    {
+        for (const pair<string, JsonValue>& member : members)
+            if (member.first == key)
+                return &member.second;
+        return nullptr;
+    }
+
+    double Number(const string& key, double fallback) const
+    {
+        const JsonValue* value = Find(key);
+        return value && value->IsNumber() ? value->number : fallback;
+    }
+
+    bool Boolean(const string& key, bool fallback) const
+    {
+        const JsonValue* value = Find(key);
+        return value && value->type == BOOLEAN ? value->boolean : fallback;
+    }
+
+    string String(const string& key, const string& fallback = string()) const
+    {
+        const JsonValue* value = Find(key);
+        return value && value->IsString() ? value->text : fallback;
+    }
+
+    // false with error telling what and where when text isn't a single JSON value
+    static bool Parse(const char* text, size_t size, JsonValue& out, string& error)
+    {
+        Parser parser{ text, text + size, text, string() };
+        out = JsonValue();
+        bool parsed = parser.ParseValue(out, 0);
+        if (parsed)
+        {
+            parser.SkipSpace();
+            parsed = parser.position == parser.end || parser.Fail("trailing characters");
+        }
+        if (!parsed)
+        {
+            error = parser.error + " at byte " + to_string(parser.position - text);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Parser {
+        const char* begin;
+        const char* end;
+        const char* position;
+        string error;
+
+        static const int kMaxDepth = 256;
+
+        bool Fail(const char* message)
+        {
+            error = message;
+            return false;
+        }
+
+        void SkipSpace()
+        {
+            while (position != end && (*position == ' ' || *position == '\t' || *position == '\n' || *position == '\r'))
+                position++;
+        }
+
+        bool Literal(const char* word)
+        {
+            for (const char* c = word; *c; c++, position++)
+                if (position == end || *position != *c)
+                    return Fail("unknown literal");
+            return true;
+        }
+
+        bool ParseValue(JsonValue& value, int depth)
+        {
+            if (depth > kMaxDepth)
+                return Fail("nested too deep");
+            SkipSpace();
+            if (position == end)
+                return Fail("unexpected end");
+            switch (*position)
+            {
+            case '{': return ParseObject(value, depth);
+            case '[': return ParseArray(value, depth);
+            case '"': value.type = STRING; return ParseString(value.text);
+            case 't': value.type = BOOLEAN; value.boolean = true; return Literal("true");
+            case 'f': value.type = BOOLEAN; value.boolean = false; return Literal("false");
+            case 'n': value.type = NUL; return Literal("null");
+            default: return ParseNumber(value);
+            }
+        }
+
+        bool ParseNumber(JsonValue& value)
+        {
+            // strtod wants a terminated string, a number is short enough to copy
+            const char* start = position;
+            while (position != end && (isdigit((unsigned char)*position) || *position == '-' || *position == '+' || *position == '.'
+                || *position == 'e' || *position == 'E'))
+                position++;
+            string digits(start, position);
+            char* parsedEnd = nullptr;
+            value.type = NUMBER;
+            value.number = strtod(digits.c_str(), &parsedEnd);
+            if (digits.empty() || parsedEnd != digits.c_str() + digits.size())
+            {
+                position = start;
+                return Fail("invalid number");
+            }
+            return true;
+        }
+
+        bool ParseString(string& out)
+        {
+            position++;
+            while (position != end && *position != '"')
+            {
+                char c = *position++;
+                if (c != '\\')
+                {
+                    out += c;
+                    continue;
+                }
+                if (position == end)
+                    break;
+                char escape = *position++;
+                switch (escape)
+                {
+                case '"': case '\\': case '/': out += escape; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                {
+                    if (end - position < 4)
+                        return Fail("short \\u escape");
+                    unsigned int code = unsigned(strtoul(string(position, position + 4).c_str(), nullptr, 16));
+                    position += 4;
+                    if (code < 0x80)
+                        out += char(code);
+                    else if (code < 0x800)
+                    {
+                        out += char(0xC0 | (code >> 6));
+                        out += char(0x80 | (code & 0x3F));
+                    }
+                    else
+                    {
+                        out += char(0xE0 | (code >> 12));
+                        out += char(0x80 | ((code >> 6) & 0x3F));
+                        out += char(0x80 | (code & 0x3F));
+                    }
+                    break;
+                }
+                default: return Fail("unknown escape");
+                }
+            }
+            if (position == end)
+                return Fail("unterminated string");
+            position++;
+            return true;
+        }
+
+        bool ParseArray(JsonValue& value, int depth)
+        {
+            value.type = ARRAY;
+            position++;
+            SkipSpace();
+            if (position != end && *position == ']')
+            {
+                position++;
+                return true;
+            }
+            while (true)
+            {
+                value.items.emplace_back();
+                if (!ParseValue(value.items.back(), depth + 1))
+                    return false;
+                SkipSpace();
+                if (position == end)
+                    return Fail("unterminated array");
+                if (*position++ == ']')
+                    return true;
+                if (position[-1] != ',')
+                    return Fail("expected , or ]");
+            }
+        }
+
+        bool ParseObject(JsonValue& value, int depth)
+        {
+            value.type = OBJECT;
+            position++;
+            SkipSpace();
+            if (position != end && *position == '}')
+            {
+                position++;
+                return true;
+            }
+            while (true)
+            {
+                SkipSpace();
+                if (position == end || *position != '"')
+                    return Fail("expected a member name");
+                value.members.emplace_back();
+                if (!ParseString(value.members.back().first))
+                    return false;
+                SkipSpace();
+                if (position == end || *position++ != ':')
+                    return Fail("expected :");
+                if (!ParseValue(value.members.back().second, depth + 1))
+                    return false;
+                SkipSpace();
+                if (position == end)
+                    return Fail("unterminated object");
+                if (*position++ == '}')
+                    return true;
+                if (position[-1] != ',')
+                    return Fail("expected , or }");
+            }
+        }
+    };
+};
+#endif
@@ -0,0 +1,313 @@
+#pragma once
+#ifndef LAZY_MODEL_H
+#define LAZY_MODEL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <assimp/Importer.hpp>
+
+#include "frustum.h"
+#include "mesh.h"
+#include "model.h"
+#include "profiler.h"
+#include "proxy_cube.h"
+#include "render_queue.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+class LazyModel;
+
+// Loads the LazyModels once they are wanted and unloads them again under memory pressure. A model is wanted when the
+// camera is within its load distance, or when it is in the view and covers at least minVisiblePixels on screen; its
+// file is then imported with Assimp on a worker thread and Update builds the meshes on the GL thread, at most
+// importsPerFrame models a frame. Until then the model is drawn as its bounding box. When the buffers and textures of
+// the loaded models exceed memoryBudgetBytes, the ones the camera left longest ago are released again.
+class AssetStreamer
+{
+public:
+    // video memory the loaded lazy models may take, their vertex and index buffers and their textures as far as those
+    // have loaded
+    size_t memoryBudgetBytes = 256 * 1024 * 1024;
+    // a model is kept while the camera is within this multiple of its load distance, so one at the edge doesn't load
+    // and unload every frame
+    float unloadDistanceFactor = 1.5f;
+    // a model in view loads once it covers this many pixels on screen, wherever the camera is
+    float minVisiblePixels = 24.0f;
+    int importsPerFrame = 1;
+    // draw not yet loaded models as their bounding boxes
+    bool drawProxies = true;
+    glm::vec3 proxyColor = glm::vec3(0.04f, 0.05f, 0.07f);
+
+    static AssetStreamer& Instance()
+    {
+        static AssetStreamer streamer;
+        return streamer;
+    }
+
+    // finishes imports and unloads over budget, once per frame on the GL thread before the draws
+    void Update();
+
+    unsigned int Frame() const { return m_Frame; }
+    size_t RegisteredCount() const { return m_Models.size(); }
+    size_t LoadedCount() const;
+    size_t ResidentBytes() const;
+
+    // the box minimum..maximum in the space of model, in a flat colour; leaves the proxy program bound
+    void DrawProxy(const glm::vec3& minimum, const glm::vec3& maximum, const glm::mat4& model, const DrawView& view)
+    {
+        ProxyCube& cube = ProxyCube::Instance();
+        Shader& shader = cube.Bind(view.viewProjection);
+        shader.setMat4("model", ProxyCube::BoxMatrix(model, minimum, maximum));
+        shader.setVec3("color", proxyColor);
+        cube.Draw();
+    }
+
+private:
+    friend class LazyModel;
+
+    vector<LazyModel*> m_Models;
+    unsigned int m_Frame = 0;
+
+    void Register(LazyModel* model)
+    {
+        m_Models.push_back(model);
+    }
+
+    void Unregister(LazyModel* model)
+    {
+        m_Models.erase(std::remove(m_Models.begin(), m_Models.end(), model), m_Models.end());
+    }
+};
+
+// A static model registered with its bounds instead of loaded up front; AssetStreamer loads it when the draws find it
+// wanted. The object space bounds come from a .bounds file written next to the model the first time it loads, a model
+// without one is loaded on its first draw.
+class LazyModel
+{
+public:
+    LazyModel(const string& path, float loadDistance, ModelImportOptions options = ModelImportOptions())
+        : m_Path(path), m_Options(options), m_LoadDistance(loadDistance)
+    {
+        m_HasBounds = ReadBounds();
+        AssetStreamer::Instance().Register(this);
+    }
+
+    ~LazyModel()
+    {
+        AssetStreamer::Instance().Unregister(this);
+        // an import still running is waited for by the future
+    }
+
+    LazyModel(const LazyModel&) = delete;
+    LazyModel& operator=(const LazyModel&) = delete;
+
+    bool IsLoaded() const { return m_Model != nullptr; }
+    const string& Path() const { return m_Path; }
+    // the loaded model, nullptr until then
+    const Model* GetModel() const { return m_Model.get(); }
+
+    // object space box, known once the model was loaded or from the cached bounds of an earlier run
+    bool GetBounds(glm::vec3& minimum, glm::vec3& maximum) const
+    {
+        minimum = m_BoundsMin;
+        maximum = m_BoundsMax;
+        return m_HasBounds;
+    }
+
+    // draws the model if it is loaded and its proxy otherwise, and tells the streamer whether it is wanted; the shader
+    // is in use again afterwards
+    void Draw(Shader& shader, const glm::mat4& model, const DrawView& view)
+    {
+        if (Track(model, view))
+        {
+            m_Model->Draw(shader, model, view);
+            return;
+        }
+        if (m_HasBounds && AssetStreamer::Instance().drawProxies)
+        {
+            AssetStreamer::Instance().DrawProxy(m_BoundsMin, m_BoundsMax, model, view);
+            shader.use();
+        }
+    }
+
+    // like Draw, through the render queue
+    void Submit(RenderQueue& queue, Shader& shader, const glm::mat4& model, const DrawView& view)
+    {
+        if (Track(model, view))
+        {
+            queue.Submit(*m_Model, shader, model, view);
+            return;
+        }
+        if (m_HasBounds && AssetStreamer::Instance().drawProxies)
+        {
+            glm::vec3 minimum = m_BoundsMin, maximum = m_BoundsMax;
+            DrawView proxyView = view;
+            float depth = glm::length(glm::vec3(model * glm::vec4((minimum + maximum) * 0.5f, 1.0f)) - view.viewPos);
+            queue.SubmitCallback(PASS_OPAQUE, depth, [minimum, maximum, model, proxyView]() {
+                AssetStreamer::Instance().DrawProxy(minimum, maximum, model, proxyView);
+            });
+        }
+    }
+
+    // for a frame the model is culled in: tells the streamer about it like Draw, without drawing
+    void Skip(const glm::mat4& model, const DrawView& view)
+    {
+        Track(model, view);
+    }
+
+private:
+    friend class AssetStreamer;
+
+    string m_Path;
+    ModelImportOptions m_Options;
+    float m_LoadDistance;
+    bool m_HasBounds = false;
+    glm::vec3 m_BoundsMin = glm::vec3(0.0f), m_BoundsMax = glm::vec3(0.0f);
+    unique_ptr<Model> m_Model;
+    future<unique_ptr<Assimp::Importer>> m_Import;
+    unsigned int m_LastKeptFrame = 0;
+
+    // tells the streamer whether the model is wanted from view, starting its import if so; true when it is loaded
+    bool Track(const glm::mat4& model, const DrawView& view)
+    {
+        AssetStreamer& streamer = AssetStreamer::Instance();
+        bool wanted = !m_HasBounds;
+        bool kept = wanted;
+        if (m_HasBounds)
+        {
+            glm::vec3 center = glm::vec3(model * glm::vec4((m_BoundsMin + m_BoundsMax) * 0.5f, 1.0f));
+            float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            float radius = glm::length(m_BoundsMax - m_BoundsMin) * 0.5f * scale;
+            // distance to the bounding sphere, 0 inside it
+            float distance = glm::max(0.0f, glm::length(center - view.viewPos) - radius);
+            bool inView = Frustum::FromMatrix(view.viewProjection * model).IntersectsBox(m_BoundsMin, m_BoundsMax);
+            float pixels = distance > 0.0f ? 2.0f * radius / distance * view.projectionScale : FLT_MAX;
+            wanted = distance <= m_LoadDistance || (inView && pixels >= streamer.minVisiblePixels);
+            kept = wanted || inView || distance <= m_LoadDistance * streamer.unloadDistanceFactor;
+        }
+        if (kept)
+            m_LastKeptFrame = streamer.Frame();
+
+        if (m_Model)
+            return true;
+        if (wanted && !m_Import.valid())
+            StartImport();
+        return false;
+    }
+
+    string BoundsPath() const
+    {
+        return m_Path + ".bounds";
+    }
+
+    bool ReadBounds()
+    {
+        ifstream file(BoundsPath());
+        return bool(file >> m_BoundsMin.x >> m_BoundsMin.y >> m_BoundsMin.z >> m_BoundsMax.x >> m_BoundsMax.y >> m_BoundsMax.z);
+    }
+
+    // best effort like the texture cache, without the file the model simply loads eagerly next run
+    void WriteBounds()
+    {
+        ofstream file(BoundsPath());
+        file << m_BoundsMin.x << ' ' << m_BoundsMin.y << ' ' << m_BoundsMin.z << ' '
+            << m_BoundsMax.x << ' ' << m_BoundsMax.y << ' ' << m_BoundsMax.z << endl;
+    }
+
+    void StartImport()
+    {
+        string path = m_Path;
+        m_Import = std::async(std::launch::async, [path]() {
+            Profiler::Instance().SetThreadName("model import");
+            ProfileScope profile("Assimp import", path);
+            unique_ptr<Assimp::Importer> importer(new Assimp::Importer());
+            importer->ReadFile(path, Model::ImportFlags);
+            return importer;
+        });
+    }
+
+    bool ImportReady() const
+    {
+        return m_Import.valid() && m_Import.wait_for(chrono::seconds(0)) == future_status::ready;
+    }
+
+    // builds the model from the finished import, on the GL thread
+    void FinishImport()
+    {
+        unique_ptr<Assimp::Importer> importer = m_Import.get();
+        m_Model.reset(new Model(m_Path, *importer, m_Options));
+        glm::vec3 minimum, maximum;
+        if (m_Model->GetBounds(minimum, maximum))
+        {
+            bool changed = !m_HasBounds || minimum != m_BoundsMin || maximum != m_BoundsMax;
+            m_BoundsMin = minimum;
+            m_BoundsMax = maximum;
+            m_HasBounds = true;
+            if (changed)
+                WriteBounds();
+        }
+        cout << "LAZY::LOAD:: " << m_Path << " after " << AssetStreamer::Instance().Frame() << " frames, "
+            << m_Model->BufferBytes() / 1024 << " KB of buffers" << endl;
+    }
+
+    void Unload()
+    {
+        m_Model->Release();
+        m_Model.reset();
+        cout << "LAZY::UNLOAD:: " << m_Path << endl;
+    }
+};
+
+inline void AssetStreamer::Update()
+{
+    m_Frame++;
+    int imports = 0;
+    for (LazyModel* model : m_Models)
+        if (imports < importsPerFrame && !model->m_Model && model->ImportReady())
+        {
+            model->FinishImport();
+            imports++;
+        }
+
+    // under pressure, the models the camera left longest ago go first; one that is still kept in range stays
+    size_t resident = ResidentBytes();
+    while (resident > memoryBudgetBytes)
+    {
+        LazyModel* oldest = nullptr;
+        for (LazyModel* model : m_Models)
+            if (model->m_Model && model->m_LastKeptFrame + 1 < m_Frame && (!oldest || model->m_LastKeptFrame < oldest->m_LastKeptFrame))
+                oldest = model;
+        if (!oldest)
+            break;
+        resident -= std::min(resident, oldest->m_Model->BufferBytes() + oldest->m_Model->TextureBytes());
+        oldest->Unload();
+    }
+}
+
+inline size_t AssetStreamer::LoadedCount() const
+{
+    size_t count = 0;
+    for (const LazyModel* model : m_Models)
+        if (model->m_Model)
+            count++;
+    return count;
+}
+
+inline size_t AssetStreamer::ResidentBytes() const
+{
+    size_t bytes = 0;
+    for (const LazyModel* model : m_Models)
+        if (model->m_Model)
+            bytes += model->m_Model->BufferBytes() + model->m_Model->TextureBytes();
+    return bytes;
+}
+#endif
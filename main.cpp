@@ -11,6 +11,23 @@
 #include <random>
 
 #include "animator.h"
+#include "alloc_stats.h"
+#include "texture_loader.h"
+#include "staging_pool.h"
+#include "profiler.h"
+#include "lazy_model.h"
+#include "instance_buffer.h"
+#include "baked_animation.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "frame_data.h"
+#include "frustum_culler.h"
+#include "bvh.h"
+#include "occlusion_culler.h"
+#include "software_occlusion.h"
+#include "scene.h"
+#include <chrono>
+#include <sys/stat.h>
 
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -19,6 +36,11 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
 unsigned int loadTexture(const char* path);
 unsigned int loadCubemap(vector<std::string> faces);
+void benchmarkMipmaps(const char* path);
+void benchmarkInstancing(int count);
+void benchmarkBvh(int count);
+void benchmarkScene(int count);
+FrameData makeFrameData(const glm::mat4& projection, const glm::mat4& view);
 
 // window settings
 const unsigned int SCR_WIDTH = 800;
@@ -29,53 +51,53 @@ Camera camera(glm::vec3(0.0f, 30.0f, 10.0f));
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
+// set when P is pressed, the object in the middle of the screen is looked up in the next frame
+bool pickRequested = false;
 
 // timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-// lighting position
-// Define light properties for both lights
-struct DirLight {
-    glm::vec3 direction;
-    glm::vec3 color;
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-};
-
-struct PointLight {
-    glm::vec3 position;
-    glm::vec3 color;
-
-    float linear;
-    float quadratic;
-
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-};
-
-struct SpotLight {
-    glm::vec3 position;
-    glm::vec3 color;
-    glm::vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    float linear;
-    float quadratic;
-
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-};
-
-DirLight MoonLight;       // Also the moon is shown in the scene but I want it more like an ambient light, to create a night atmosphere
-SpotLight LHLight;
-
-int main()
+// lighting, as the scene file sets it
+FrameDirLight MoonLight;       // Also the moon is shown in the scene but I want it more like an ambient light, to create a night atmosphere
+FrameSpotLight LHLight;
+// black unless the scene file has one
+FramePointLight BayLight = FramePointLight();
+
+int main(int argc, char** argv)
 {
+    // the startup is timed from here to the first frame, see the PROFILE lines and startup_trace.json
+    Profiler::Instance().SetThreadName("main");
+
+    // --benchmark-bvh [count] times the scene index on count synthetic instances against testing them all, and exits
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-bvh")
+    {
+        benchmarkBvh(argc > 2 ? atoi(argv[2]) : 100000);
+        return 0;
+    }
+    // --benchmark-scene [count] loads a generated scene of count crowd members as JSON and compiled, and exits
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-scene")
+    {
+        benchmarkScene(argc > 2 ? atoi(argv[2]) : 100000);
+        return 0;
+    }
+    // --compile-scene scene.json scene.scn writes the binary form of a scene file, which loads with one mapping
+    if (argc > 3 && std::string(argv[1]) == "--compile-scene")
+    {
+        SceneFile sceneFile;
+        if (!sceneFile.Load(argv[2]) || !sceneFile.WriteBinary(argv[3]))
+        {
+            std::cout << "SCENE:: couldn't compile " << argv[2] << " into " << argv[3] << std::endl;
+            return -1;
+        }
+        std::cout << "SCENE:: " << argv[2] << " compiled into " << argv[3] << ", " << sceneFile.locals.size() << " nodes" << std::endl;
+        return 0;
+    }
+    // --scene path runs another scene file, JSON or compiled
+    std::string scenePath = argc > 2 && std::string(argv[1]) == "--scene" ? argv[2] : "scenes/howth_bay.json";
+
+    ProfileScope windowProfile("Window and context");
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -107,14 +129,30 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    windowProfile.End();
+
+    // --benchmark-mipmaps [image] times the CPU mip chain against glGenerateMipmap and exits
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-mipmaps")
+    {
+        benchmarkMipmaps(argc > 2 ? argv[2] : "models/lightblue/right.png");
+        glfwTerminate();
+        return 0;
+    }
+    // --benchmark-instancing [count] draws count fish one by one and as one instanced draw, and exits
+    if (argc > 1 && std::string(argv[1]) == "--benchmark-instancing")
+    {
+        benchmarkInstancing(argc > 2 ? atoi(argv[2]) : 10000);
+        glfwTerminate();
+        return 0;
+    }
 
     stbi_set_flip_vertically_on_load(true);
 
-    // configure global opengl state
+    // configure global opengl state, binds and state changes go through GLState so the redundant ones are dropped
     // -----------------------------
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::Instance().Enable(GL_DEPTH_TEST);
+    GLState::Instance().Enable(GL_BLEND);
+    GLState::Instance().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // build and compile our shader zprogram
     // ------------------------------------
@@ -123,36 +161,51 @@ int main()
     Shader moonShader("vertexShaders/Moon_vs.txt", "fragmentShaders/Moon_fs.txt");
     Shader modelShader("vertexShaders/Model_vs.txt", "fragmentShaders/Model_fs.txt");
     Shader fishmanShader("vertexShaders/ModelAnim_vs.txt", "fragmentShaders/ModelAnim_fs.txt");
+    Shader crowdShader("vertexShaders/ModelAnimInstanced_vs.txt", "fragmentShaders/ModelAnim_fs.txt");
     //Shader fishShader("vertexShaders/fish_vs.txt", "fragmentShaders/fish_fs.txt");
     //Shader crawlingShader("vertexShaders/ModelAnim_vs.txt", "fragmentShaders/ModelAnim_fs.txt");
     //Shader normalTextureSahder("vertexShaders/Moon_vs.txt", "fragmentShaders/Moon_fs .txt");
 
     // load models
     // -----------
-    Model theMoon("models/NASA CGI Moon Kit/NASA CGI Moon Kit.obj");
-    Model farIsland("models/Kauai Hawaii/Kauai Hawaii.obj");
-    Model closeIsland("models/Kauai Hawaii/Kauai Hawaii.obj");
-    Model cthulhu("models/Cthulhu/Horror_low_subd.obj");
-    Model lighthouse("models/lighthouse/Phare.obj");
-    Model lighthouseLamp("models/LighthouseLamp/LighthouseLamp.obj");
-    
-
-    // load animation models
-    Model fishman("models/Praying/prayFishman.fbx");
-    Animation prayingFishman("models/Praying/prayFishman.fbx", &fishman);
-    Animator praying(&prayingFishman);
-
-    Model zombie("models/fishman/Zombie Crawl.dae");
-    Animation crawlingFishman("models/fishman/Zombie Crawl.dae", &zombie);
-    Animator crawling(&crawlingFishman);
-
-    Model crouchZombie("models/fishman/Male Crouch Pose.dae");
-    Animation crouchFishman("models/fishman/Male Crouch Pose.dae", &crouchZombie);
-    Animator crouch(&crouchFishman);
-
-    Model fishCrowd("models/rainbow_trout/scene.gltf");
-    Animation swimFish("models/rainbow_trout/scene.gltf", &fishCrowd);
-    Animator swimming(&swimFish);
+    AllocationSnapshot loadStart = AllocationSnapshot::Take();
+    // the models, their animations, the lights and where everything goes all come from the scene file
+    Scene scene;
+    if (!scene.Load(scenePath))
+    {
+        glfwTerminate();
+        return -1;
+    }
+    // the distant models load once the camera comes within their load distance or they show up on screen, until then
+    // they are drawn as their bounding boxes; the islands and the lighthouse keep a coarse copy for the CPU occlusion
+    // buffer
+    LazyModel& theMoon = scene.GetLazyModel("moon");
+    LazyModel& farIsland = scene.GetLazyModel("far island");
+    LazyModel& closeIsland = scene.GetLazyModel("close island");
+    LazyModel& cthulhu = scene.GetLazyModel("Cthulhu");
+    Model& lighthouse = scene.GetModel("lighthouse");
+    Model& lighthouseLamp = scene.GetModel("lighthouse lamp");
+
+    // the animated models
+    Model& fishman = scene.GetModel("praying fishman");
+    Animator& praying = scene.GetAnimator("praying");
+    Model& zombie = scene.GetModel("zombie");
+    // the crowds are drawn instanced, posed from their animation baked into a texture
+    BakedAnimation& crawling = scene.GetBakedAnimation("crawling");
+    Animator& crouch = scene.GetAnimator("crouching");
+    Model& fishCrowd = scene.GetModel("fish");
+    BakedAnimation& swimming = scene.GetBakedAnimation("swimming");
+
+    // object space boxes for frustum culling; the skinned models get room for the poses that reach past their bind pose
+    BoundingBox lighthouseBounds, lighthouseLampBounds, fishmanBounds, zombieBounds, fishBounds;
+    lighthouse.GetBounds(lighthouseBounds.minimum, lighthouseBounds.maximum);
+    lighthouseLamp.GetBounds(lighthouseLampBounds.minimum, lighthouseLampBounds.maximum);
+    fishman.GetBounds(fishmanBounds.minimum, fishmanBounds.maximum);
+    fishmanBounds = fishmanBounds.Scaled(1.5f);
+    zombie.GetBounds(zombieBounds.minimum, zombieBounds.maximum);
+    zombieBounds = zombieBounds.Scaled(1.5f);
+    fishCrowd.GetBounds(fishBounds.minimum, fishBounds.maximum);
+    fishBounds = fishBounds.Scaled(1.5f);
 
     /*Model tentacle("models/kraken/tentacle.gltf");
     Animation twistTentacle("models/kraken/tentacle.gltf", &tentacle);
@@ -209,8 +262,8 @@ int main()
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+    GLState::Instance().BindVertexArray(skyboxVAO);
+    GLState::Instance().BindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
@@ -235,6 +288,7 @@ int main()
 
     // create the sea plane
     // ---------------------
+    ProfileScope seaProfile("Sea grid");
     struct Vertex {
         glm::vec3 Position;
         glm::vec2 TexCoords;
@@ -254,14 +308,15 @@ int main()
     }
 
     // create indices of VBO
-    std::vector<unsigned int> seaIndices;
+    // the grid has 201 * 201 vertices, so 16 bit indices are enough
+    std::vector<unsigned short> seaIndices;
     int pointsPerLine = 201;
     for (int z = 0; z < pointsPerLine - 1; ++z) {
         for (int x = 0; x < pointsPerLine - 1; ++x) {
-            unsigned int topLeft = z * pointsPerLine + x;
-            unsigned int topRight = topLeft + 1;
-            unsigned int bottomLeft = topLeft + pointsPerLine;
-            unsigned int bottomRight = bottomLeft + 1;
+            unsigned short topLeft = z * pointsPerLine + x;
+            unsigned short topRight = topLeft + 1;
+            unsigned short bottomLeft = topLeft + pointsPerLine;
+            unsigned short bottomRight = bottomLeft + 1;
 
             // First triangle
             seaIndices.push_back(topLeft);
@@ -280,13 +335,13 @@ int main()
     glGenBuffers(1, &seaVBO);
     glGenBuffers(1, &seaEBO);
 
-    glBindVertexArray(seaVAO);
+    GLState::Instance().BindVertexArray(seaVAO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, seaVBO);
+    GLState::Instance().BindBuffer(GL_ARRAY_BUFFER, seaVBO);
     glBufferData(GL_ARRAY_BUFFER, seaVertices.size() * sizeof(Vertex), seaVertices.data(), GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, seaEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, seaIndices.size() * sizeof(unsigned int), seaIndices.data(), GL_STATIC_DRAW);
+    GLState::Instance().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, seaEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, seaIndices.size() * sizeof(unsigned short), seaIndices.data(), GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
     glEnableVertexAttribArray(0);
@@ -294,50 +349,85 @@ int main()
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
     glEnableVertexAttribArray(1);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    GLState::Instance().BindVertexArray(0);
+    seaProfile.End();
 
     // load the sea texture
     // --------------------
-    unsigned int seaTexture;
-    glGenTextures(1, &seaTexture);
-    glBindTexture(GL_TEXTURE_2D, seaTexture);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-    unsigned char* data = stbi_load("models/BodyOfWater_square.jpg", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load texture" << std::endl;
-    }
-    stbi_image_free(data);
+    // decoded in the background like every other texture, linear filtering without mipmap sampling as before
+    TextureLoadOptions seaTextureOptions;
+    seaTextureOptions.minFilter = GL_LINEAR;
+    unsigned int seaTexture = TextureLoader::Instance().Load2D("models/BodyOfWater_square.jpg", seaTextureOptions);
     seaShader.use();
     seaShader.setInt("seaTexture", 1);
     // sea end
     // -------------------------------
 
+    AllocationSnapshot loadEnd = AllocationSnapshot::Take();
+    std::cout << "LOAD:: allocations " << loadEnd.allocations - loadStart.allocations
+        << ", heap " << loadEnd.liveBytes / (1024 * 1024) << " MB"
+        << ", RSS " << CurrentResidentBytes() / (1024 * 1024) << " MB (peak " << PeakResidentBytes() / (1024 * 1024) << " MB)" << std::endl;
+
     // variables for moving crowd
     double animationStartTime = glfwGetTime();
 
-    // create random numbers to make the crowd randomly
-    std::random_device rd;  // a random seed
-    std::mt19937 gen(rd()); // mersenne_twister_engine
-    std::uniform_real_distribution<> dis(-1.0, 1.0);
-    std::vector<glm::vec3> randomOffsets;
-    for (int i = 0; i < 50; ++i) {
-        randomOffsets.push_back(glm::vec3(dis(gen), dis(gen), dis(gen)));
-    }
+    // the scene file places everything once, only the Cthulhu statues and the fish are moved every frame
+    auto aroundY = [](float degrees) { return glm::angleAxis(glm::radians(degrees), glm::vec3(0.0f, 1.0f, 0.0f)); };
+    SceneGraph& sceneGraph = scene.graph;
+    SceneGraph::Node moonNode = scene.GetNode("moon");
+    SceneGraph::Node lighthouseNode = scene.GetNode("lighthouse");
+    SceneGraph::Node lighthouseLampNode = scene.GetNode("lighthouse lamp");
+    SceneGraph::Node farIslandNode = scene.GetNode("far island");
+    SceneGraph::Node cthulhuNode = scene.GetNode("Cthulhu");
+    SceneGraph::Node closeIslandNode = scene.GetNode("close island");
+    SceneGraph::Node fishmanNode = scene.GetNode("praying fishman");
+    SceneGraph::Node schoolLeaderNode = scene.GetNode("school leader");
+    const SceneCrowd& hordeCrowd = scene.GetCrowd("horde");
+    const SceneCrowd& schoolCrowd = scene.GetCrowd("school");
+
+    // the members of a crowd, rebuilt every frame, and the ones of them in view
+    std::vector<InstanceData> horde, school, visibleHorde, visibleSchool;
+    // every object of a frame is tested against the view before it is submitted
+    FrustumCuller sceneCuller;
+    // the same objects in a BVH for region and ray queries, one proxy per object in the order they are placed each
+    // frame, -1 until the object has a box
+    DynamicBvh sceneIndex;
+    std::vector<int> sceneProxies;
+    std::vector<std::string> sceneNames;
+    // each object's world box, its box in its node when that was made, and its place in the culler this frame,
+    // SIZE_MAX without a box
+    std::vector<BoundingBox> sceneBoxes, sceneLocalBoxes;
+    size_t sceneBoxesMoved = 0;
+    std::vector<size_t> sceneCullIndices;
+    // the objects in view are tested against what hid them last frame
+    OcclusionCuller occlusionCuller;
+    size_t occludedMembers = 0;
+    // before that, against the islands and the lighthouse drawn small on the CPU; the islands' hull outlives an unload
+    SoftwareOcclusionBuffer softwareOcclusion;
+    OccluderMesh islandOccluder;
+    // the sea grid, raised and lowered by at most the wave amplitude
+    const BoundingBox seaBounds{ glm::vec3(-100.0f, -0.2f, -100.0f), glm::vec3(100.0f, 0.2f, 100.0f) };
+    InstanceBuffer hordeInstances, schoolInstances;
+    // the draws of a frame are collected here and issued sorted by program, material and mesh
+    RenderQueue renderQueue;
+
+    // the lights don't move
+    MoonLight = scene.file.directionalLight;
+    LHLight = scene.file.spotLight;
+    BayLight = scene.file.pointLight;
+    FrameUniforms frameUniforms;
+    bool lightsChanged = true;
+    glm::vec3 lastCameraPosition, lastCameraFront;
+    float lastCameraZoom = 0.0f;
+
+    // statistics are printed every few seconds
+    float lastReportTime = 0.0f;
+    const float reportInterval = 5.0f;
+    // heap allocations made by posing the skeletons since the last report, none once they are warmed up
+    size_t animationAllocations = 0;
+    // the startup profile is written once the textures queued while loading are in, or after a while regardless
+    bool startupProfiled = false;
+    const float startupProfileTimeout = 30.0f;
 
     // render loop
     // -----------
@@ -352,10 +442,15 @@ int main()
         // input
         // -----
         processInput(window);
+        // bring in the textures the decode workers finished, a bounded amount per frame
+        TextureLoader::Instance().ProcessUploads();
+        // builds the lazy models whose import finished and unloads the ones out of range when over budget
+        AssetStreamer::Instance().Update();
+        Mesh::CullingStats() = ClusterCullingStats();
+        AllocationSnapshot animationStart = AllocationSnapshot::Take();
         praying.UpdateAnimation(deltaTime);
-        crawling.UpdateAnimation(deltaTime);
         crouch.UpdateAnimation(deltaTime);
-        swimming.UpdateAnimation(deltaTime);
+        animationAllocations += AllocationSnapshot::Take().allocations - animationStart.allocations;
 
         // render
         // ------
@@ -368,253 +463,44 @@ int main()
         // parameters: (field of view(angle), aspect of width and height, near plane position, far plane position)
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = camera.GetViewMatrix();
-        // world transformation
-        glm::mat4 model = glm::mat4(1.0f);
-        MoonLight.direction = glm::vec3(-1.0f, -1.0f, 1.0f);
-        MoonLight.color = glm::vec3(1.0f);                     // white
-        MoonLight.ambient = glm::vec3(0.3f);
-        MoonLight.diffuse = glm::vec3(0.4f);
-        MoonLight.specular = glm::vec3(0.5f);
-
-        LHLight.color = glm::vec3(35.0f, 35.0f, 10.0f);        // yellow, strong spot light
-        LHLight.position = glm::vec3(-25.0f, 21.0f, -2.0f);
-        LHLight.direction = glm::vec3(0.0f, -2.0f, 1.0f);
-        LHLight.linear = 0.09f;
-        LHLight.quadratic = 0.032f;
-        LHLight.ambient = glm::vec3(0.1f);
-        LHLight.diffuse = glm::vec3(0.8f);
-        LHLight.specular = glm::vec3(1.0f);
-        LHLight.cutOff = glm::cos(glm::radians(12.5f));
-        LHLight.outerCutOff = glm::cos(glm::radians(15.0f));
-
-        // draw the skybox
-        glDepthMask(GL_FALSE);
-        glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
-        skyboxShader.use();
-        view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
-        // skybox cube
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
-        glDepthMask(GL_TRUE);
-
-
-        // draw the sea
-        view = camera.GetViewMatrix();
-        glEnable(GL_DEPTH_TEST);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, seaTexture);
-        seaShader.use();
-        seaShader.setInt("seaTexture", 1);
-        seaShader.setVec3("objectColor", 0.0f, 0.3f, 0.4f);         // dark blue sea
-        seaShader.setVec3("dirLight.color", MoonLight.color);
-        seaShader.setVec3("dirLight.direction", MoonLight.direction);
-        seaShader.setVec3("dirLight.ambient", MoonLight.ambient);
-        seaShader.setVec3("dirLight.diffuse", MoonLight.diffuse);
-        seaShader.setVec3("dirLight.specular", MoonLight.specular);
-        seaShader.setVec3("spotLight.color", LHLight.color);
-        seaShader.setVec3("spotLight.position", LHLight.position);
-        seaShader.setVec3("spotLight.direction", LHLight.direction);
-        seaShader.setFloat("spotLight.linear", LHLight.linear);
-        seaShader.setFloat("spotLight.quadratic", LHLight.quadratic);
-        seaShader.setVec3("spotLight.ambient", LHLight.ambient);
-        seaShader.setVec3("spotLight.diffuse", LHLight.diffuse);
-        seaShader.setVec3("spotLight.specular", LHLight.specular);
-        seaShader.setFloat("spotLight.cutOff", LHLight.cutOff);
-        seaShader.setVec3("viewPos", camera.Position);
-        seaShader.setFloat("time", glfwGetTime());
-        seaShader.setFloat("frequency", 0.5f);
-        seaShader.setFloat("amplitude", 0.2f);
-        seaShader.setMat4("projection", projection);
-        seaShader.setMat4("view", view);
-        seaShader.setMat4("model", model);
-
-        glBindVertexArray(seaVAO);
-        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(seaIndices.size()), GL_UNSIGNED_INT, 0);
-
-
-        // draw the moon
-        moonShader.use();
-        moonShader.setVec3("moonGlowColor", MoonLight.color);
-        moonShader.setVec3("viewPos", camera.Position);
-        moonShader.setMat4("projection", projection);
-        moonShader.setMat4("view", view);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-15.0f, 5.0f, -80.0f));
-        //model = glm::rotate(model, glm::radians(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        //model = glm::scale(model, glm::vec3(0.7f)); // a smaller moon
-        moonShader.setMat4("model", model);
-        theMoon.Draw(moonShader);
-
-        // draw the lighthouse
-        modelShader.use();
-        modelShader.setVec3("dirLight.color", MoonLight.color);
-        modelShader.setVec3("dirLight.direction", MoonLight.direction);
-        modelShader.setVec3("dirLight.ambient", MoonLight.ambient);
-        modelShader.setVec3("dirLight.diffuse", MoonLight.diffuse);
-        modelShader.setVec3("dirLight.specular", MoonLight.specular);
-        modelShader.setVec3("spotLight.color", LHLight.color);
-        modelShader.setVec3("spotLight.position", LHLight.position);
-        modelShader.setFloat("spotLight.linear", LHLight.linear);
-        modelShader.setFloat("spotLight.quadratic", LHLight.quadratic);
-        modelShader.setVec3("spotLight.ambient", LHLight.ambient);
-        modelShader.setVec3("spotLight.diffuse", LHLight.diffuse);
-        modelShader.setVec3("spotLight.specular", LHLight.specular);
-        modelShader.setFloat("spotLight.cutOff", LHLight.cutOff);
-        modelShader.setFloat("spotLight.outerCutOff", LHLight.outerCutOff);
-        modelShader.setVec3("viewPos", camera.Position);
-        modelShader.setMat4("projection", projection);
-        modelShader.setMat4("view", view);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-25.0f, 7.5f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.5f));
-        modelShader.setMat4("model", model);
-        lighthouse.Draw(modelShader);
-
-        // draw the lighthouse lamp
-        // based on the lighthouse position
-        modelShader.use();
-        model = glm::translate(model, glm::vec3(0.0f, 27.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(100.0f));
-        modelShader.setMat4("model", model);
-        lighthouseLamp.Draw(modelShader);
-
-        // draw the far away island
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(30.0f, -0.3f, -70.0f));
-        model = glm::rotate(model, glm::radians(-20.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.0013f));
-        modelShader.setMat4("model", model);
-        farIsland.Draw(modelShader);
-
-        // draw the Cthulhu statues
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-55.0f, 0.1f, -55.0f));
-        model = glm::rotate(model, glm::radians(5.0f) * (float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(8.0f));
-        modelShader.setMat4("model", model);
-        cthulhu.Draw(modelShader);
-
-        // draw the close island
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-55.0f, -0.5f, 40.0f));
-        model = glm::rotate(model, glm::radians(-120.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.003f));
-        modelShader.setMat4("model", model);
-        closeIsland.Draw(modelShader);
-
-
-        // draw the praying fishman
-        fishmanShader.use();
-        fishmanShader.setVec3("dirLight.color", MoonLight.color);
-        fishmanShader.setVec3("dirLight.direction", MoonLight.direction);
-        fishmanShader.setVec3("dirLight.ambient", MoonLight.ambient);
-        fishmanShader.setVec3("dirLight.diffuse", MoonLight.diffuse);
-        fishmanShader.setVec3("dirLight.specular", MoonLight.specular);
-        fishmanShader.setVec3("spotLight.color", LHLight.color);
-        fishmanShader.setVec3("spotLight.position", LHLight.position);
-        fishmanShader.setFloat("spotLight.linear", LHLight.linear);
-        fishmanShader.setFloat("spotLight.quadratic", LHLight.quadratic);
-        fishmanShader.setVec3("spotLight.ambient", LHLight.ambient);
-        fishmanShader.setVec3("spotLight.diffuse", LHLight.diffuse);
-        fishmanShader.setVec3("spotLight.specular", LHLight.specular);
-        fishmanShader.setFloat("spotLight.cutOff", LHLight.cutOff);
-        fishmanShader.setFloat("spotLight.outerCutOff", LHLight.outerCutOff);
-        fishmanShader.setVec3("viewPos", camera.Position);
-        fishmanShader.setMat4("projection", projection);
-        fishmanShader.setMat4("view", view);
-
-        auto transform = praying.GetFinalBoneMatrices();
-        for (int i = 0; i < transform.size(); ++i) {
-            fishmanShader.setMat4("finalBonesMatrices[" + std::to_string(i) + "]", transform[i]);
-        }
-
-        // render the loaded model
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-20.0f, 3.5f, -7.0f));
-        model = glm::rotate(model, glm::radians(-130.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.03f));
-        fishmanShader.setMat4("model", model);
-        fishman.Draw(fishmanShader);
-
-        // draw the crawling crowd
-        transform = crawling.GetFinalBoneMatrices();
-        for (int i = 0; i < transform.size(); ++i) {
-            fishmanShader.setMat4("finalBonesMatrices[" + std::to_string(i) + "]", transform[i]);
-        }
-
-        /*float duration = 20.0f;
-        float moveFraction = fmin(glfwGetTime() / duration, 1.0f);
-        glm::vec3 startPosition = glm::vec3(-800.0f, 0.0f, -1600.0f);
-        glm::vec3 endPosition = glm::vec3(-200.0f, 0.0f, -400.0f);
-        glm::vec3 currentPosition = startPosition + (endPosition - startPosition) * moveFraction;*/
-
-        glm::mat4 model_1 = glm::mat4(1.0f);
-        model_1 = glm::translate(model_1, glm::vec3(-200.0f, 0.0f, -400.0f));
-        model_1 = glm::rotate(model_1, glm::radians(30.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_1 = glm::scale(model_1, glm::vec3(700.0f));
-        model_1 = model * model_1;
-        fishmanShader.setMat4("model", model_1);
-        zombie.Draw(fishmanShader);
-        for (int i = 0; i < 2; ++i) {
-            model_1 = glm::translate(model_1, glm::vec3(0.0f, -0.15f, -0.3f));
-            fishmanShader.setMat4("model", model_1);
-            zombie.Draw(fishmanShader);
-        }
-
-        glm::mat4 model_2 = glm::mat4(1.0f);
-        model_2 = glm::translate(model_2, glm::vec3(0.0f, 0.0f, -400.0f));
-        model_2 = glm::scale(model_2, glm::vec3(700.0f));
-        model_2 = model * model_2;
-        fishmanShader.setMat4("model", model_2);
-        zombie.Draw(fishmanShader);
-        for (int i = 0; i < 3; ++i) {
-            model_2 = glm::translate(model_2, glm::vec3(0.0f, 0.0f, -0.3f));
-            model_2 = glm::rotate(model_2, glm::radians(-35.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            fishmanShader.setMat4("model", model_2);
-            zombie.Draw(fishmanShader);
-        }
-
-        glm::mat4 model_3 = glm::mat4(1.0f);
-        model_3 = glm::translate(model_3, glm::vec3(200.0f, 0.1f, -400.0f));
-        model_3 = glm::rotate(model_3, glm::radians(-30.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_3 = glm::scale(model_3, glm::vec3(700.0f));
-        model_3 = model * model_3;
-        fishmanShader.setMat4("model", model_3);
-        zombie.Draw(fishmanShader);
-        for (int i = 0; i < 3; ++i) {
-            model_3 = glm::translate(model_3, glm::vec3(0.0f, 0.1f, -0.3f));
-            model_3 = glm::rotate(model_3, glm::radians(-25.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            fishmanShader.setMat4("model", model_3);
-            zombie.Draw(fishmanShader);
-        }
-
-        glm::mat4 model_4 = glm::mat4(1.0f);
-        model_4 = glm::translate(model_4, glm::vec3(-400.0f, 0.0f, -200.0f));
-        model_4 = glm::rotate(model_4, glm::radians(60.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model_4 = glm::scale(model_4, glm::vec3(700.0f));
-        model_4 = model * model_4;
-        fishmanShader.setMat4("model", model_4);
-        zombie.Draw(fishmanShader);
-        for (int i = 0; i < 4; ++i) {
-            model_4 = glm::translate(model_4, glm::vec3(0.0f, -0.1f, -0.3f));
-            fishmanShader.setMat4("model", model_4);
-            zombie.Draw(fishmanShader);
+        // static models pick their level of detail from their size on screen and cull their clusters against the view
+        DrawView drawView;
+        drawView.viewPos = camera.Position;
+        drawView.viewProjection = projection * view;
+        drawView.projectionScale = (float)SCR_HEIGHT / (2.0f * glm::tan(glm::radians(camera.Zoom) / 2.0f));
+        // the camera and the lights go to every program through the FrameData uniform block, rebuilt when they change
+        if (lightsChanged || camera.Position != lastCameraPosition || camera.Front != lastCameraFront || camera.Zoom != lastCameraZoom)
+        {
+            frameUniforms.Update(makeFrameData(projection, view));
+            lightsChanged = false;
+            lastCameraPosition = camera.Position;
+            lastCameraFront = camera.Front;
+            lastCameraZoom = camera.Zoom;
         }
 
-
-        // draw the schooling fish
+        // draw the skybox
+        renderQueue.SubmitCallback(PASS_BACKGROUND, 0.0f, [&]() {
+            GLState::Instance().DepthMask(false);
+            GLState::Instance().DepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
+            skyboxShader.use();
+            glm::mat4 skyView = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
+            skyboxShader.setMat4("view", skyView);
+            skyboxShader.setMat4("projection", projection);
+            // skybox cube
+            GLState::Instance().BindVertexArray(skyboxVAO);
+            GLState::Instance().BindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            GLState::Instance().DepthFunc(GL_LESS);
+            GLState::Instance().DepthMask(true);
+        });
+
+
+        // where everything is this frame: the Cthulhu statues turn and the fish swim, the rest of the scene keeps the
+        // world matrices it got once
+        sceneGraph.SetRotation(cthulhuNode, aroundY(5.0f * (float)glfwGetTime()));
+
+        // the schooling fish
         // --------------------------
-        transform = swimming.GetFinalBoneMatrices();
-        for (int i = 0; i < transform.size(); ++i) {
-            fishmanShader.setMat4("finalBonesMatrices[" + std::to_string(i) + "]", transform[i]);
-        }
-        
 
         const double animationDuration = 10.0f;
         double timeSinceStart = glfwGetTime() - animationStartTime;
@@ -642,37 +528,294 @@ int main()
         glm::vec3 currentPos = glm::mix(startPos, endPos, t);       // calculate the interpolation
         currentPos.y += 10.0f * sin(glm::pi<float>() * t);          // sin wave track
 
-        // change moving direction when backwards
-        float rotationAngle = goingTowardsB ? 0.0f : glm::pi<float>();
-        glm::mat4 rotationMat = glm::rotate(glm::mat4(1.0f), rotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, currentPos);
-        model *= rotationMat;
-        model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(1.2f));
-        fishmanShader.setMat4("model", model);
-        fishCrowd.Draw(fishmanShader);
-
-        // create the crowds
-        glm::mat4 model_school = glm::mat4(1.0f);
-        model_school = model * model_school;
-        model_school = glm::translate(model_school, glm::vec3(1.0f, -0.5f, 1.0f));
-        //model_school = glm::rotate(model_school, glm::radians(-10.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        for (int i = 0; i < 30; ++i) {
-            model_school = glm::translate(model_school, 1.5f * randomOffsets[i]);
-            //model_school = glm::rotate(model_school, glm::radians(-10.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-            fishmanShader.setMat4("model", model_school);
-            fishCrowd.Draw(fishmanShader);
+        // facing the way they swim
+        float heading = goingTowardsB ? -90.0f : 90.0f;
+        sceneGraph.SetPosition(schoolLeaderNode, currentPos);
+        sceneGraph.SetRotation(schoolLeaderNode, aroundY(heading));
+
+        sceneGraph.Update();
+        const glm::mat4& moonModel = sceneGraph.World(moonNode);
+        const glm::mat4& lighthouseModel = sceneGraph.World(lighthouseNode);
+        const glm::mat4& lighthouseLampModel = sceneGraph.World(lighthouseLampNode);
+        const glm::mat4& farIslandModel = sceneGraph.World(farIslandNode);
+        const glm::mat4& cthulhuModel = sceneGraph.World(cthulhuNode);
+        const glm::mat4& closeIslandModel = sceneGraph.World(closeIslandNode);
+        const glm::mat4& fishmanModel = sceneGraph.World(fishmanNode);
+
+        // the crawling crowd, each member a little further into the crawl than the one before
+        horde.clear();
+        for (uint32_t i = 0; i < hordeCrowd.count; i++)
+            horde.push_back(InstanceData{ sceneGraph.World(hordeCrowd.firstNode + i), glm::vec4(1.0f), currentFrame + hordeCrowd.timeStep * i });
+        school.clear();
+        for (uint32_t i = 0; i < schoolCrowd.count; i++)
+            school.push_back(InstanceData{ sceneGraph.World(schoolCrowd.firstNode + i), glm::vec4(1.0f), currentFrame + schoolCrowd.timeStep * i });
+
+        // every object and crowd member has a world space box and all of them are tested against the view at once;
+        // a lazy model without bounds yet has no box and counts as visible. A box is only transformed again, and moved
+        // in the scene index, when the scene graph moved its node or its model's bounds changed; the still parts of the
+        // scene cost a flag test. Objects are known by the slot they get here, the same every frame
+        sceneCuller.Clear();
+        size_t sceneSlot = 0;
+        // number tells the members of a crowd apart, -1 for a single object; the name is made once, with the slot.
+        // Without a node the box is in world space already
+        auto place = [&](const char* name, int number, SceneGraph::Node node, const BoundingBox& bounds, bool known) {
+            size_t slot = sceneSlot++;
+            if (slot == sceneProxies.size())
+            {
+                sceneProxies.push_back(-1);
+                sceneNames.push_back(number < 0 ? std::string(name) : name + (" " + std::to_string(number)));
+                sceneBoxes.push_back(BoundingBox());
+                sceneLocalBoxes.push_back(BoundingBox());
+                sceneCullIndices.push_back(SIZE_MAX);
+            }
+            if (!known)
+            {
+                sceneCullIndices[slot] = SIZE_MAX;
+                return slot;
+            }
+            bool boundsChanged = sceneProxies[slot] < 0 || bounds.minimum != sceneLocalBoxes[slot].minimum
+                || bounds.maximum != sceneLocalBoxes[slot].maximum;
+            if (boundsChanged || (node != SceneGraph::kNoParent && sceneGraph.Changed(node)))
+            {
+                sceneLocalBoxes[slot] = bounds;
+                sceneBoxes[slot] = node == SceneGraph::kNoParent ? bounds : bounds.Transformed(sceneGraph.World(node));
+                if (sceneProxies[slot] < 0)
+                    sceneProxies[slot] = sceneIndex.Insert(sceneBoxes[slot], int(slot));
+                else
+                    sceneIndex.Move(sceneProxies[slot], sceneBoxes[slot]);
+                sceneBoxesMoved++;
+            }
+            sceneCullIndices[slot] = sceneCuller.Add(sceneBoxes[slot]);
+            return slot;
+        };
+        auto placeLazy = [&](const char* name, const LazyModel& lazy, SceneGraph::Node node) {
+            BoundingBox bounds;
+            bool known = lazy.GetBounds(bounds.minimum, bounds.maximum);
+            return place(name, -1, node, bounds, known);
+        };
+        size_t seaSlot = place("sea", -1, SceneGraph::kNoParent, seaBounds, true);
+        size_t moonSlot = placeLazy("moon", theMoon, moonNode);
+        size_t lighthouseSlot = place("lighthouse", -1, lighthouseNode, lighthouseBounds, true);
+        size_t lighthouseLampSlot = place("lighthouse lamp", -1, lighthouseLampNode, lighthouseLampBounds, true);
+        size_t farIslandSlot = placeLazy("far island", farIsland, farIslandNode);
+        size_t cthulhuSlot = placeLazy("Cthulhu", cthulhu, cthulhuNode);
+        size_t closeIslandSlot = placeLazy("close island", closeIsland, closeIslandNode);
+        size_t fishmanSlot = place("praying fishman", -1, fishmanNode, fishmanBounds, true);
+        size_t firstZombieSlot = sceneSlot;
+        for (uint32_t i = 0; i < hordeCrowd.count; i++)
+            place("zombie", int(i), SceneGraph::Node(hordeCrowd.firstNode + i), zombieBounds, true);
+        size_t firstFishSlot = sceneSlot;
+        for (uint32_t i = 0; i < schoolCrowd.count; i++)
+            place("fish", int(i), SceneGraph::Node(schoolCrowd.firstNode + i), fishBounds, true);
+        sceneCuller.Cull(Frustum::FromMatrix(drawView.viewProjection));
+
+        // the big occluders in view go into the CPU depth buffer, both islands share the hull of whichever loaded first
+        if (islandOccluder.Empty() && (closeIsland.GetModel() || farIsland.GetModel()))
+            islandOccluder = (closeIsland.GetModel() ? closeIsland.GetModel() : farIsland.GetModel())->occluder;
+        softwareOcclusion.Begin(drawView.viewProjection);
+        if (sceneCuller.Visible(sceneCullIndices[lighthouseSlot]))
+            softwareOcclusion.AddOccluder(lighthouse.occluder, lighthouseModel);
+        if (!islandOccluder.Empty() && sceneCuller.Visible(sceneCullIndices[farIslandSlot]))
+            softwareOcclusion.AddOccluder(islandOccluder, farIslandModel);
+        if (!islandOccluder.Empty() && sceneCuller.Visible(sceneCullIndices[closeIslandSlot]))
+            softwareOcclusion.AddOccluder(islandOccluder, closeIslandModel);
+        softwareOcclusion.Rasterize();
+
+        // then the ones in view against that buffer, and the rest against last frame's occlusion queries: hidden ones
+        // are skipped, the ones whose query is still out are drawn under it with conditional render
+        occlusionCuller.BeginFrame();
+        auto classify = [&](size_t slot) {
+            if (sceneCullIndices[slot] == SIZE_MAX)
+                return OcclusionCuller::VISIBLE;
+            if (!sceneCuller.Visible(sceneCullIndices[slot]))
+                return OcclusionCuller::CULLED;
+            // the lamp sits inside the lantern, which the lighthouse hull closes
+            if (slot != lighthouseLampSlot && !softwareOcclusion.IsVisible(sceneBoxes[slot]))
+                return OcclusionCuller::OCCLUDED;
+            return occlusionCuller.Test(slot, sceneBoxes[slot], camera.Position);
+        };
+        // sets the condition of the object's draws and tells whether to submit it at all
+        auto drawable = [&](size_t slot) {
+            OcclusionCuller::Visibility visibility = classify(slot);
+            renderQueue.SetCondition(visibility == OcclusionCuller::PENDING ? occlusionCuller.Query(slot) : 0);
+            return visibility == OcclusionCuller::VISIBLE || visibility == OcclusionCuller::PENDING;
+        };
+
+        // P: the nearest object along the view direction, by its padded box
+        if (pickRequested)
+        {
+            pickRequested = false;
+            int picked = -1;
+            float pickedDistance = 0.0f;
+            sceneIndex.QueryRay(camera.Position, camera.Front, 1000.0f, [&](int object, float distance) {
+                picked = object;
+                pickedDistance = distance;
+                return distance;
+            });
+            if (picked >= 0)
+                std::cout << "PICK:: " << sceneNames[picked] << " at " << pickedDistance << std::endl;
+            else
+                std::cout << "PICK:: nothing" << std::endl;
+        }
+
+        // the crowds can't draw a member conditionally, a member whose query is still out is drawn
+        occludedMembers = 0;
+        visibleHorde.clear();
+        for (size_t i = 0; i < horde.size(); i++)
+        {
+            OcclusionCuller::Visibility visibility = classify(firstZombieSlot + i);
+            if (visibility == OcclusionCuller::VISIBLE || visibility == OcclusionCuller::PENDING)
+                visibleHorde.push_back(horde[i]);
+            occludedMembers += visibility == OcclusionCuller::OCCLUDED ? 1 : 0;
+        }
+        visibleSchool.clear();
+        for (size_t i = 0; i < school.size(); i++)
+        {
+            OcclusionCuller::Visibility visibility = classify(firstFishSlot + i);
+            if (visibility == OcclusionCuller::VISIBLE || visibility == OcclusionCuller::PENDING)
+                visibleSchool.push_back(school[i]);
+            occludedMembers += visibility == OcclusionCuller::OCCLUDED ? 1 : 0;
+        }
+
+        // every program gets the uniforms its draws share once, the draws themselves are queued and issued sorted
+        // draw the sea, it hides things but is too big to be hidden
+        if (sceneCuller.Visible(sceneCullIndices[seaSlot]))
+        {
+            renderQueue.SubmitCallback(PASS_OPAQUE, 0.0f, [&]() {
+                GLState::Instance().Enable(GL_DEPTH_TEST);
+                GLState::Instance().BindTexture(1, GL_TEXTURE_2D, seaTexture);
+                seaShader.use();
+                seaShader.setInt("seaTexture", 1);
+                seaShader.setVec3("objectColor", 0.0f, 0.3f, 0.4f);         // dark blue sea
+                seaShader.setFloat("time", glfwGetTime());
+                seaShader.setFloat("frequency", 0.5f);
+                seaShader.setFloat("amplitude", 0.2f);
+                seaShader.setMat4("model", glm::mat4(1.0f));
+
+                GLState::Instance().BindVertexArray(seaVAO);
+                glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(seaIndices.size()), GL_UNSIGNED_SHORT, 0);
+            });
+        }
+
+        // draw the moon
+        moonShader.use();
+        moonShader.setVec3("moonGlowColor", MoonLight.color);
+        if (drawable(moonSlot))
+            theMoon.Submit(renderQueue, moonShader, moonModel, drawView);
+        else
+            theMoon.Skip(moonModel, drawView);
+
+        // draw the lighthouse and its lamp
+        if (drawable(lighthouseSlot))
+            renderQueue.Submit(lighthouse, modelShader, lighthouseModel, drawView);
+        if (drawable(lighthouseLampSlot))
+            renderQueue.Submit(lighthouseLamp, modelShader, lighthouseLampModel, drawView);
+
+        // draw the islands and the Cthulhu statue; the ones not drawn still tell the streamer about themselves
+        if (drawable(farIslandSlot))
+            farIsland.Submit(renderQueue, modelShader, farIslandModel, drawView);
+        else
+            farIsland.Skip(farIslandModel, drawView);
+        if (drawable(cthulhuSlot))
+            cthulhu.Submit(renderQueue, modelShader, cthulhuModel, drawView);
+        else
+            cthulhu.Skip(cthulhuModel, drawView);
+        if (drawable(closeIslandSlot))
+            closeIsland.Submit(renderQueue, modelShader, closeIslandModel, drawView);
+        else
+            closeIsland.Skip(closeIslandModel, drawView);
+
+        // draw the praying fishman
+        if (drawable(fishmanSlot))
+        {
+            fishmanShader.use();
+
+            const auto& transform = praying.GetFinalBoneMatrices();
+            for (int i = 0; i < transform.size(); ++i) {
+                fishmanShader.setMat4("finalBonesMatrices[" + std::to_string(i) + "]", transform[i]);
+            }
+            renderQueue.Submit(fishman, fishmanShader, fishmanModel, drawView);
         }
 
+        // one instanced draw per crowd of the members in view, posed by their own baked animation
+        renderQueue.SetCondition(0);
+        hordeInstances.Update(visibleHorde);
+        if (!visibleHorde.empty())
+            renderQueue.SubmitInstanced(zombie, crowdShader, hordeInstances, glm::length(glm::vec3(visibleHorde[0].model[3]) - camera.Position),
+                PASS_OPAQUE, [&crawling](Shader& shader) { crawling.Bind(shader); });
+        schoolInstances.Update(visibleSchool);
+        if (!visibleSchool.empty())
+            renderQueue.SubmitInstanced(fishCrowd, crowdShader, schoolInstances, glm::length(glm::vec3(visibleSchool[0].model[3]) - camera.Position),
+                PASS_OPAQUE, [&swimming](Shader& shader) { swimming.Bind(shader); });
+
+        // sort and issue the draws of the frame
+        renderQueue.Execute();
+        // and test the boxes of this frame's objects against what was drawn, for the next one
+        occlusionCuller.IssueQueries(drawView.viewProjection);
+
         // end of the scene
         // --------------------
 
+        if (currentFrame - lastReportTime >= reportInterval)
+        {
+            lastReportTime = currentFrame;
+            const ClusterCullingStats& clusterStats = Mesh::CullingStats();
+            std::cout << "STATS:: clusters " << clusterStats.clusters << ", frustum culled " << clusterStats.frustumCulled
+                << ", backface culled " << clusterStats.backfaceCulled << ", draw ranges " << clusterStats.drawRanges
+                << ", textures pending " << TextureLoader::Instance().PendingCount() << ", uploaded " << TextureLoader::Instance().UploadedTextures()
+                << " (" << TextureLoader::Instance().UploadedBytes() / (1024 * 1024) << " MB, "
+                << TextureLoader::Instance().UploadedUncompressedBytes() / (1024 * 1024) << " MB uncompressed)"
+                << ", streamed " << TextureLoader::Instance().StreamedResidentBytes() / (1024 * 1024) << " MB of "
+                << TextureLoader::Instance().streamingBudgetBytes / (1024 * 1024) << " MB"
+                << ", staging reused " << StagingPool::GetStatistics().reused << "/" << StagingPool::GetStatistics().allocations
+                << " (" << StagingPool::GetStatistics().retainedBytes / (1024 * 1024) << " MB held)"
+                << ", lazy models loaded " << AssetStreamer::Instance().LoadedCount() << "/" << AssetStreamer::Instance().RegisteredCount()
+                << " (" << AssetStreamer::Instance().ResidentBytes() / (1024 * 1024) << " MB)"
+                << ", queue draws " << renderQueue.Stats().draws << " of " << renderQueue.Stats().items << " items, program binds "
+                << renderQueue.Stats().programBinds << ", vertex array binds " << renderQueue.Stats().vertexArrayBinds
+                << ", texture binds " << renderQueue.Stats().textureBinds << ", model uploads " << renderQueue.Stats().modelUploads
+                << ", frame data uploads " << frameUniforms.Uploads() << std::endl;
+            // the last frame's object culling
+            std::cout << "STATS:: objects frustum culled " << sceneCuller.Stats().culled << " of " << sceneCuller.Stats().tested
+                << ", crowd members drawn " << visibleHorde.size() + visibleSchool.size() << " of " << horde.size() + school.size()
+                << ", scene index " << sceneIndex.Count() << " objects, height " << sceneIndex.Height() << ", refits "
+                << sceneIndex.Stats().refits << ", reinserts " << sceneIndex.Stats().reinserts << ", transforms updated "
+                << sceneGraph.Stats().worldUpdates << " of " << sceneGraph.Stats().nodes << ", boxes moved " << sceneBoxesMoved << std::endl;
+            std::cout << "STATS:: occlusion queries " << occlusionCuller.Stats().queries << ", objects occluded "
+                << occlusionCuller.Stats().occluded << " (crowd members " << occludedMembers << "), drawn conditionally "
+                << occlusionCuller.Stats().conditional << std::endl;
+            std::cout << "STATS:: CPU occlusion " << softwareOcclusion.Stats().occluded << " of " << softwareOcclusion.Stats().tested
+                << " objects hidden, occluder triangles " << softwareOcclusion.Stats().rasterizedTriangles << " of "
+                << softwareOcclusion.Stats().occluderTriangles << ", rasterized in " << softwareOcclusion.Stats().rasterizeMilliseconds
+                << " ms on " << softwareOcclusion.Stats().threads << " threads" << std::endl;
+            sceneIndex.ResetStats();
+            sceneBoxesMoved = 0;
+            std::cout << "STATS:: animation heap allocations " << animationAllocations << std::endl;
+            animationAllocations = 0;
+            // GL state calls since the last report, by kind
+            const GLState::Counters& glCounters = GLState::Instance().GetCounters();
+            std::cout << "STATS:: GL state calls issued " << glCounters.Issued() << ", elided " << glCounters.Elided() << " (";
+            for (int kind = 0; kind < GLState::KIND_COUNT; kind++)
+                std::cout << (kind ? ", " : "") << GLState::KindName(GLState::Kind(kind)) << " " << glCounters.issued[kind] << "/" << glCounters.elided[kind];
+            std::cout << ")" << std::endl;
+            GLState::Instance().ResetCounters();
+        }
+
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
         glfwSwapBuffers(window);
         glfwPollEvents();
+
+        Profiler::Instance().MarkFirstFrame();
+        if (!startupProfiled && (TextureLoader::Instance().PendingCount() == 0 || currentFrame > startupProfileTimeout))
+        {
+            Profiler::Instance().Mark("Startup profile end");
+            Profiler::Instance().Finish();
+            Profiler::Instance().PrintSummary();
+            if (Profiler::Instance().WriteChromeTrace("startup_trace.json"))
+                std::cout << "PROFILE:: trace written to startup_trace.json" << std::endl;
+            startupProfiled = true;
+        }
     }
     
 
@@ -697,6 +840,13 @@ void processInput(GLFWwindow* window)
         camera.ProcessKeyboard(LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera.ProcessKeyboard(RIGHT, deltaTime);
+
+    // one pick per press
+    static bool pickHeld = false;
+    bool pickDown = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (pickDown && !pickHeld)
+        pickRequested = true;
+    pickHeld = pickDown;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -745,43 +895,27 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
+// the std140 FrameData of the camera and the lights of the scene file
+// ---------------------------------------------------------------------------------------------------------
+FrameData makeFrameData(const glm::mat4& projection, const glm::mat4& view)
+{
+    // zeroed, the padding takes part in the comparison with the last upload
+    FrameData data = {};
+    data.projection = projection;
+    data.view = view;
+    data.viewPos = camera.Position;
+    data.dirLight = MoonLight;
+    data.pointLight = BayLight;
+    data.spotLight = LHLight;
+    return data;
+}
+
 // utility function for loading a 2D texture from file
+// the texture shows a placeholder until the loader has decoded and uploaded it
 // ---------------------------------------------------
 unsigned int loadTexture(char const* path)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    return TextureLoader::Instance().Load2D(path);
 }
 
 // loads a cubemap texture from 6 individual texture faces
@@ -795,30 +929,328 @@ unsigned int loadTexture(char const* path)
 // -------------------------------------------------------
 unsigned int loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    TextureLoadOptions options;
+    options.wrap = GL_CLAMP_TO_EDGE;
+    options.minFilter = GL_LINEAR;
+    options.generateMipmaps = false;
+    // the skybox faces are always uploaded as RGB
+    options.channels = 3;
+    return TextureLoader::Instance().LoadCubemap(faces, options);
+}
+
+// uploads an image with a full mip chain a few times over, once generated by the driver and once built by
+// MipChainBuilder, and prints the average time of each including the upload
+// ---------------------------------------------------------------------------------------------------------
+void benchmarkMipmaps(const char* path)
+{
+    int width, height, fileChannels;
+    unsigned char* pixels = stbi_load(path, &width, &height, &fileChannels, 3);
+    if (!pixels)
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return;
+    }
 
-    int width, height, nrComponents;
-    for (unsigned int i = 0; i < faces.size(); i++)
+    const int runs = 5;
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    GLState::Instance().BindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    double driverTime = 0.0, linearTime = 0.0, srgbTime = 0.0, filterTime = 0.0;
+    MipChain mips;
+    for (int run = 0; run < runs; run++)
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
+        double start = glfwGetTime();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glFinish();
+        driverTime += glfwGetTime() - start;
+
+        for (int srgb = 0; srgb < 2; srgb++)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            start = glfwGetTime();
+            MipChainBuilder::Build(pixels, width, height, 3, srgb != 0, mips);
+            double filtered = glfwGetTime();
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+            for (size_t i = 0; i < mips.levels.size(); i++)
+                glTexImage2D(GL_TEXTURE_2D, GLint(i + 1), GL_RGB, mips.levels[i].width, mips.levels[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, &mips.data[mips.levels[i].offset]);
+            glFinish();
+            (srgb ? srgbTime : linearTime) += glfwGetTime() - start;
+            if (srgb)
+                filterTime += filtered - start;
         }
-        else
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    GLState::Instance().ForgetTexture(texture);
+    glDeleteTextures(1, &texture);
+    stbi_image_free(pixels);
+
+    std::cout << "BENCHMARK:: mipmaps " << width << "x" << height << " RGB, " << MipChainBuilder::LevelCount(width, height) << " levels, "
+        << runs << " runs: glGenerateMipmap " << driverTime * 1000.0 / runs << " ms, CPU chain "
+        << linearTime * 1000.0 / runs << " ms, CPU chain sRGB " << srgbTime * 1000.0 / runs << " ms ("
+        << filterTime * 1000.0 / runs << " ms filtering), on " << (const char*)glGetString(GL_RENDERER) << std::endl;
+}
+
+// draws count trout in a grid a few frames over, once with a draw call per fish like the scene used to and once as a
+// single instanced draw, and prints the average CPU and GPU time of a frame of each
+// ---------------------------------------------------------------------------------------------------------
+void benchmarkInstancing(int count)
+{
+    count = std::max(1, count);
+    Shader fishShader("vertexShaders/ModelAnim_vs.txt", "fragmentShaders/ModelAnim_fs.txt");
+    Shader instancedShader("vertexShaders/ModelAnimInstanced_vs.txt", "fragmentShaders/ModelAnim_fs.txt");
+    Model fish("models/rainbow_trout/scene.gltf");
+    Animation swim("models/rainbow_trout/scene.gltf", &fish);
+    Animator animator(&swim);
+    BakedAnimation baked(swim);
+
+    // a square grid of fish in front of the camera
+    int side = int(ceil(sqrt(double(count))));
+    std::vector<InstanceData> instances;
+    for (int i = 0; i < count; i++)
+    {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3((i % side - side * 0.5f) * 2.0f, (i / side - side * 0.5f) * 1.0f, -side * 1.5f));
+        instances.push_back(InstanceData{ model, glm::vec4(1.0f), 0.01f * i });
+    }
+    InstanceBuffer buffer;
+    buffer.Update(instances);
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 10000.0f);
+    glm::mat4 view = glm::mat4(1.0f);
+    // both shaders read the camera from the FrameData block, the lights stay black
+    FrameUniforms frameUniforms;
+    FrameData frameData = {};
+    frameData.projection = projection;
+    frameData.view = view;
+    frameUniforms.Update(frameData);
+    GLState::Instance().Enable(GL_DEPTH_TEST);
+
+    const int frames = 10;
+    double individualCpu = 0.0, individualTotal = 0.0, instancedCpu = 0.0, instancedTotal = 0.0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glFinish();
+        double start = glfwGetTime();
+        fishShader.use();
+        animator.SampleAt(0.0f);
+        const auto& transform = animator.GetFinalBoneMatrices();
+        for (size_t i = 0; i < transform.size(); ++i)
+            fishShader.setMat4("finalBonesMatrices[" + std::to_string(i) + "]", transform[i]);
+        for (const InstanceData& instance : instances)
+        {
+            fishShader.setMat4("model", instance.model);
+            fish.Draw(fishShader);
+        }
+        individualCpu += glfwGetTime() - start;
+        glFinish();
+        individualTotal += glfwGetTime() - start;
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glFinish();
+        start = glfwGetTime();
+        instancedShader.use();
+        baked.Bind(instancedShader);
+        buffer.Update(instances);
+        fish.DrawInstanced(instancedShader, buffer);
+        instancedCpu += glfwGetTime() - start;
+        glFinish();
+        instancedTotal += glfwGetTime() - start;
+    }
+    buffer.Release();
+
+    std::cout << "BENCHMARK:: instancing " << count << " fish, " << frames << " frames: individual draws "
+        << individualCpu * 1000.0 / frames << " ms CPU, " << individualTotal * 1000.0 / frames << " ms total; instanced "
+        << instancedCpu * 1000.0 / frames << " ms CPU, " << instancedTotal * 1000.0 / frames << " ms total, on "
+        << (const char*)glGetString(GL_RENDERER) << std::endl;
+}
+
+// scatters count boxes of instance size at the density of a crowded scene, moves them like a few frames of animation
+// would and runs frustum, sphere and ray queries through a DynamicBvh and by testing every box, printing the times
+// and checking both find the same
+// ---------------------------------------------------------------------------------------------------------
+void benchmarkBvh(int count)
+{
+    count = std::max(1, count);
+    std::mt19937 gen(7);
+    // about one instance per 1000 cubic units
+    float half = 5.0f * std::cbrt(float(count));
+    std::uniform_real_distribution<float> position(-half, half), size(0.5f, 4.0f), unit(-1.0f, 1.0f);
+    std::vector<BoundingBox> boxes(count);
+    for (BoundingBox& box : boxes)
+    {
+        box.minimum = glm::vec3(position(gen), position(gen), position(gen));
+        box.maximum = box.minimum + glm::vec3(size(gen), size(gen), size(gen));
+    }
+    auto elapsed = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    DynamicBvh bvh;
+    std::vector<int> proxies(count);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+        proxies[i] = bvh.Insert(boxes[i], i);
+    double buildTime = elapsed(start);
+
+    // a tenth of the instances drift a little every frame and one in a hundred of those jumps across the world
+    const int frames = 10;
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++)
+        for (int i = frame % 10; i < count; i += 10)
+        {
+            glm::vec3 offset = i % 1000 < 10 ? glm::vec3(unit(gen), unit(gen), unit(gen)) * half : glm::vec3(unit(gen), unit(gen), unit(gen)) * 0.3f;
+            boxes[i] = BoundingBox{ boxes[i].minimum + offset, boxes[i].maximum + offset };
+            bvh.Move(proxies[i], boxes[i]);
+        }
+    double moveTime = elapsed(start) / frames;
+
+    // the same queries both ways; the tree reports by padded boxes, so it may find a few more than the exact test
+    const int queries = 1000;
+    std::vector<glm::vec3> origins(queries), directions(queries);
+    for (int q = 0; q < queries; q++)
+    {
+        origins[q] = glm::vec3(position(gen), position(gen), position(gen));
+        directions[q] = glm::normalize(glm::vec3(unit(gen), unit(gen), unit(gen)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+    }
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    auto frustumOf = [&](int q) {
+        return Frustum::FromMatrix(projection * glm::lookAt(origins[q], origins[q] + directions[q], glm::vec3(0.0f, 1.0f, 0.0f)));
+    };
+    const float radius = 20.0f, rayLength = 500.0f;
+    size_t bvhHits[3] = {}, bruteHits[3] = {};
+    size_t missed = 0;
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++)
+        bvh.QueryFrustum(frustumOf(q), [&](int) { bvhHits[0]++; });
+    double bvhFrustum = elapsed(start);
+    FrustumCuller culler;
+    for (const BoundingBox& box : boxes)
+        culler.Add(box);
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++)
+        bruteHits[0] += boxes.size() - culler.Cull(frustumOf(q));
+    double bruteFrustum = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++)
+        bvh.QuerySphere(origins[q], radius, [&](int) { bvhHits[1]++; });
+    double bvhSphere = elapsed(start);
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++)
+        for (const BoundingBox& box : boxes)
+        {
+            glm::vec3 offset = glm::clamp(origins[q], box.minimum, box.maximum) - origins[q];
+            bruteHits[1] += glm::dot(offset, offset) <= radius * radius ? 1 : 0;
+        }
+    double bruteSphere = elapsed(start);
+
+    // the nearest box along each ray
+    std::vector<int> nearest(queries, -1);
+    std::vector<float> nearestDistance(queries, rayLength);
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++)
+        bvh.QueryRay(origins[q], directions[q], rayLength, [&](int object, float distance) {
+            nearest[q] = object;
+            nearestDistance[q] = distance;
+            return distance;
+        });
+    double bvhRay = elapsed(start);
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++)
+    {
+        int hit = -1;
+        float hitDistance = rayLength;
+        for (int i = 0; i < count; i++)
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            const BoundingBox& box = bvh.FatBox(proxies[i]);
+            float enter = 0.0f, leave = hitDistance;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float t0 = (box.minimum[axis] - origins[q][axis]) / directions[q][axis];
+                float t1 = (box.maximum[axis] - origins[q][axis]) / directions[q][axis];
+                enter = std::max(enter, std::min(t0, t1));
+                leave = std::min(leave, std::max(t0, t1));
+            }
+            if (enter <= leave)
+            {
+                hit = i;
+                hitDistance = enter;
+            }
         }
+        bruteHits[2] += hit >= 0 ? 1 : 0;
+        bvhHits[2] += nearest[q] >= 0 ? 1 : 0;
+        // both have to find the same nearest box; equally near boxes may be found in either order
+        bool tie = std::fabs(hitDistance - nearestDistance[q]) <= 1e-4f * std::max(1.0f, hitDistance);
+        if ((hit >= 0) != (nearest[q] >= 0) || (hit >= 0 && hit != nearest[q] && !tie))
+            missed++;
+    }
+    double bruteRay = elapsed(start);
+
+    std::cout << "BENCHMARK:: bvh " << count << " instances, height " << bvh.Height() << ": build " << buildTime << " ms, "
+        << count / 10 << " moves " << moveTime << " ms per frame (" << bvh.Stats().refits << " refits, " << bvh.Stats().reinserts << " reinserts)" << std::endl;
+    std::cout << "BENCHMARK:: bvh " << queries << " queries each, tree vs all boxes: frustum " << bvhFrustum << " ms vs "
+        << bruteFrustum << " ms (SIMD), " << bvhHits[0] << "/" << bruteHits[0] << " found; sphere " << bvhSphere << " ms vs "
+        << bruteSphere << " ms, " << bvhHits[1] << "/" << bruteHits[1] << " found; nearest ray " << bvhRay << " ms vs "
+        << bruteRay << " ms, " << bvhHits[2] << "/" << bruteHits[2] << " hit, " << missed << " disagreeing" << std::endl;
+}
+
+// --benchmark-scene: count crowd members scattered over the sea, written out member by member as JSON and compiled;
+// each form is loaded into a SceneFile and the compiled one also into a scene graph
+// ---------------------------------------------------------------------------------------------------------
+void benchmarkScene(int count)
+{
+    count = std::max(1, count);
+    const std::string jsonPath = "scene_benchmark.json", binaryPath = "scene_benchmark.scn";
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f), heading(0.0f, 360.0f), size(0.5f, 2.0f);
+    FILE* file = fopen(jsonPath.c_str(), "w");
+    if (!file)
+    {
+        std::cout << "BENCHMARK:: can't write " << jsonPath << std::endl;
+        return;
+    }
+    fprintf(file, "{\n    \"nodes\": [ { \"name\": \"crowd\" } ],\n    \"crowds\": [ { \"name\": \"crowd\", \"parent\": \"crowd\", \"timeStep\": 0.01, \"members\": [\n");
+    for (int i = 0; i < count; i++)
+    {
+        float x = position(gen), z = position(gen), angle = heading(gen), scale = size(gen);
+        fprintf(file, "        %c{ \"position\": [%.3f, 0, %.3f], \"rotation\": [0, %.2f, 0], \"scale\": %.3f }\n", i ? ',' : ' ', x, z, angle, scale);
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    return textureID;
-}
\ No newline at end of file
+    fprintf(file, "    ] } ]\n}\n");
+    fclose(file);
+    auto elapsed = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    SceneFile fromJson;
+    auto start = std::chrono::steady_clock::now();
+    bool loaded = fromJson.Load(jsonPath);
+    double jsonTime = elapsed(start);
+    bool compiled = loaded && fromJson.WriteBinary(binaryPath);
+
+    SceneFile fromBinary;
+    start = std::chrono::steady_clock::now();
+    loaded = compiled && fromBinary.Load(binaryPath);
+    double binaryTime = elapsed(start);
+    SceneGraph graph;
+    start = std::chrono::steady_clock::now();
+    graph.Append(fromBinary.locals.data(), fromBinary.parents.data(), fromBinary.locals.size());
+    graph.Update();
+    double graphTime = elapsed(start);
+
+    struct stat jsonInfo = {}, binaryInfo = {};
+    stat(jsonPath.c_str(), &jsonInfo);
+    stat(binaryPath.c_str(), &binaryInfo);
+    remove(jsonPath.c_str());
+    remove(binaryPath.c_str());
+    if (!loaded || fromBinary.locals.size() != fromJson.locals.size()
+        || memcmp(fromBinary.locals.data(), fromJson.locals.data(), fromJson.locals.size() * sizeof(Transform)) != 0)
+    {
+        std::cout << "BENCHMARK:: scene round trip failed" << std::endl;
+        return;
+    }
+    std::cout << "BENCHMARK:: scene of " << count << " instances: JSON " << jsonInfo.st_size / 1024 << " KB in " << jsonTime
+        << " ms, compiled " << binaryInfo.st_size / 1024 << " KB in " << binaryTime << " ms, scene graph built and updated in "
+        << graphTime << " ms" << std::endl;
+}
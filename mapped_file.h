@@ -0,0 +1,117 @@
+#pragma once
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read-only memory mapping of a whole file. The pages are the OS file cache itself, so decoders reading from Data()
+// need no read buffer of their own and nothing is copied until the bytes are used.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const char* path)
+    {
+        Open(path);
+    }
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const char* path)
+    {
+        Close();
+#ifdef _WIN32
+        m_File = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (m_File == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        m_Mapping = CreateFileMappingA(m_File, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!m_Mapping)
+        {
+            Close();
+            return false;
+        }
+        m_Data = static_cast<const unsigned char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+        m_Size = size_t(size.QuadPart);
+#else
+        int file = open(path, O_RDONLY);
+        if (file < 0)
+            return false;
+        struct stat info;
+        if (fstat(file, &info) != 0 || info.st_size == 0)
+        {
+            close(file);
+            return false;
+        }
+        void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        // the mapping keeps the file referenced on its own
+        close(file);
+        if (data == MAP_FAILED)
+            return false;
+        // the decoders read front to back once
+        madvise(data, size_t(info.st_size), MADV_SEQUENTIAL);
+        m_Data = static_cast<const unsigned char*>(data);
+        m_Size = size_t(info.st_size);
+#endif
+        if (!m_Data)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_Data)
+            UnmapViewOfFile(m_Data);
+        if (m_Mapping)
+            CloseHandle(m_Mapping);
+        if (m_File != INVALID_HANDLE_VALUE)
+            CloseHandle(m_File);
+        m_Mapping = NULL;
+        m_File = INVALID_HANDLE_VALUE;
+#else
+        if (m_Data)
+            munmap(const_cast<unsigned char*>(m_Data), m_Size);
+#endif
+        m_Data = nullptr;
+        m_Size = 0;
+    }
+
+    bool IsOpen() const { return m_Data != nullptr; }
+    const unsigned char* Data() const { return m_Data; }
+    size_t Size() const { return m_Size; }
+
+private:
+    const unsigned char* m_Data = nullptr;
+    size_t m_Size = 0;
+#ifdef _WIN32
+    HANDLE m_File = INVALID_HANDLE_VALUE;
+    HANDLE m_Mapping = NULL;
+#endif
+};
+#endif
@@ -0,0 +1,159 @@
+#pragma once
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+#include "shader.h"
+
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// type is one of the sampler name literals, path is interned in the arena of the Model that loaded the texture
+struct Texture {
+    unsigned int id;
+    const char* type;
+    const char* path;
+    // layer of the GL_TEXTURE_2D_ARRAY id, -1 for a plain 2D texture
+    int layer = -1;
+};
+
+// every texture role has a fixed unit, so meshes sharing textures leave the bindings alone; texture arrays go to
+// the units after the 2D ones, a unit must not be sampled as two different types
+enum TextureRole { TEXTURE_DIFFUSE = 0, TEXTURE_SPECULAR, TEXTURE_NORMAL, TEXTURE_HEIGHT, TEXTURE_ROLE_COUNT };
+
+// The textures a mesh is drawn with, resolved into one slot per role when the model is imported and not changed
+// afterwards. The sampler units and uniform locations are looked up once per shader program and cached, so binding
+// a material does no string work and no GL queries; binds already in place are skipped by GLState, uniforms here.
+class Material
+{
+public:
+    Material()
+    {
+        for (int role = 0; role < TEXTURE_ROLE_COUNT; role++)
+            m_Slots[role] = Slot{ 0, -1 };
+    }
+
+    // the first texture of each role is used, like the shaders only have one sampler per role
+    static Material FromTextures(const vector<Texture>& textures)
+    {
+        Material material;
+        bool used[TEXTURE_ROLE_COUNT] = {};
+        for (const Texture& texture : textures)
+        {
+            int role = RoleOf(texture.type);
+            if (used[role])
+                continue;
+            used[role] = true;
+            material.m_Slots[role] = Slot{ texture.id, texture.layer };
+        }
+        material.m_SortId = InternSlots(material.m_Slots);
+        return material;
+    }
+
+    // materials with the same textures share an id, the render queue sorts by it to group their draws
+    unsigned int SortId() const { return m_SortId; }
+
+    // textures the materials actually bound, not counting the binds GLState skipped
+    static size_t& TextureBindCount()
+    {
+        static size_t count = 0;
+        return count;
+    }
+
+    static int RoleOf(const char* type)
+    {
+        if (strcmp(type, "texture_diffuse") == 0)
+            return TEXTURE_DIFFUSE;
+        if (strcmp(type, "texture_specular") == 0)
+            return TEXTURE_SPECULAR;
+        if (strcmp(type, "texture_normal") == 0)
+            return TEXTURE_NORMAL;
+        return TEXTURE_HEIGHT;
+    }
+
+    // binds the textures and sets the layer uniforms, shader must be the program in use
+    void Bind(const Shader& shader) const
+    {
+        ProgramBindings& program = BindingsFor(shader.ID);
+        for (int role = 0; role < TEXTURE_ROLE_COUNT; role++)
+        {
+            const Slot& slot = m_Slots[role];
+            if (slot.id != 0)
+            {
+                bool isArray = slot.layer >= 0;
+                int unit = isArray ? TEXTURE_ROLE_COUNT + role : role;
+                if (GLState::Instance().BindTexture(unit, isArray ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, slot.id))
+                    TextureBindCount()++;
+            }
+            // -1 selects the plain 2D sampler of a role in the shaders
+            if (program.layerLocations[role] != -1 && program.layers[role] != slot.layer)
+            {
+                glUniform1i(program.layerLocations[role], slot.layer);
+                program.layers[role] = slot.layer;
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        unsigned int id;
+        int layer;
+    };
+
+    // what a shader program was set up with, uniform values belong to the program and stay until changed
+    struct ProgramBindings {
+        GLint layerLocations[TEXTURE_ROLE_COUNT];
+        int layers[TEXTURE_ROLE_COUNT];
+    };
+
+    Slot m_Slots[TEXTURE_ROLE_COUNT];
+    unsigned int m_SortId = 0;
+
+    // numbers the distinct texture sets from 1 in the order they are first seen, on the GL thread that loads models
+    static unsigned int InternSlots(const Slot* slots)
+    {
+        static map<array<uint64_t, TEXTURE_ROLE_COUNT>, unsigned int> ids;
+        array<uint64_t, TEXTURE_ROLE_COUNT> key;
+        for (int role = 0; role < TEXTURE_ROLE_COUNT; role++)
+            key[role] = (uint64_t(slots[role].id) << 32) | uint32_t(slots[role].layer);
+        auto found = ids.find(key);
+        if (found != ids.end())
+            return found->second;
+        unsigned int id = static_cast<unsigned int>(ids.size()) + 1;
+        ids[key] = id;
+        return id;
+    }
+
+    static ProgramBindings& BindingsFor(unsigned int programID)
+    {
+        static unordered_map<unsigned int, ProgramBindings> programs;
+        auto found = programs.find(programID);
+        if (found != programs.end())
+            return found->second;
+
+        static const char* samplerNames[TEXTURE_ROLE_COUNT] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+        static const char* arrayNames[TEXTURE_ROLE_COUNT] = { "texture_diffuse_array", "texture_specular_array", "texture_normal_array", "texture_height_array" };
+        static const char* layerNames[TEXTURE_ROLE_COUNT] = { "texture_diffuse_layer", "texture_specular_layer", "texture_normal_layer", "texture_height_layer" };
+        ProgramBindings& program = programs[programID];
+        // every sampler gets its own unit, even the ones a material has no texture for: two samplers of different
+        // types left on the same unit fail the draw
+        for (int role = 0; role < TEXTURE_ROLE_COUNT; role++)
+        {
+            glUniform1i(glGetUniformLocation(programID, samplerNames[role]), role);
+            glUniform1i(glGetUniformLocation(programID, arrayNames[role]), TEXTURE_ROLE_COUNT + role);
+            program.layerLocations[role] = glGetUniformLocation(programID, layerNames[role]);
+            // a value no material has, so the first Bind always sets the uniform
+            program.layers[role] = INT_MIN;
+        }
+        return program;
+    }
+};
+#endif
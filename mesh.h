@@ -7,13 +7,21 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "frustum.h"
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "material.h"
 #include "shader.h"
+#include "texture_loader.h"
 
+#include <cfloat>
 #include <string>
 #include <vector>
 using namespace std;
 
 #define MAX_BONE_INFLUENCE 4
+// meshes up to this many vertices are drawn with 16 bit indices
+#define MAX_SHORT_INDEX_VERTICES 65535
 
 struct Vertex {
     // position
@@ -32,10 +40,41 @@ struct Vertex {
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
-struct Texture {
-    unsigned int id;
-    string type;
-    string path;
+// a level of detail of a mesh, a range of its index buffer with the object space error it introduces
+struct MeshLod {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    float error;
+};
+
+// a cluster (meshlet) of the full resolution LOD: a short index range with its object space bounding sphere and the
+// cone containing all its face normals (coneCutoff is the sine of the cone's half angle, 1 when it can't be culled)
+struct MeshCluster {
+    unsigned int indexOffset;
+    unsigned int indexCount;
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// what LOD selection and cluster culling need to know about the view
+struct DrawView {
+    glm::vec3 viewPos;
+    glm::mat4 viewProjection;
+    // viewport height in pixels divided by 2 * tan(fovy / 2), turns (size / distance) into pixels
+    float projectionScale;
+    // largest acceptable screen space error
+    float maxPixelError = 1.0f;
+    bool cullClusters = true;
+};
+
+// cluster culling counters, reset by the caller whenever it reports them
+struct ClusterCullingStats {
+    size_t clusters = 0;
+    size_t frustumCulled = 0;
+    size_t backfaceCulled = 0;
+    size_t drawRanges = 0;
 };
 
 class Mesh {
@@ -44,60 +83,230 @@ public:
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    // textures resolved per role, what Draw binds
+    Material             material;
+    // levels of detail, all in indices and sharing the vertex buffer, from full resolution to coarsest
+    vector<MeshLod>      lods;
+    // clusters covering lods[0], empty if the mesh is always drawn as a whole
+    vector<MeshCluster>  clusters;
+    // object space bounding sphere
+    glm::vec3 boundsCenter;
+    float boundsRadius;
     unsigned int VAO;
+    // GL_UNSIGNED_SHORT when every vertex can be addressed with 16 bits, GL_UNSIGNED_INT otherwise
+    GLenum indexType;
+    // size of the vertex and index buffers
+    size_t bufferBytes = 0;
 
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor, takes over the arrays so callers should std::move them in
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, vector<MeshLod> lods = vector<MeshLod>(), vector<MeshCluster> clusters = vector<MeshCluster>())
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), lods(std::move(lods)), clusters(std::move(clusters))
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        material = Material::FromTextures(this->textures);
+        if (this->lods.empty())
+            this->lods.push_back(MeshLod{ 0, static_cast<unsigned int>(this->indices.size()), 0.0f });
+        computeBounds();
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
+    // frees the CPU copies of the vertices and indices once they live on the GPU, drawing only needs lods and clusters
+    void ReleaseGeometry()
+    {
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+    }
+
+    // deletes the vertex array and buffers, Mesh copies share them so only the owner calls this
+    void Release()
+    {
+        GLState& state = GLState::Instance();
+        state.ForgetVertexArray(VAO);
+        InstanceBuffer::ForgetVertexArray(VAO);
+        state.ForgetBuffer(VBO);
+        state.ForgetBuffer(EBO);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        VAO = VBO = EBO = 0;
+        bufferBytes = 0;
+    }
+
+    static ClusterCullingStats& CullingStats()
+    {
+        static ClusterCullingStats stats;
+        return stats;
+    }
+
+    // picks the coarsest LOD whose error stays below view.maxPixelError pixels on screen
+    int SelectLod(const glm::mat4& model, const DrawView& view) const
+    {
+        glm::vec3 center = glm::vec3(model * glm::vec4(boundsCenter, 1.0f));
+        float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+        // distance to the closest point of the bounding sphere, the camera inside it gets full detail
+        float distance = glm::length(center - view.viewPos) - boundsRadius * scale;
+        if (distance <= 0.0f)
+            return 0;
+
+        int lod = 0;
+        for (int i = 1; i < static_cast<int>(lods.size()); i++)
+            if (lods[i].error * scale / distance * view.projectionScale <= view.maxPixelError)
+                lod = i;
+        return lod;
+    }
+
+    // tells the texture streaming the mesh covers about pixels on screen, its textures are assumed to span it once
+    void RequestTextures(float pixels) const
+    {
+        for (const Texture& texture : textures)
+            TextureLoader::Instance().RequestResolution(texture.id, pixels);
+    }
+
+    // size of the bounding sphere on screen in pixels, unbounded when the camera is inside it
+    float ProjectedSize(const glm::mat4& model, const DrawView& view) const
+    {
+        glm::vec3 center = glm::vec3(model * glm::vec4(boundsCenter, 1.0f));
+        float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+        float distance = glm::length(center - view.viewPos) - boundsRadius * scale;
+        if (distance <= 0.0f)
+            return FLT_MAX;
+        return 2.0f * boundsRadius * scale / distance * view.projectionScale;
+    }
+
     // render the mesh
-    void Draw(Shader& shader)
-    {
-        // bind appropriate textures
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr = 1;
-        unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++)
+    void Draw(Shader& shader, int lod = 0)
+    {
+        material.Bind(shader);
+
+        // draw mesh, the vertex array stays bound for the next draw of the same mesh
+        GLState::Instance().BindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, lods[lod].indexCount, indexType, indexOffsetPointer(lods[lod].indexOffset));
+    }
+
+    // renders every instance of the buffer at full detail in one call, without culling clusters or instances
+    void DrawInstanced(Shader& shader, const InstanceBuffer& instances)
+    {
+        if (instances.Count() == 0)
+            return;
+        material.Bind(shader);
+
+        GLState::Instance().BindVertexArray(VAO);
+        DrawInstances(instances);
+    }
+
+    // renders the mesh at the LOD its screen size calls for; at full resolution only the clusters that are inside the
+    // frustum and not facing away from the camera are drawn
+    void Draw(Shader& shader, const glm::mat4& model, const DrawView& view)
+    {
+        RequestTextures(ProjectedSize(model, view));
+        rangeCounts.clear();
+        rangeOffsets.clear();
+        if (SelectRanges(model, view, rangeCounts, rangeOffsets) == 0)
+            return;
+
+        material.Bind(shader);
+        GLState::Instance().BindVertexArray(VAO);
+        DrawRanges(rangeCounts.data(), rangeOffsets.data(), static_cast<GLsizei>(rangeCounts.size()));
+    }
+
+    // appends the index ranges Draw would draw from view to counts and offsets and returns how many there are, 0 when
+    // every cluster is culled
+    size_t SelectRanges(const glm::mat4& model, const DrawView& view, vector<GLsizei>& counts, vector<const void*>& offsets) const
+    {
+        int lod = SelectLod(model, view);
+        if (lod != 0 || clusters.empty() || !view.cullClusters)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if (name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if (name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to string
-            else if (name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            counts.push_back(lods[lod].indexCount);
+            offsets.push_back(indexOffsetPointer(lods[lod].indexOffset));
+            return 1;
         }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        // cull in object space: planes of the model-view-projection matrix and the camera moved into the model
+        Frustum frustum = Frustum::FromMatrix(view.viewProjection * model);
+        glm::vec3 objectViewPos = glm::vec3(glm::inverse(model) * glm::vec4(view.viewPos, 1.0f));
+
+        ClusterCullingStats& stats = CullingStats();
+        size_t first = counts.size();
+        unsigned int lastRangeEnd = 0;
+        for (const MeshCluster& cluster : clusters)
+        {
+            stats.clusters++;
+            if (!frustum.IntersectsSphere(cluster.center, cluster.radius))
+            {
+                stats.frustumCulled++;
+                continue;
+            }
+            // every face of the cluster points away if the camera is inside the cone's negative space
+            glm::vec3 toCluster = cluster.center - objectViewPos;
+            if (glm::dot(toCluster, cluster.coneAxis) >= cluster.coneCutoff * glm::length(toCluster) + cluster.radius)
+            {
+                stats.backfaceCulled++;
+                continue;
+            }
+            // neighbouring visible clusters are contiguous in the index buffer, merge them into one range
+            if (counts.size() > first && lastRangeEnd == cluster.indexOffset)
+                counts.back() += cluster.indexCount;
+            else
+            {
+                counts.push_back(cluster.indexCount);
+                offsets.push_back(indexOffsetPointer(cluster.indexOffset));
+            }
+            lastRangeEnd = cluster.indexOffset + cluster.indexCount;
+        }
+        stats.drawRanges += counts.size() - first;
+        return counts.size() - first;
+    }
+
+    // draws index ranges from SelectRanges, with the vertex array and the material already bound
+    void DrawRanges(const GLsizei* counts, const void* const* offsets, GLsizei count) const
+    {
+        if (count == 1)
+            glDrawElements(GL_TRIANGLES, counts[0], indexType, offsets[0]);
+        else
+            glMultiDrawElements(GL_TRIANGLES, counts, indexType, offsets, count);
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // draws lods[0] once per instance, with the vertex array and the material already bound
+    void DrawInstances(const InstanceBuffer& instances) const
+    {
+        instances.Attach(VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, lods[0].indexCount, indexType, indexOffsetPointer(lods[0].indexOffset), instances.Count());
     }
 
 private:
     // render data 
     unsigned int VBO, EBO;
+    // scratch arrays of the visible cluster ranges, kept to avoid allocating every frame
+    vector<GLsizei> rangeCounts;
+    vector<const void*> rangeOffsets;
+
+    // byte offset of an index into the element buffer, as glDrawElements expects it
+    const void* indexOffsetPointer(unsigned int index) const
+    {
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+        return (const void*)(index * indexSize);
+    }
+
+    void computeBounds()
+    {
+        if (vertices.empty())
+        {
+            boundsCenter = glm::vec3(0.0f);
+            boundsRadius = 0.0f;
+            return;
+        }
+        glm::vec3 minimum = vertices[0].Position, maximum = vertices[0].Position;
+        for (const Vertex& vertex : vertices)
+        {
+            minimum = glm::min(minimum, vertex.Position);
+            maximum = glm::max(maximum, vertex.Position);
+        }
+        boundsCenter = (minimum + maximum) * 0.5f;
+        boundsRadius = 0.0f;
+        for (const Vertex& vertex : vertices)
+            boundsRadius = glm::max(boundsRadius, glm::length(vertex.Position - boundsCenter));
+    }
 
     // initializes all the buffer objects/arrays
     void setupMesh()
@@ -107,16 +316,28 @@ private:
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        GLState::Instance().BindVertexArray(VAO);
         // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        GLState::Instance().BindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        GLState::Instance().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        if (vertices.size() <= MAX_SHORT_INDEX_VERTICES)
+        {
+            // half the index memory and bandwidth for all the small meshes
+            vector<unsigned short> shortIndices(indices.begin(), indices.end());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+            indexType = GL_UNSIGNED_SHORT;
+        }
+        else
+        {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+            indexType = GL_UNSIGNED_INT;
+        }
+        bufferBytes = vertices.size() * sizeof(Vertex) + indices.size() * (indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int));
 
         // set the vertex attribute pointers
         // vertex Positions
@@ -141,7 +362,8 @@ private:
         // weights
         glEnableVertexAttribArray(6);
         glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+        // no later element buffer bind may land in this vertex array
+        GLState::Instance().BindVertexArray(0);
     }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+#ifndef MESH_CLUSTERS_H
+#define MESH_CLUSTERS_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+// Splits the full resolution index range of a mesh into small clusters (meshlets) with a bounding sphere and a normal
+// cone each, so Mesh::Draw can reject the parts of a large mesh that are off screen or facing away.
+class MeshClusterBuilder
+{
+public:
+    static const unsigned int kMaxTriangles = 124;
+    static const unsigned int kMaxVertices = 64;
+
+    // Clusters are cut from the triangle order of the range as it is. After MeshOptimizer that order is the vertex
+    // cache order, which is spatially coherent, so the clusters stay compact and every cluster is a contiguous range.
+    static vector<MeshCluster> Build(const vector<Vertex>& vertices, const vector<unsigned int>& indices, unsigned int indexOffset, unsigned int indexCount)
+    {
+        vector<MeshCluster> clusters;
+        vector<unsigned int> clusterVertices;
+        clusterVertices.reserve(kMaxVertices + 3);
+
+        unsigned int start = indexOffset, end = indexOffset + indexCount;
+        unsigned int clusterStart = start;
+        for (unsigned int i = start; i + 2 < end; i += 3)
+        {
+            size_t vertexCount = clusterVertices.size();
+            for (int k = 0; k < 3; k++)
+                if (std::find(clusterVertices.begin(), clusterVertices.begin() + vertexCount, indices[i + k]) == clusterVertices.begin() + vertexCount)
+                    clusterVertices.push_back(indices[i + k]);
+
+            // the triangle doesn't fit anymore, close the cluster before it
+            if (clusterVertices.size() > kMaxVertices || (i - clusterStart) / 3 >= kMaxTriangles)
+            {
+                clusters.push_back(ComputeBounds(vertices, indices, clusterStart, i - clusterStart));
+                clusterStart = i;
+                clusterVertices.assign(indices.begin() + i, indices.begin() + i + 3);
+            }
+        }
+        if (clusterStart < end)
+            clusters.push_back(ComputeBounds(vertices, indices, clusterStart, end - clusterStart));
+        return clusters;
+    }
+
+private:
+    static MeshCluster ComputeBounds(const vector<Vertex>& vertices, const vector<unsigned int>& indices, unsigned int indexOffset, unsigned int indexCount)
+    {
+        MeshCluster cluster;
+        cluster.indexOffset = indexOffset;
+        cluster.indexCount = indexCount;
+
+        // bounding sphere around the centre of the bounding box
+        glm::vec3 minimum = vertices[indices[indexOffset]].Position, maximum = minimum;
+        for (unsigned int i = indexOffset; i < indexOffset + indexCount; i++)
+        {
+            minimum = glm::min(minimum, vertices[indices[i]].Position);
+            maximum = glm::max(maximum, vertices[indices[i]].Position);
+        }
+        cluster.center = (minimum + maximum) * 0.5f;
+        cluster.radius = 0.0f;
+        for (unsigned int i = indexOffset; i < indexOffset + indexCount; i++)
+            cluster.radius = glm::max(cluster.radius, glm::length(vertices[indices[i]].Position - cluster.center));
+
+        // normal cone: average face normal and the widest angle any face deviates from it
+        vector<glm::vec3> normals;
+        normals.reserve(indexCount / 3);
+        glm::vec3 axis(0.0f);
+        for (unsigned int i = indexOffset; i + 2 < indexOffset + indexCount; i += 3)
+        {
+            const glm::vec3& p0 = vertices[indices[i]].Position;
+            glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - p0, vertices[indices[i + 2]].Position - p0);
+            float length = glm::length(normal);
+            if (length == 0.0f)
+                continue;
+            normals.push_back(normal / length);
+            axis += normals.back();
+        }
+        float axisLength = glm::length(axis);
+        cluster.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+        float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+        for (const glm::vec3& normal : normals)
+            minDot = glm::min(minDot, glm::dot(normal, cluster.coneAxis));
+        // faces spread over more than a hemisphere, some always face the camera
+        cluster.coneCutoff = minDot <= 0.0f ? 1.0f : sqrtf(1.0f - minDot * minDot);
+        return cluster;
+    }
+};
+#endif
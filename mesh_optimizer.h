@@ -0,0 +1,428 @@
+#pragma once
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Post-transform cache statistics of an index buffer, used to compare a mesh before and after optimization.
+// ACMR: average cache miss ratio (transformed vertices per triangle, 0.5 is the theoretical best, 3.0 the worst)
+// ATVR: average transformed vertex ratio (transformed vertices per unique vertex, 1.0 is the best)
+struct VertexCacheStatistics {
+    size_t triangles = 0;
+    size_t vertices = 0;
+    size_t transforms = 0;
+
+    float ACMR() const { return triangles ? float(transforms) / float(triangles) : 0.0f; }
+    float ATVR() const { return vertices ? float(transforms) / float(vertices) : 0.0f; }
+
+    VertexCacheStatistics& operator+=(const VertexCacheStatistics& other)
+    {
+        triangles += other.triangles;
+        vertices += other.vertices;
+        transforms += other.transforms;
+        return *this;
+    }
+};
+
+// Import-time mesh optimizations. Every step works in place on the vertex/index arrays produced by Model::processMesh,
+// so it has to run after the bone weights were written (they are addressed by the original vertex ids).
+class MeshOptimizer
+{
+public:
+    // size of the FIFO cache simulated when measuring, close to what current hardware provides
+    static const unsigned int kStatisticsCacheSize = 16;
+
+    // runs the full pipeline: welding, vertex cache reordering, overdraw ordering and vertex fetch reordering
+    static void Optimize(vector<Vertex>& vertices, vector<unsigned int>& indices, VertexCacheStatistics* before = nullptr, VertexCacheStatistics* after = nullptr)
+    {
+        if (before)
+            *before += AnalyzeVertexCache(indices, vertices.size());
+
+        WeldVertices(vertices, indices);
+        OptimizeVertexCache(indices, vertices.size());
+        OptimizeOverdraw(indices, vertices);
+        OptimizeVertexFetch(vertices, indices);
+
+        if (after)
+            *after += AnalyzeVertexCache(indices, vertices.size());
+    }
+
+    // simulates a FIFO post-transform cache over the index buffer
+    static VertexCacheStatistics AnalyzeVertexCache(const vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = kStatisticsCacheSize)
+    {
+        VertexCacheStatistics stats;
+        stats.triangles = indices.size() / 3;
+
+        // a vertex is in the cache if it was inserted less than cacheSize insertions ago
+        vector<size_t> insertedAt(vertexCount, 0);
+        vector<bool> referenced(vertexCount, false);
+        size_t timestamp = cacheSize + 1;
+        for (unsigned int index : indices)
+        {
+            if (timestamp - insertedAt[index] > cacheSize)
+            {
+                insertedAt[index] = timestamp++;
+                stats.transforms++;
+            }
+            if (!referenced[index])
+            {
+                referenced[index] = true;
+                stats.vertices++;
+            }
+        }
+        return stats;
+    }
+
+    // merges bit-identical vertices; Assimp only does this when asked with aiProcess_JoinIdenticalVertices
+    static void WeldVertices(vector<Vertex>& vertices, vector<unsigned int>& indices)
+    {
+        struct VertexHash {
+            const vector<Vertex>* vertices;
+            size_t operator()(unsigned int index) const
+            {
+                // FNV-1a over the raw vertex, Vertex only holds 4 byte members so there is no padding to worry about
+                const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&(*vertices)[index]);
+                size_t hash = 2166136261u;
+                for (size_t i = 0; i < sizeof(Vertex); i++)
+                    hash = (hash ^ bytes[i]) * 16777619u;
+                return hash;
+            }
+        };
+        struct VertexEqual {
+            const vector<Vertex>* vertices;
+            bool operator()(unsigned int a, unsigned int b) const
+            {
+                return memcmp(&(*vertices)[a], &(*vertices)[b], sizeof(Vertex)) == 0;
+            }
+        };
+
+        unordered_map<unsigned int, unsigned int, VertexHash, VertexEqual> unique(vertices.size(), VertexHash{ &vertices }, VertexEqual{ &vertices });
+        vector<unsigned int> remap(vertices.size());
+        vector<Vertex> result;
+        result.reserve(vertices.size());
+        for (unsigned int i = 0; i < vertices.size(); i++)
+        {
+            auto inserted = unique.emplace(i, unsigned(result.size()));
+            if (inserted.second)
+                result.push_back(vertices[i]);
+            remap[i] = inserted.first->second;
+        }
+        if (result.size() == vertices.size())
+            return;
+        vertices.swap(result);
+
+        for (unsigned int& index : indices)
+            index = remap[index];
+    }
+
+    // reorders triangles for the post-transform cache (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation")
+    static void OptimizeVertexCache(vector<unsigned int>& indices, size_t vertexCount)
+    {
+        const int kCacheSize = 32;
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        // vertex -> triangles adjacency, stored as one flat array with per vertex offsets
+        vector<unsigned int> offsets(vertexCount + 1, 0);
+        for (unsigned int index : indices)
+            offsets[index + 1]++;
+        for (size_t i = 0; i < vertexCount; i++)
+            offsets[i + 1] += offsets[i];
+        vector<unsigned int> adjacency(indices.size());
+        vector<unsigned int> activeCount(vertexCount, 0);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t * 3 + k];
+                adjacency[offsets[v] + activeCount[v]++] = unsigned(t);
+            }
+
+        vector<int> cachePosition(vertexCount, -1);
+        vector<float> vertexScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+            vertexScore[v] = ForsythScore(-1, activeCount[v]);
+
+        vector<float> triangleScore(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+        vector<bool> emitted(triangleCount, false);
+        vector<unsigned int> result;
+        result.reserve(indices.size());
+
+        // the cache holds up to kCacheSize entries, plus 3 slots for the triangle being added before eviction
+        vector<unsigned int> cache, nextCache;
+        cache.reserve(kCacheSize + 3);
+        nextCache.reserve(kCacheSize + 3);
+
+        size_t inputCursor = 0;
+        int bestTriangle = -1;
+        for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+        {
+            // no candidate left in the cache neighbourhood, restart from the next triangle in input order
+            if (bestTriangle < 0)
+            {
+                while (emitted[inputCursor])
+                    inputCursor++;
+                bestTriangle = int(inputCursor);
+            }
+
+            const unsigned int* tri = &indices[size_t(bestTriangle) * 3];
+            result.insert(result.end(), tri, tri + 3);
+            emitted[bestTriangle] = true;
+
+            // move the triangle's vertices to the front of the LRU cache and drop the triangle from their adjacency
+            nextCache.assign(tri, tri + 3);
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = tri[k];
+                unsigned int* begin = &adjacency[offsets[v]];
+                unsigned int* end = begin + activeCount[v];
+                *std::find(begin, end, unsigned(bestTriangle)) = *(end - 1);
+                activeCount[v]--;
+            }
+            for (unsigned int v : cache)
+                if (v != tri[0] && v != tri[1] && v != tri[2])
+                    nextCache.push_back(v);
+            std::swap(cache, nextCache);
+
+            // evicted vertices lose their cache bonus
+            for (size_t i = kCacheSize; i < cache.size(); i++)
+            {
+                cachePosition[cache[i]] = -1;
+                vertexScore[cache[i]] = ForsythScore(-1, activeCount[cache[i]]);
+            }
+            if (cache.size() > size_t(kCacheSize))
+            {
+                UpdateTriangleScores(cache.begin() + kCacheSize, cache.end(), indices, offsets, adjacency, activeCount, vertexScore, triangleScore);
+                cache.resize(kCacheSize);
+            }
+
+            for (size_t i = 0; i < cache.size(); i++)
+            {
+                cachePosition[cache[i]] = int(i);
+                vertexScore[cache[i]] = ForsythScore(int(i), activeCount[cache[i]]);
+            }
+            UpdateTriangleScores(cache.begin(), cache.end(), indices, offsets, adjacency, activeCount, vertexScore, triangleScore);
+
+            // the next triangle is the best scoring one that still touches the cache
+            bestTriangle = -1;
+            float bestScore = -1.0f;
+            for (unsigned int v : cache)
+                for (unsigned int i = offsets[v]; i < offsets[v] + activeCount[v]; i++)
+                {
+                    unsigned int t = adjacency[i];
+                    if (triangleScore[t] > bestScore)
+                    {
+                        bestScore = triangleScore[t];
+                        bestTriangle = int(t);
+                    }
+                }
+        }
+
+        indices.swap(result);
+    }
+
+    // Reorders clusters of the cache optimized index buffer so that outward facing parts are drawn first, which lets
+    // early depth testing reject more of the hidden fragments. Clusters are only split where the local cache efficiency
+    // stays within threshold of the whole mesh, so the vertex cache gain is kept (Sander et al., "Fast Triangle
+    // Reordering for Vertex Locality and Reduced Overdraw").
+    static void OptimizeOverdraw(vector<unsigned int>& indices, const vector<Vertex>& vertices, float threshold = 1.05f)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2)
+            return;
+
+        float meshACMR = AnalyzeVertexCache(indices, vertices.size()).ACMR();
+
+        // Split into clusters. Every cluster is simulated starting with an empty cache and closed as soon as its own
+        // ACMR gets within threshold of the whole mesh, so reordering the clusters can't cost more than that.
+        vector<size_t> clusterStart(1, 0);
+        vector<size_t> insertedAt(vertices.size(), 0);
+        size_t timestamp = kStatisticsCacheSize + 1;
+        size_t clusterTriangles = 0, clusterMisses = 0;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t * 3 + k];
+                if (timestamp - insertedAt[v] > kStatisticsCacheSize)
+                {
+                    insertedAt[v] = timestamp++;
+                    clusterMisses++;
+                }
+            }
+            clusterTriangles++;
+            if (t + 1 < triangleCount && float(clusterMisses) <= threshold * meshACMR * float(clusterTriangles))
+            {
+                clusterStart.push_back(t + 1);
+                clusterTriangles = 0;
+                clusterMisses = 0;
+                timestamp += kStatisticsCacheSize + 1;
+            }
+        }
+        clusterStart.push_back(triangleCount);
+        size_t clusterCount = clusterStart.size() - 1;
+        if (clusterCount < 2)
+            return;
+
+        // area weighted centroid and normal of every cluster
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        vector<glm::vec3> clusterCentroid(clusterCount, glm::vec3(0.0f));
+        vector<glm::vec3> clusterNormal(clusterCount, glm::vec3(0.0f));
+        for (size_t c = 0; c < clusterCount; c++)
+        {
+            float clusterArea = 0.0f;
+            for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+            {
+                const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+                const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                float area = glm::length(normal);
+                clusterCentroid[c] += (p0 + p1 + p2) * (area / 3.0f);
+                clusterNormal[c] += normal;
+                clusterArea += area;
+            }
+            meshCentroid += clusterCentroid[c];
+            meshArea += clusterArea;
+            clusterCentroid[c] = clusterArea > 0.0f ? clusterCentroid[c] / clusterArea : vertices[indices[clusterStart[c] * 3]].Position;
+            float normalLength = glm::length(clusterNormal[c]);
+            clusterNormal[c] = normalLength > 0.0f ? clusterNormal[c] / normalLength : glm::vec3(0.0f);
+        }
+        if (meshArea > 0.0f)
+            meshCentroid /= meshArea;
+
+        // clusters facing away from the mesh centre occlude the inner ones, draw them first
+        vector<float> sortKey(clusterCount);
+        vector<unsigned int> order(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++)
+        {
+            sortKey[c] = glm::dot(clusterCentroid[c] - meshCentroid, clusterNormal[c]);
+            order[c] = unsigned(c);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return sortKey[a] > sortKey[b]; });
+
+        vector<unsigned int> result;
+        result.reserve(indices.size());
+        for (unsigned int c : order)
+            result.insert(result.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+        indices.swap(result);
+    }
+
+    // reorders the vertex buffer in first use order of the index buffer and drops unreferenced vertices
+    static void OptimizeVertexFetch(vector<Vertex>& vertices, vector<unsigned int>& indices)
+    {
+        const unsigned int kUnused = ~0u;
+        vector<unsigned int> remap(vertices.size(), kUnused);
+        vector<Vertex> result;
+        result.reserve(vertices.size());
+        for (unsigned int& index : indices)
+        {
+            if (remap[index] == kUnused)
+            {
+                remap[index] = unsigned(result.size());
+                result.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(result);
+    }
+
+    struct MeshChunk {
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+    };
+
+    // splits a mesh into chunks of at most maxVertices vertices, keeping the (optimized) triangle order
+    static vector<MeshChunk> SplitMesh(const vector<Vertex>& vertices, const vector<unsigned int>& indices, size_t maxVertices = MAX_SHORT_INDEX_VERTICES)
+    {
+        const unsigned int kUnused = ~0u;
+        vector<MeshChunk> chunks(1);
+        vector<unsigned int> remap(vertices.size(), kUnused);
+        vector<unsigned int> chunkVertices; // vertices referenced by the current chunk, to reset remap cheaply
+
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            int newVertices = 0;
+            for (int k = 0; k < 3; k++)
+                if (remap[indices[t + k]] == kUnused)
+                    newVertices++;
+            if (chunks.back().vertices.size() + newVertices > maxVertices)
+            {
+                for (unsigned int v : chunkVertices)
+                    remap[v] = kUnused;
+                chunkVertices.clear();
+                chunks.emplace_back();
+            }
+
+            MeshChunk& chunk = chunks.back();
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t + k];
+                if (remap[v] == kUnused)
+                {
+                    remap[v] = unsigned(chunk.vertices.size());
+                    chunk.vertices.push_back(vertices[v]);
+                    chunkVertices.push_back(v);
+                }
+                chunk.indices.push_back(remap[v]);
+            }
+        }
+        return chunks;
+    }
+
+private:
+    static float ForsythScore(int cachePosition, unsigned int activeTriangles)
+    {
+        const float kCacheDecayPower = 1.5f;
+        const float kLastTriangleScore = 0.75f;
+        const float kValenceBoostScale = 2.0f;
+        const float kValenceBoostPower = 0.5f;
+        const int kCacheSize = 32;
+
+        // a vertex without remaining triangles is never needed again
+        if (activeTriangles == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // the vertices of the last triangle get a fixed score so the next one doesn't just reuse the same edge
+            if (cachePosition < 3)
+                score = kLastTriangleScore;
+            else
+                score = powf(1.0f - float(cachePosition - 3) / float(kCacheSize - 3), kCacheDecayPower);
+        }
+        // bonus for vertices with few triangles left, so lone triangles don't get stranded
+        score += kValenceBoostScale * powf(float(activeTriangles), -kValenceBoostPower);
+        return score;
+    }
+
+    template <typename Iterator>
+    static void UpdateTriangleScores(Iterator begin, Iterator end, const vector<unsigned int>& indices, const vector<unsigned int>& offsets,
+        const vector<unsigned int>& adjacency, const vector<unsigned int>& activeCount, const vector<float>& vertexScore, vector<float>& triangleScore)
+    {
+        for (Iterator it = begin; it != end; ++it)
+        {
+            unsigned int v = *it;
+            for (unsigned int i = offsets[v]; i < offsets[v] + activeCount[v]; i++)
+            {
+                unsigned int t = adjacency[i];
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+            }
+        }
+    }
+};
+#endif
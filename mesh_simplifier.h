@@ -0,0 +1,292 @@
+#pragma once
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Quadric error metric simplification (Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics").
+// Vertices are collapsed into one of their neighbours, so the simplified index buffers keep addressing the original
+// vertex buffer and all LOD levels of a mesh can share it. Vertices on open borders and on attribute seams (several
+// vertices at the same position) are locked, which keeps silhouettes and UV layouts intact.
+class MeshSimplifier
+{
+public:
+    // Simplifies indices down to about targetIndexCount indices, stopping early if the next collapse would move the
+    // surface by more than maxError (object space). Returns the simplified indices, error receives the largest error.
+    static vector<unsigned int> Simplify(const vector<Vertex>& vertices, const vector<unsigned int>& indices, size_t targetIndexCount, float maxError, float* error)
+    {
+        size_t vertexCount = vertices.size();
+        size_t triangleCount = indices.size() / 3;
+        vector<unsigned int> triangles(indices.begin(), indices.begin() + triangleCount * 3);
+
+        vector<vector<unsigned int>> vertexTriangles(vertexCount);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                vertexTriangles[triangles[t * 3 + k]].push_back(unsigned(t));
+
+        vector<bool> locked = FindLockedVertices(vertices, triangles, vertexTriangles);
+
+        // every vertex starts with the area weighted planes of its triangles
+        vector<Quadric> quadrics(vertexCount);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            Quadric q = Quadric::FromTriangle(vertices[triangles[t * 3]].Position, vertices[triangles[t * 3 + 1]].Position, vertices[triangles[t * 3 + 2]].Position);
+            for (int k = 0; k < 3; k++)
+                quadrics[triangles[t * 3 + k]] += q;
+        }
+
+        vector<bool> triangleAlive(triangleCount, true);
+        vector<unsigned int> version(vertexCount, 0);
+        vector<bool> removed(vertexCount, false);
+        priority_queue<Collapse, vector<Collapse>, greater<Collapse>> queue;
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+                PushCollapse(queue, vertices, quadrics, locked, version, a, b);
+                PushCollapse(queue, vertices, quadrics, locked, version, b, a);
+            }
+
+        size_t aliveTriangles = triangleCount;
+        float resultError = 0.0f;
+        while (aliveTriangles * 3 > targetIndexCount && !queue.empty())
+        {
+            Collapse collapse = queue.top();
+            queue.pop();
+            unsigned int from = collapse.from, to = collapse.to;
+            // stale entry, one of the vertices changed since it was queued
+            if (removed[from] || removed[to] || collapse.fromVersion != version[from] || collapse.toVersion != version[to])
+                continue;
+            if (collapse.error > maxError)
+                break;
+            if (FlipsTriangle(vertices, triangles, triangleAlive, vertexTriangles[from], from, to))
+                continue;
+
+            // move every triangle of from over to to, the ones sharing the collapsed edge disappear
+            for (unsigned int t : vertexTriangles[from])
+            {
+                if (!triangleAlive[t])
+                    continue;
+                unsigned int* tri = &triangles[size_t(t) * 3];
+                if (tri[0] == to || tri[1] == to || tri[2] == to)
+                {
+                    triangleAlive[t] = false;
+                    aliveTriangles--;
+                    continue;
+                }
+                for (int k = 0; k < 3; k++)
+                    if (tri[k] == from)
+                        tri[k] = to;
+                vertexTriangles[to].push_back(t);
+            }
+            vertexTriangles[from].clear();
+            removed[from] = true;
+            quadrics[to] += quadrics[from];
+            version[to]++;
+            resultError = std::max(resultError, collapse.error);
+
+            // compact the adjacency of to and requeue the edges around it with the merged quadric
+            vector<unsigned int>& adjacent = vertexTriangles[to];
+            adjacent.erase(std::remove_if(adjacent.begin(), adjacent.end(), [&](unsigned int t) { return !triangleAlive[t]; }), adjacent.end());
+            for (unsigned int t : adjacent)
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int other = triangles[size_t(t) * 3 + k];
+                    if (other == to)
+                        continue;
+                    PushCollapse(queue, vertices, quadrics, locked, version, other, to);
+                    PushCollapse(queue, vertices, quadrics, locked, version, to, other);
+                }
+        }
+
+        vector<unsigned int> result;
+        result.reserve(aliveTriangles * 3);
+        for (size_t t = 0; t < triangleCount; t++)
+            if (triangleAlive[t])
+                result.insert(result.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+        if (error)
+            *error = resultError;
+        return result;
+    }
+
+    // Appends up to levelCount simplified versions of indices to it, each with about half the triangles of the previous
+    // level, and describes all of them in lods. The chain ends early once a level can't get below 80% of the previous.
+    static void BuildLodChain(const vector<Vertex>& vertices, vector<unsigned int>& indices, vector<MeshLod>& lods, int levelCount)
+    {
+        lods.assign(1, MeshLod{ 0, unsigned(indices.size()), 0.0f });
+        // small meshes are cheap enough at full resolution
+        if (indices.size() < kMinLodIndices)
+            return;
+
+        vector<unsigned int> previous(indices.begin(), indices.end());
+        float previousError = 0.0f;
+        for (int level = 1; level <= levelCount; level++)
+        {
+            float error = 0.0f;
+            vector<unsigned int> lod = Simplify(vertices, previous, previous.size() / 2, FLT_MAX, &error);
+            if (lod.empty() || lod.size() > previous.size() * 4 / 5)
+                break;
+            MeshOptimizer::OptimizeVertexCache(lod, vertices.size());
+
+            // errors accumulate over the chain since every level simplifies the previous one
+            previousError += error;
+            lods.push_back(MeshLod{ unsigned(indices.size()), unsigned(lod.size()), previousError });
+            indices.insert(indices.end(), lod.begin(), lod.end());
+            previous.swap(lod);
+        }
+    }
+
+private:
+    static const size_t kMinLodIndices = 3 * 512;
+
+    // symmetric 4x4 matrix of the squared distance to a set of planes, with the accumulated area as weight
+    struct Quadric {
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+        double weight = 0;
+
+        static Quadric FromTriangle(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+        {
+            Quadric q;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(normal);
+            if (length == 0.0)
+                return q;
+            double area = length * 0.5;
+            double a = normal.x / length, b = normal.y / length, c = normal.z / length;
+            double d = -(a * p0.x + b * p0.y + c * p0.z);
+            q.a00 = a * a * area; q.a01 = a * b * area; q.a02 = a * c * area; q.a03 = a * d * area;
+            q.a11 = b * b * area; q.a12 = b * c * area; q.a13 = b * d * area;
+            q.a22 = c * c * area; q.a23 = c * d * area;
+            q.a33 = d * d * area;
+            q.weight = area;
+            return q;
+        }
+
+        Quadric& operator+=(const Quadric& o)
+        {
+            a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+            a11 += o.a11; a12 += o.a12; a13 += o.a13;
+            a22 += o.a22; a23 += o.a23;
+            a33 += o.a33;
+            weight += o.weight;
+            return *this;
+        }
+
+        // root mean squared distance of p to the planes
+        float Error(const glm::vec3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                + a22 * z * z + 2 * a23 * z
+                + a33;
+            return weight > 0.0 ? float(sqrt(std::max(e, 0.0) / weight)) : 0.0f;
+        }
+    };
+
+    struct Collapse {
+        float error;
+        unsigned int from, to;
+        unsigned int fromVersion, toVersion;
+        bool operator>(const Collapse& other) const { return error > other.error; }
+    };
+
+    static void PushCollapse(priority_queue<Collapse, vector<Collapse>, greater<Collapse>>& queue, const vector<Vertex>& vertices,
+        const vector<Quadric>& quadrics, const vector<bool>& locked, const vector<unsigned int>& version, unsigned int from, unsigned int to)
+    {
+        if (locked[from])
+            return;
+        Quadric q = quadrics[from];
+        q += quadrics[to];
+        queue.push(Collapse{ q.Error(vertices[to].Position), from, to, version[from], version[to] });
+    }
+
+    // border vertices (on an edge used by a single triangle) and seam vertices (sharing the position of another vertex)
+    static vector<bool> FindLockedVertices(const vector<Vertex>& vertices, const vector<unsigned int>& triangles, const vector<vector<unsigned int>>& vertexTriangles)
+    {
+        vector<bool> locked(vertices.size(), false);
+
+        struct PositionHash {
+            size_t operator()(const glm::vec3& p) const
+            {
+                size_t h = 0;
+                const unsigned int* bits = reinterpret_cast<const unsigned int*>(&p);
+                for (int i = 0; i < 3; i++)
+                    h = (h ^ bits[i]) * 16777619u;
+                return h;
+            }
+        };
+        struct PositionEqual {
+            bool operator()(const glm::vec3& a, const glm::vec3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+        };
+        unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> firstAtPosition;
+        firstAtPosition.reserve(vertices.size());
+        for (unsigned int v = 0; v < vertices.size(); v++)
+        {
+            auto inserted = firstAtPosition.emplace(vertices[v].Position, v);
+            if (!inserted.second)
+            {
+                locked[v] = true;
+                locked[inserted.first->second] = true;
+            }
+        }
+
+        // an edge a->b is a border if no triangle of a also contains the edge b->a
+        for (size_t t = 0; t < triangles.size() / 3; t++)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+                bool shared = false;
+                for (unsigned int other : vertexTriangles[a])
+                {
+                    const unsigned int* tri = &triangles[size_t(other) * 3];
+                    for (int j = 0; j < 3; j++)
+                        if (tri[j] == b && tri[(j + 1) % 3] == a)
+                            shared = true;
+                }
+                if (!shared)
+                    locked[a] = locked[b] = true;
+            }
+        return locked;
+    }
+
+    // true if moving from onto to turns any remaining triangle of from upside down
+    static bool FlipsTriangle(const vector<Vertex>& vertices, const vector<unsigned int>& triangles, const vector<bool>& triangleAlive,
+        const vector<unsigned int>& fromTriangles, unsigned int from, unsigned int to)
+    {
+        for (unsigned int t : fromTriangles)
+        {
+            if (!triangleAlive[t])
+                continue;
+            const unsigned int* tri = &triangles[size_t(t) * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+                continue;
+            glm::vec3 p[3], q[3];
+            for (int k = 0; k < 3; k++)
+            {
+                p[k] = vertices[tri[k]].Position;
+                q[k] = tri[k] == from ? vertices[to].Position : p[k];
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+            if (glm::dot(before, after) <= 0.0f)
+                return true;
+        }
+        return false;
+    }
+};
+#endif
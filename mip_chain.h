@@ -0,0 +1,216 @@
+#pragma once
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_CHAIN_SSE2 1
+#endif
+
+struct MipLevel {
+    int width, height;
+    size_t offset, size;
+};
+
+// the levels below level 0 of an image, all in one buffer
+struct MipChain {
+    int channels = 0;
+    vector<MipLevel> levels;
+    vector<unsigned char> data;
+};
+
+// Builds mip chains on the CPU, for drivers that generate mipmaps slowly (software GL does it pixel by pixel on the
+// GL thread). Every level is a 2x2 box filter of the one above it. Colour channels of sRGB images are averaged in
+// linear light and encoded again, so the smaller levels don't darken; alpha and linear data are averaged as they are.
+// Everything runs on the calling thread: the TextureLoader's decode workers already build several chains at once.
+class MipChainBuilder
+{
+public:
+    static int LevelCount(int width, int height)
+    {
+        int count = 1;
+        while (width > 1 || height > 1)
+        {
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            count++;
+        }
+        return count;
+    }
+
+    // fills out with levels 1 and below of pixels (width * height * channels bytes), level 0 isn't copied
+    static void Build(const unsigned char* pixels, int width, int height, int channels, bool srgb, MipChain& out)
+    {
+        out.channels = channels;
+        out.levels.clear();
+        size_t total = 0;
+        for (int w = width, h = height; w > 1 || h > 1;)
+        {
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+            MipLevel level{ w, h, total, size_t(w) * h * channels };
+            out.levels.push_back(level);
+            total += level.size;
+        }
+        out.data.resize(total);
+
+        const unsigned char* source = pixels;
+        for (const MipLevel& level : out.levels)
+        {
+            Downsample(source, width, height, channels, srgb, &out.data[level.offset]);
+            source = &out.data[level.offset];
+            width = level.width;
+            height = level.height;
+        }
+    }
+
+    // filters the next level of source into out, (width / 2) * (height / 2) * channels bytes; a side of 1 pairs its
+    // only row or column with itself
+    static void Downsample(const unsigned char* source, int width, int height, int channels, bool srgb, unsigned char* out)
+    {
+        switch (channels)
+        {
+        case 1: FilterRows<1>(source, width, height, srgb, out); break;
+        case 2: FilterRows<2>(source, width, height, srgb, out); break;
+        case 3: FilterRows<3>(source, width, height, srgb, out); break;
+        default: FilterRows<4>(source, width, height, srgb, out); break;
+        }
+    }
+
+private:
+    // sRGB byte to 16 bit linear value, and back from a linear value rounded to 12 bits
+    struct SrgbTables {
+        uint16_t toLinear[256];
+        unsigned char fromLinear[4097];
+
+        SrgbTables()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                float linear = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+                toLinear[i] = uint16_t(linear * 65535.0f + 0.5f);
+            }
+            for (int i = 0; i <= 4096; i++)
+            {
+                float linear = std::min(1.0f, i / 4096.0f);
+                float c = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+                fromLinear[i] = (unsigned char)(c * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    static const SrgbTables& Tables()
+    {
+        static SrgbTables tables;
+        return tables;
+    }
+
+    template <int Channels>
+    static void FilterRows(const unsigned char* source, int width, int height, bool srgb, unsigned char* out)
+    {
+        int outWidth = std::max(1, width / 2);
+        int outHeight = std::max(1, height / 2);
+        size_t rowLength = size_t(width) * Channels;
+        // gray + alpha and RGBA keep their last channel linear
+        const int colourChannels = Channels == 2 || Channels == 4 ? Channels - 1 : Channels;
+        // each output row is a vertical sum of two source rows first, then pairs of columns of that sum
+        vector<uint32_t> linearSums(srgb ? rowLength : 0);
+        vector<uint16_t> sums(srgb ? 0 : rowLength);
+        const SrgbTables& tables = Tables();
+
+        for (int y = 0; y < outHeight; y++)
+        {
+            const unsigned char* row0 = source + size_t(std::min(y * 2, height - 1)) * rowLength;
+            const unsigned char* row1 = source + size_t(std::min(y * 2 + 1, height - 1)) * rowLength;
+            unsigned char* target = out + size_t(y) * outWidth * Channels;
+
+            if (srgb)
+            {
+                // the table lookups are a gather per byte and stay scalar, the sums after them don't
+                for (size_t i = 0; i < rowLength; i += Channels)
+                    for (int c = 0; c < Channels; c++)
+                        linearSums[i + c] = c < colourChannels ? tables.toLinear[row0[i + c]] + tables.toLinear[row1[i + c]]
+                            : (row0[i + c] + row1[i + c]) * 257u;
+                int x = 0;
+#ifdef MIP_CHAIN_SSE2
+                if (Channels == 4 && width > 1)
+                {
+                    // the four channels of one RGBA output pixel per step: average, then the 12 bit table index
+                    const __m128i two = _mm_set1_epi32(2), eight = _mm_set1_epi32(8);
+                    alignas(16) uint32_t index[4];
+                    for (; x < outWidth; x++)
+                    {
+                        __m128i a = _mm_loadu_si128((const __m128i*)(&linearSums[size_t(x) * 8]));
+                        __m128i b = _mm_loadu_si128((const __m128i*)(&linearSums[size_t(x) * 8 + 4]));
+                        __m128i average = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(a, b), two), 2);
+                        _mm_store_si128((__m128i*)index, _mm_srli_epi32(_mm_add_epi32(average, eight), 4));
+                        unsigned char* pixel = target + size_t(x) * 4;
+                        pixel[0] = tables.fromLinear[index[0]];
+                        pixel[1] = tables.fromLinear[index[1]];
+                        pixel[2] = tables.fromLinear[index[2]];
+                        pixel[3] = (unsigned char)((uint32_t(_mm_cvtsi128_si32(_mm_srli_si128(average, 12))) + 128) / 257);
+                    }
+                }
+#endif
+                for (; x < outWidth; x++)
+                {
+                    const uint32_t* s0 = &linearSums[size_t(std::min(x * 2, width - 1)) * Channels];
+                    const uint32_t* s1 = &linearSums[size_t(std::min(x * 2 + 1, width - 1)) * Channels];
+                    for (int c = 0; c < Channels; c++)
+                    {
+                        uint32_t average = (s0[c] + s1[c] + 2) / 4;
+                        target[x * Channels + c] = c < colourChannels ? tables.fromLinear[(average + 8) >> 4] : (unsigned char)((average + 128) / 257);
+                    }
+                }
+                continue;
+            }
+
+            size_t i = 0;
+#ifdef MIP_CHAIN_SSE2
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 16 <= rowLength; i += 16)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i*)(row0 + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(row1 + i));
+                _mm_storeu_si128((__m128i*)(&sums[i]), _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+                _mm_storeu_si128((__m128i*)(&sums[i + 8]), _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+            }
+#endif
+            for (; i < rowLength; i++)
+                sums[i] = uint16_t(row0[i] + row1[i]);
+
+            int x = 0;
+#ifdef MIP_CHAIN_SSE2
+            if (Channels == 4 && width > 1)
+            {
+                // two RGBA output pixels from four summed source pixels per step
+                const __m128i two = _mm_set1_epi16(2);
+                for (; x + 2 <= outWidth; x += 2)
+                {
+                    __m128i a = _mm_loadu_si128((const __m128i*)(&sums[size_t(x) * 8]));
+                    __m128i b = _mm_loadu_si128((const __m128i*)(&sums[size_t(x) * 8 + 8]));
+                    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+                    sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+                    _mm_storel_epi64((__m128i*)(target + size_t(x) * 4), _mm_packus_epi16(sum, sum));
+                }
+            }
+#endif
+            for (; x < outWidth; x++)
+            {
+                const uint16_t* s0 = &sums[size_t(std::min(x * 2, width - 1)) * Channels];
+                const uint16_t* s1 = &sums[size_t(std::min(x * 2 + 1, width - 1)) * Channels];
+                for (int c = 0; c < Channels; c++)
+                    target[x * Channels + c] = (unsigned char)((s0[c] + s1[c] + 2) / 4);
+            }
+        }
+    }
+};
+#endif
@@ -10,9 +10,17 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "arena.h"
 #include "mesh.h"
+#include "mesh_clusters.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "profiler.h"
 #include "shader.h"
+#include "software_occlusion.h"
+#include "texture_loader.h"
 
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -21,9 +29,26 @@
 #include <vector>
 #include "assimp_glm_helpers.h"
 #include "animdata.h"
+#include "alloc_stats.h"
 
 using namespace std;
 
+// import settings of a Model, the defaults are what the scene uses
+struct ModelImportOptions {
+	// split meshes with more than MAX_SHORT_INDEX_VERTICES vertices so every part can be drawn with 16 bit indices
+	bool splitForShortIndices = true;
+	// simplified levels of detail generated per mesh, on top of the full resolution one
+	int lodLevels = 3;
+	// split the full resolution of large meshes into clusters for finer grained culling
+	bool buildClusters = true;
+	// keep the vertices and indices in memory after they were uploaded, nothing in the scene reads them back
+	bool keepGeometry = false;
+	// pack textures of the same role, size and channels into texture arrays; packed textures aren't streamed
+	bool packTextureArrays = true;
+	// simplify every static mesh down to this many triangles into the model's occluder, 0 builds none
+	size_t occluderTriangles = 0;
+};
+
 class Model
 {
 public:
@@ -32,20 +57,119 @@ public:
 	vector<Mesh>    meshes;
 	string directory;
 	bool gammaCorrection;
+	ModelImportOptions importOptions;
+	// a coarse copy of the static meshes for the CPU occlusion buffer, empty unless importOptions asked for one
+	OccluderMesh occluder;
+
 
 
+	// post processing every model is imported with
+	static const unsigned int ImportFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace;
 
 	// constructor, expects a filepath to a 3D model.
-	Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+	Model(string const& path, bool gamma = false, ModelImportOptions options = ModelImportOptions()) : gammaCorrection(gamma), importOptions(options), m_Arena(4 * 1024)
 	{
+		ProfileScope profile("Model", path);
+		AllocationSnapshot before = AllocationSnapshot::Take();
+		ResetPeakLiveBytes();
 		loadModel(path);
+		reportLoad(path, before);
+	}
+
+	// constructor for a file importer has already read with ImportFlags, on any thread; the meshes and textures are
+	// created here, on the GL thread
+	Model(string const& path, Assimp::Importer& importer, ModelImportOptions options = ModelImportOptions()) : gammaCorrection(false), importOptions(options), m_Arena(4 * 1024)
+	{
+		ProfileScope profile("Model", path);
+		AllocationSnapshot before = AllocationSnapshot::Take();
+		ResetPeakLiveBytes();
+		loadScene(importer, path);
+		reportLoad(path, before);
+	}
+
+	// deletes the buffers and textures of the model, which draws nothing afterwards; needs the GL context
+	void Release()
+	{
+		for (Mesh& mesh : meshes)
+			mesh.Release();
+		// texture arrays are shared by several entries
+		vector<unsigned int> released;
+		for (const Texture& texture : textures_loaded)
+			if (texture.id != 0 && std::find(released.begin(), released.end(), texture.id) == released.end())
+			{
+				TextureLoader::Instance().Release(texture.id);
+				released.push_back(texture.id);
+			}
+		meshes.clear();
+		textures_loaded.clear();
+	}
+
+	// video memory of the vertex and index buffers
+	size_t BufferBytes() const
+	{
+		size_t bytes = 0;
+		for (const Mesh& mesh : meshes)
+			bytes += mesh.bufferBytes;
+		return bytes;
+	}
+
+	// video memory of the textures as far as they have loaded, see TextureLoader::ResidentBytes
+	size_t TextureBytes() const
+	{
+		// texture arrays are shared by several entries
+		vector<unsigned int> counted;
+		size_t bytes = 0;
+		for (const Texture& texture : textures_loaded)
+			if (texture.id != 0 && std::find(counted.begin(), counted.end(), texture.id) == counted.end())
+			{
+				bytes += TextureLoader::Instance().ResidentBytes(texture.id);
+				counted.push_back(texture.id);
+			}
+		return bytes;
+	}
+
+	// object space box around the bounding spheres of all meshes, false for a model without meshes
+	bool GetBounds(glm::vec3& minimum, glm::vec3& maximum) const
+	{
+		if (meshes.empty())
+			return false;
+		minimum = glm::vec3(FLT_MAX);
+		maximum = glm::vec3(-FLT_MAX);
+		for (const Mesh& mesh : meshes)
+		{
+			minimum = glm::min(minimum, mesh.boundsCenter - glm::vec3(mesh.boundsRadius));
+			maximum = glm::max(maximum, mesh.boundsCenter + glm::vec3(mesh.boundsRadius));
+		}
+		return true;
 	}
 
 	// draws the model, and thus all its meshes
 	void Draw(Shader& shader)
 	{
 		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			// no view to judge the size on screen from, stream the textures in at full resolution
+			meshes[i].RequestTextures(FLT_MAX);
 			meshes[i].Draw(shader);
+		}
+	}
+
+	// draws the model with the level of detail of every mesh chosen from its projected size, culling the clusters of
+	// meshes drawn at full resolution
+	void Draw(Shader& shader, const glm::mat4& model, const DrawView& view)
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(shader, model, view);
+	}
+
+	// draws the model once per instance of the buffer, with a shader that reads the instance attributes
+	void DrawInstanced(Shader& shader, const InstanceBuffer& instances)
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			meshes[i].RequestTextures(FLT_MAX);
+			meshes[i].DrawInstanced(shader, instances);
+		}
 	}
 
 	auto& GetBoneInfoMap() { return m_BoneInfoMap; }
@@ -57,12 +181,39 @@ private:
 	std::map<string, BoneInfo> m_BoneInfoMap;
 	int m_BoneCounter = 0;
 
+	// owns the texture paths, released with the model
+	LinearArena m_Arena;
+
+	// post-transform cache statistics of all meshes of this asset, before and after MeshOptimizer
+	VertexCacheStatistics m_CacheStatsBefore;
+	VertexCacheStatistics m_CacheStatsAfter;
+
+	void reportLoad(string const& path, const AllocationSnapshot& before)
+	{
+		AllocationSnapshot after = AllocationSnapshot::Take();
+		// peak is how far the heap grew while loading, steady is what the model keeps afterwards
+		cout << "MODEL::LOAD:: " << path << " allocations " << after.allocations - before.allocations
+			<< ", peak heap +" << (after.peakLiveBytes - before.liveBytes) / 1024 << " KB"
+			<< ", steady heap +" << ((long long)after.liveBytes - (long long)before.liveBytes) / 1024 << " KB"
+			<< ", RSS " << CurrentResidentBytes() / (1024 * 1024) << " MB"
+			<< ", arena blocks " << m_Arena.BlockCount() << ", arena used " << m_Arena.UsedBytes() << " of " << m_Arena.CapacityBytes() << " bytes" << endl;
+	}
+
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 	void loadModel(string const& path)
 	{
 		// read file via ASSIMP
+		ProfileScope readProfile("Assimp import");
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
+		importer.ReadFile(path, ImportFlags);
+		readProfile.End();
+		loadScene(importer, path);
+	}
+
+	// builds the meshes and textures from the scene importer has read
+	void loadScene(Assimp::Importer& importer, string const& path)
+	{
+		const aiScene* scene = importer.GetScene();
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
@@ -73,7 +224,16 @@ private:
 		directory = path.substr(0, path.find_last_of('/'));
 
 		// process ASSIMP's root node recursively
+		meshes.reserve(scene->mNumMeshes);
+		ProfileScope meshProfile("Model meshes");
 		processNode(scene->mRootNode, scene);
+		meshProfile.End();
+		ProfileScope textureProfile("Model textures");
+		loadTextures();
+		textureProfile.End();
+
+		cout << "MESH::OPTIMIZE:: " << path << " ACMR " << m_CacheStatsBefore.ACMR() << " -> " << m_CacheStatsAfter.ACMR()
+			<< ", ATVR " << m_CacheStatsBefore.ATVR() << " -> " << m_CacheStatsAfter.ATVR() << endl;
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -85,7 +245,7 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			processMesh(mesh, scene);
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
@@ -105,12 +265,15 @@ private:
 	}
 
 
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+	// converts an aiMesh and appends it to meshes, as several parts if it's too large for 16 bit indices
+	void processMesh(aiMesh* mesh, const aiScene* scene)
 	{
-		// data to fill
+		// data to fill, sized up front from the counts Assimp gives
 		vector<Vertex> vertices;
 		vector<unsigned int> indices;
 		vector<Texture> textures;
+		vertices.reserve(mesh->mNumVertices);
+		indices.reserve(size_t(mesh->mNumFaces) * 3);
 
 		// walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -155,7 +318,12 @@ private:
 				vertex.Bitangent = vector;
 			}
 			else
+			{
 				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+				// keep the vertex fully defined, the optimizer welds vertices by comparing their bytes
+				vertex.Tangent = glm::vec3(0.0f);
+				vertex.Bitangent = glm::vec3(0.0f);
+			}
 
 			vertices.push_back(vertex);
 		}
@@ -163,6 +331,9 @@ private:
 		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
 			aiFace face = mesh->mFaces[i];
+			// aiProcess_Triangulate leaves point and line primitives alone, they can't be drawn as GL_TRIANGLES
+			if (face.mNumIndices != 3)
+				continue;
 			// retrieve all indices of the face and store them in the indices vector
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
 				indices.push_back(face.mIndices[j]);
@@ -191,7 +362,38 @@ private:
 
 		ExtractBoneWeightForVertices(vertices, mesh, scene);
 
-		return Mesh(vertices, indices, textures);
+		// reorder for the vertex cache and early depth rejection, after the bone weights were assigned by vertex id
+		MeshOptimizer::Optimize(vertices, indices, &m_CacheStatsBefore, &m_CacheStatsAfter);
+
+		bool skinned = mesh->mNumBones > 0;
+		if (importOptions.splitForShortIndices && vertices.size() > MAX_SHORT_INDEX_VERTICES)
+		{
+			vector<MeshOptimizer::MeshChunk> chunks = MeshOptimizer::SplitMesh(vertices, indices);
+			// the chunks hold their own copies, free the whole mesh before they are processed
+			vector<Vertex>().swap(vertices);
+			vector<unsigned int>().swap(indices);
+			for (MeshOptimizer::MeshChunk& chunk : chunks)
+				addMesh(chunk.vertices, chunk.indices, textures, skinned);
+		}
+		else
+			addMesh(vertices, indices, textures, skinned);
+	}
+
+	// builds the LOD chain and clusters of a processed mesh and uploads it, vertices and indices are moved into the Mesh
+	void addMesh(vector<Vertex>& vertices, vector<unsigned int>& indices, vector<Texture>& textures, bool skinned)
+	{
+		// skinned meshes deform, static simplification errors and cluster bounds mean nothing for them
+		vector<MeshLod> lods;
+		MeshSimplifier::BuildLodChain(vertices, indices, lods, skinned ? 0 : importOptions.lodLevels);
+		// a mesh that fits a couple of clusters gains nothing over the whole-model test
+		vector<MeshCluster> clusters;
+		if (importOptions.buildClusters && !skinned && lods[0].indexCount > 3 * 4 * MeshClusterBuilder::kMaxTriangles)
+			clusters = MeshClusterBuilder::Build(vertices, indices, lods[0].indexOffset, lods[0].indexCount);
+		if (importOptions.occluderTriangles > 0 && !skinned)
+			occluder.Append(vertices, indices, lods.back(), importOptions.occluderTriangles);
+		meshes.emplace_back(std::move(vertices), std::move(indices), textures, std::move(lods), std::move(clusters));
+		if (!importOptions.keepGeometry)
+			meshes.back().ReleaseGeometry();
 	}
 
 	void SetVertexBoneData(Vertex& vertex, int boneID, float weight)
@@ -245,49 +447,17 @@ private:
 	}
 
 
-	unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false)
+	// the texture is decoded on a worker thread and shows a placeholder until TextureLoader uploads it
+	unsigned int TextureFromFile(const char* path, const string& directory, const TextureLoadOptions& options = TextureLoadOptions())
 	{
 		string filename = string(path);
 		filename = directory + '/' + filename;
-
-		unsigned int textureID;
-		glGenTextures(1, &textureID);
-
-		int width, height, nrComponents;
-		unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-		if (data)
-		{
-			GLenum format;
-			if (nrComponents == 1)
-				format = GL_RED;
-			else if (nrComponents == 3)
-				format = GL_RGB;
-			else if (nrComponents == 4)
-				format = GL_RGBA;
-
-			glBindTexture(GL_TEXTURE_2D, textureID);
-			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-			glGenerateMipmap(GL_TEXTURE_2D);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Texture failed to load at path: " << path << std::endl;
-			stbi_image_free(data);
-		}
-
-		return textureID;
+		return TextureLoader::Instance().Load2D(filename, options);
 	}
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
 	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+	vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, const char* typeName)
 	{
 		vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
@@ -298,7 +468,7 @@ private:
 			bool skip = false;
 			for (unsigned int j = 0; j < textures_loaded.size(); j++)
 			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+				if (std::strcmp(textures_loaded[j].path, str.C_Str()) == 0)
 				{
 					textures.push_back(textures_loaded[j]);
 					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
@@ -308,15 +478,101 @@ private:
 			if (!skip)
 			{   // if texture hasn't been loaded already, load it
 				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
+				// loadTextures fills in the texture once every texture of the model is known
+				texture.id = 0;
 				texture.type = typeName;
-				texture.path = str.C_Str();
+				texture.path = m_Arena.Intern(str.C_Str());
 				textures.push_back(texture);
 				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
 			}
 		}
 		return textures;
 	}
+
+	TextureLoadOptions textureOptions(const char* typeName)
+	{
+		TextureLoadOptions options;
+		// only the mip levels the draws need are kept resident
+		options.stream = true;
+		// only the diffuse maps are colour, specular, normal and height maps hold linear data
+		options.srgb = std::strcmp(typeName, "texture_diffuse") == 0;
+		// the bump maps of these models are tangent space normal maps; a flat normal until the real one arrives
+		if (std::strcmp(typeName, "texture_normal") == 0)
+		{
+			options.normalMap = true;
+			options.placeholder[0] = 128;
+			options.placeholder[1] = 128;
+			options.placeholder[2] = 255;
+		}
+		return options;
+	}
+
+	// loads the textures collected by loadMaterialTextures. Textures of one role with the same size and channels are
+	// packed into a texture array, so the meshes using them draw without rebinding; the others load on their own.
+	void loadTextures()
+	{
+		struct TextureGroup {
+			const char* type;
+			int width, height, channels;
+			vector<size_t> members;
+		};
+		vector<TextureGroup> groups;
+		for (size_t i = 0; i < textures_loaded.size(); i++)
+		{
+			Texture& texture = textures_loaded[i];
+			string filename = directory + '/' + texture.path;
+			int width = 0, height = 0, channels = 0;
+			// the image header is enough to tell which textures fit in one array
+			if (!importOptions.packTextureArrays || !stbi_info(filename.c_str(), &width, &height, &channels))
+			{
+				texture.id = TextureFromFile(texture.path, directory, textureOptions(texture.type));
+				continue;
+			}
+			bool grouped = false;
+			for (TextureGroup& group : groups)
+				if (std::strcmp(group.type, texture.type) == 0 && group.width == width && group.height == height && group.channels == channels)
+				{
+					group.members.push_back(i);
+					grouped = true;
+					break;
+				}
+			if (!grouped)
+				groups.push_back(TextureGroup{ texture.type, width, height, channels, vector<size_t>(1, i) });
+		}
+
+		for (const TextureGroup& group : groups)
+		{
+			if (group.members.size() == 1)
+			{
+				Texture& texture = textures_loaded[group.members[0]];
+				texture.id = TextureFromFile(texture.path, directory, textureOptions(texture.type));
+				continue;
+			}
+			vector<string> layers;
+			for (size_t member : group.members)
+				layers.push_back(directory + '/' + textures_loaded[member].path);
+			unsigned int array = TextureLoader::Instance().LoadArray(layers, textureOptions(group.type));
+			for (size_t layer = 0; layer < group.members.size(); layer++)
+			{
+				textures_loaded[group.members[layer]].id = array;
+				textures_loaded[group.members[layer]].layer = int(layer);
+			}
+		}
+
+		// the meshes hold copies, paths are interned so the pointers identify the textures
+		for (Mesh& mesh : meshes)
+		{
+			for (Texture& texture : mesh.textures)
+				for (const Texture& loaded : textures_loaded)
+					if (loaded.path == texture.path)
+					{
+						texture.id = loaded.id;
+						texture.layer = loaded.layer;
+						break;
+					}
+			mesh.material = Material::FromTextures(mesh.textures);
+		}
+	}
 };
 
 
@@ -0,0 +1,157 @@
+#pragma once
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "frustum_culler.h"
+#include "gl_state.h"
+#include "proxy_cube.h"
+
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+// what the occlusion stage did this frame
+struct OcclusionStats {
+    // proxy boxes drawn under a query
+    size_t queries = 0;
+    // objects skipped because their box was hidden last frame
+    size_t occluded = 0;
+    // objects whose query was still running, drawn under conditional render
+    size_t conditional = 0;
+};
+
+// Hardware occlusion culling with the answers of the frame before. After the opaque draws, IssueQueries draws the
+// box of every object tested this frame with colour and depth writes off, each under its own GL_ANY_SAMPLES_PASSED
+// query. The next frame BeginFrame collects the results that are in without waiting for the others, and Test tells
+// whether an object was hidden; one whose query hasn't come back yet is drawn under glBeginConditionalRender with
+// GL_QUERY_NO_WAIT on it, so the GPU skips it if it knows by then and draws it otherwise. Hidden objects are still
+// tested every frame, and show up again one frame after they come out. Objects are slots the caller keeps stable
+// from frame to frame; a box around the camera is never tested, the near plane would cut it away.
+class OcclusionCuller
+{
+public:
+    // CULLED is for the caller, for objects left out before the occlusion test
+    enum Visibility { VISIBLE = 0, PENDING, OCCLUDED, CULLED };
+
+    // how close to a box the camera may get before it is no longer tested
+    float nearMargin = 1.0f;
+
+    OcclusionCuller() = default;
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    // reads the results of the queries that finished since the last frame, before any Test
+    void BeginFrame()
+    {
+        m_Frame++;
+        m_Stats = OcclusionStats();
+        m_Tested.clear();
+        for (Entry& entry : m_Entries)
+        {
+            if (!entry.pending)
+                continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            GLuint samplesPassed = 0;
+            glGetQueryObjectuiv(entry.query, GL_QUERY_RESULT, &samplesPassed);
+            entry.occluded = samplesPassed == 0;
+            entry.pending = false;
+        }
+    }
+
+    // the verdict on object, whose box is in world space, and queues the box to be tested again this frame
+    Visibility Test(size_t object, const BoundingBox& box, const glm::vec3& viewPos)
+    {
+        if (object >= m_Entries.size())
+            m_Entries.resize(object + 1);
+        Entry& entry = m_Entries[object];
+        bool testedLastFrame = entry.lastFrame + 1 == m_Frame;
+        entry.lastFrame = m_Frame;
+        // an answer from before the object last left the view says nothing about it now
+        if (!testedLastFrame && !entry.pending)
+            entry.occluded = false;
+
+        glm::vec3 margin(nearMargin);
+        if (BoundingBox{ box.minimum - margin, box.maximum + margin }.Contains(BoundingBox{ viewPos, viewPos }))
+        {
+            entry.occluded = false;
+            return VISIBLE;
+        }
+        if (entry.pending)
+        {
+            m_Stats.conditional++;
+            return PENDING;
+        }
+        m_Tested.push_back(Tested{ object, box });
+        if (entry.occluded)
+        {
+            m_Stats.occluded++;
+            return OCCLUDED;
+        }
+        return VISIBLE;
+    }
+
+    // the query a PENDING object is drawn under
+    GLuint Query(size_t object) const
+    {
+        return object < m_Entries.size() ? m_Entries[object].query : 0;
+    }
+
+    // draws the boxes Test queued this frame, each under its query; call after the opaque draws so their depth is in
+    void IssueQueries(const glm::mat4& viewProjection)
+    {
+        if (m_Tested.empty())
+            return;
+        GLState& state = GLState::Instance();
+        // the lazy models' placeholder program, only its depth matters here
+        ProxyCube& cube = ProxyCube::Instance();
+        Shader& shader = cube.Bind(viewProjection);
+        state.Enable(GL_DEPTH_TEST);
+        state.DepthMask(false);
+        // both faces, a box the camera is close to may show only its inside
+        state.Disable(GL_CULL_FACE);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for (const Tested& tested : m_Tested)
+        {
+            Entry& entry = m_Entries[tested.object];
+            if (!entry.query)
+                glGenQueries(1, &entry.query);
+            shader.setMat4("model", ProxyCube::BoxMatrix(glm::mat4(1.0f), tested.box.minimum, tested.box.maximum));
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, entry.query);
+            cube.Draw();
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            entry.pending = true;
+            m_Stats.queries++;
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        state.DepthMask(true);
+    }
+
+    const OcclusionStats& Stats() const { return m_Stats; }
+
+private:
+    struct Entry {
+        GLuint query = 0;
+        // the query was issued and its result not read yet
+        bool pending = false;
+        // no sample of the box passed when it was last tested
+        bool occluded = false;
+        unsigned int lastFrame = 0;
+    };
+
+    struct Tested {
+        size_t object;
+        BoundingBox box;
+    };
+
+    vector<Entry> m_Entries;
+    vector<Tested> m_Tested;
+    unsigned int m_Frame = 1;
+    OcclusionStats m_Stats;
+};
+#endif
@@ -0,0 +1,231 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Records named spans of time on every thread while the scene starts up. WriteChromeTrace saves them in the Chrome
+// trace event format (open in chrome://tracing or ui.perfetto.dev) and PrintSummary breaks the time to the first
+// frame down into the scopes of the main thread that made it up, followed by totals per scope over all threads.
+// Recording stops with Finish, the scopes are left in the code and cost a clock read afterwards.
+class Profiler
+{
+public:
+    struct Event {
+        const char* name;
+        string detail;
+        int thread;
+        int depth;
+        // microseconds since the profiler started
+        double start;
+        double duration;
+    };
+
+    static Profiler& Instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    double Now() const
+    {
+        return chrono::duration<double, micro>(chrono::steady_clock::now() - m_Start).count();
+    }
+
+    bool IsRecording() const { return m_Recording; }
+
+    // the name the calling thread gets in the trace
+    void SetThreadName(const string& name)
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_ThreadNames[CurrentThread().index] = name;
+    }
+
+    void Record(Event event)
+    {
+        if (!m_Recording)
+            return;
+        lock_guard<mutex> lock(m_Mutex);
+        m_Events.push_back(std::move(event));
+    }
+
+    // an instant in the trace, like the first frame
+    void Mark(const char* name)
+    {
+        Record(Event{ name, string(), CurrentThread().index, -1, Now(), 0.0 });
+    }
+
+    void MarkFirstFrame()
+    {
+        if (m_FirstFrame < 0.0)
+        {
+            m_FirstFrame = Now();
+            Mark("First frame");
+        }
+    }
+
+    void Finish()
+    {
+        m_Recording = false;
+    }
+
+    bool WriteChromeTrace(const string& path)
+    {
+        FILE* file = fopen(path.c_str(), "w");
+        if (!file)
+            return false;
+        lock_guard<mutex> lock(m_Mutex);
+        fprintf(file, "{\"traceEvents\":[\n");
+        bool first = true;
+        for (const auto& thread : m_ThreadNames)
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", thread.first, Escape(thread.second).c_str());
+            first = false;
+        }
+        for (const Event& event : m_Events)
+        {
+            if (event.depth < 0)
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%d,\"ts\":%.1f}",
+                    first ? "" : ",\n", Escape(event.name).c_str(), event.thread, event.start);
+            else
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f,\"args\":{\"detail\":\"%s\"}}",
+                    first ? "" : ",\n", Escape(event.name).c_str(), event.thread, event.start, event.duration, Escape(event.detail).c_str());
+            first = false;
+        }
+        fprintf(file, "\n]}\n");
+        return fclose(file) == 0;
+    }
+
+    void PrintSummary()
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        char line[512];
+        if (m_FirstFrame >= 0.0)
+        {
+            // the main thread runs the startup one scope after the other, its outermost scopes are the critical path
+            cout << "PROFILE:: first frame after " << m_FirstFrame / 1000.0 << " ms, critical path on the main thread:" << endl;
+            cout << "      ms      %  scope" << endl;
+            double tracked = 0.0;
+            for (const Event& event : m_Events)
+            {
+                if (event.thread != 0 || event.depth != 0 || event.start >= m_FirstFrame)
+                    continue;
+                snprintf(line, sizeof(line), "%8.1f %6.1f  %s %s", event.duration / 1000.0, 100.0 * event.duration / m_FirstFrame, event.name, event.detail.c_str());
+                cout << line << endl;
+                tracked += event.duration;
+            }
+            snprintf(line, sizeof(line), "%8.1f %6.1f  (not in a scope)", (m_FirstFrame - tracked) / 1000.0, 100.0 * (m_FirstFrame - tracked) / m_FirstFrame);
+            cout << line << endl;
+        }
+
+        struct Total {
+            size_t count = 0;
+            double total = 0.0, longest = 0.0;
+        };
+        map<string, Total> totals;
+        for (const Event& event : m_Events)
+        {
+            if (event.depth < 0)
+                continue;
+            Total& total = totals[event.name];
+            total.count++;
+            total.total += event.duration;
+            total.longest = std::max(total.longest, event.duration);
+        }
+        cout << "PROFILE:: totals over all threads:" << endl;
+        cout << "   count   total ms     max ms  scope" << endl;
+        for (const auto& total : totals)
+        {
+            snprintf(line, sizeof(line), "%8zu %10.1f %10.1f  %s", total.second.count, total.second.total / 1000.0, total.second.longest / 1000.0, total.first.c_str());
+            cout << line << endl;
+        }
+    }
+
+    struct ThreadState {
+        int index;
+        int depth = 0;
+    };
+
+    // threads are numbered in the order they first record, the thread that touches the profiler first is 0
+    ThreadState& CurrentThread()
+    {
+        thread_local ThreadState state{ m_NextThread++ };
+        return state;
+    }
+
+private:
+    chrono::steady_clock::time_point m_Start = chrono::steady_clock::now();
+    atomic<bool> m_Recording{ true };
+    atomic<int> m_NextThread{ 0 };
+    double m_FirstFrame = -1.0;
+    mutex m_Mutex;
+    vector<Event> m_Events;
+    map<int, string> m_ThreadNames;
+
+    static string Escape(const string& text)
+    {
+        string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if (c >= 0 && c < 0x20)
+                continue;
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+// times its own lifetime, or up to End; scopes nest per thread
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name, const string& detail = string()) : m_Name(name)
+    {
+        Profiler& profiler = Profiler::Instance();
+        if (!profiler.IsRecording())
+            return;
+        m_Recording = true;
+        m_Detail = detail;
+        m_Depth = profiler.CurrentThread().depth++;
+        m_Start = profiler.Now();
+    }
+
+    ~ProfileScope()
+    {
+        End();
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    void End()
+    {
+        if (!m_Recording)
+            return;
+        m_Recording = false;
+        Profiler& profiler = Profiler::Instance();
+        Profiler::ThreadState& thread = profiler.CurrentThread();
+        thread.depth--;
+        profiler.Record(Profiler::Event{ m_Name, std::move(m_Detail), thread.index, m_Depth, m_Start, profiler.Now() - m_Start });
+    }
+
+private:
+    const char* m_Name;
+    string m_Detail;
+    int m_Depth = 0;
+    double m_Start = 0.0;
+    bool m_Recording = false;
+};
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef PROXY_CUBE_H
+#define PROXY_CUBE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "gl_state.h"
+#include "shader.h"
+
+#include <memory>
+using namespace std;
+
+// The unit cube, 0..1 on every axis, and the flat colour program that draws it stretched over a box. The lazy models
+// draw their placeholders with it and the occlusion culler its query boxes, so there is one program and one cube
+// mesh; both are made on first use, with the GL context current.
+class ProxyCube
+{
+public:
+    static ProxyCube& Instance()
+    {
+        static ProxyCube cube;
+        return cube;
+    }
+
+    // uses the program with viewProjection set and binds the cube, returns the program for the model and colour
+    Shader& Bind(const glm::mat4& viewProjection)
+    {
+        if (!m_Shader)
+            Create();
+        m_Shader->use();
+        m_Shader->setMat4("viewProjection", viewProjection);
+        GLState::Instance().BindVertexArray(m_VAO);
+        return *m_Shader;
+    }
+
+    // the model matrix stretching the cube over minimum..maximum in the space of model
+    static glm::mat4 BoxMatrix(const glm::mat4& model, const glm::vec3& minimum, const glm::vec3& maximum)
+    {
+        return glm::scale(glm::translate(model, minimum), maximum - minimum);
+    }
+
+    // the cube, after Bind
+    void Draw() const
+    {
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+    }
+
+private:
+    unique_ptr<Shader> m_Shader;
+    unsigned int m_VAO = 0, m_VBO = 0, m_EBO = 0;
+
+    ProxyCube() = default;
+    ProxyCube(const ProxyCube&) = delete;
+    ProxyCube& operator=(const ProxyCube&) = delete;
+
+    void Create()
+    {
+        m_Shader.reset(new Shader("vertexShaders/Proxy_vs.txt", "fragmentShaders/Proxy_fs.txt"));
+        static const float corners[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+        // two triangles per face, wound outwards
+        static const unsigned char indices[36] = { 0, 3, 2, 0, 2, 1, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4,
+            3, 7, 6, 3, 6, 2, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5 };
+        glGenVertexArrays(1, &m_VAO);
+        glGenBuffers(1, &m_VBO);
+        glGenBuffers(1, &m_EBO);
+        GLState::Instance().BindVertexArray(m_VAO);
+        GLState::Instance().BindBuffer(GL_ARRAY_BUFFER, m_VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        GLState::Instance().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    }
+};
+#endif
@@ -0,0 +1,260 @@
+#pragma once
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "material.h"
+#include "mesh.h"
+#include "model.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// passes run in this order; the background goes first without depth writes, transparent draws last back to front
+enum RenderPass { PASS_BACKGROUND = 0, PASS_OPAQUE, PASS_TRANSPARENT };
+
+// what the last Execute did
+struct RenderQueueStats {
+    size_t items = 0;
+    size_t draws = 0;
+    size_t programBinds = 0;
+    size_t vertexArrayBinds = 0;
+    size_t textureBinds = 0;
+    size_t modelUploads = 0;
+};
+
+// Collects the draws of a frame and issues them sorted, so draws sharing a program, material and vertex array follow
+// each other and GLState can skip the binds between them. Every item gets a 64 bit key, from the top:
+//   4 bits pass | 12 bits program | 16 bits material | 16 bits vertex array | 16 bits depth
+// Opaque items are drawn front to back within the same state; transparent items are sorted by depth, back to front,
+// right below the pass. The keys are radix sorted, 8 bits per pass, skipping the bytes all keys share.
+// Draws other than meshes, like the sky or the sea, are submitted as callbacks; they bind through GLState like the rest
+// but may set any uniform, so the queue forgets the model matrices it uploaded after each of them. Uniforms the items
+// of a program share, like the lights and the camera, are set by the caller before Execute. Items submitted while a
+// condition is set are drawn under conditional render on that query.
+class RenderQueue
+{
+public:
+    // view distance mapped onto the 16 bits of depth, farther items share the last value
+    float depthRange = 1000.0f;
+
+    // the occlusion query the items submitted from now on are drawn under, without waiting for it; 0 for none
+    void SetCondition(GLuint query)
+    {
+        m_Condition = query;
+    }
+
+    // the meshes of model, each at the LOD and with the clusters view calls for; setup, when given, runs before every
+    // one of them is drawn and sets what else the program needs
+    void Submit(Model& model, Shader& shader, const glm::mat4& transform, const DrawView& view, RenderPass pass = PASS_OPAQUE,
+        function<void(Shader&)> setup = nullptr)
+    {
+        for (Mesh& mesh : model.meshes)
+        {
+            mesh.RequestTextures(mesh.ProjectedSize(transform, view));
+            size_t first = m_RangeCounts.size();
+            size_t count = mesh.SelectRanges(transform, view, m_RangeCounts, m_RangeOffsets);
+            if (count == 0)
+                continue;
+            Item item;
+            item.shader = &shader;
+            item.mesh = &mesh;
+            item.model = transform;
+            item.hasModel = true;
+            item.firstRange = first;
+            item.rangeCount = count;
+            item.setup = setup;
+            item.condition = m_Condition;
+            float depth = glm::length(glm::vec3(transform * glm::vec4(mesh.boundsCenter, 1.0f)) - view.viewPos);
+            Push(item, MakeKey(pass, shader.ID, mesh.material.SortId(), mesh.VAO, depth));
+        }
+    }
+
+    // every instance of the buffer with each mesh of model, see Mesh::DrawInstances; depth is where the crowd is
+    void SubmitInstanced(Model& model, Shader& shader, const InstanceBuffer& instances, float depth, RenderPass pass = PASS_OPAQUE,
+        function<void(Shader&)> setup = nullptr)
+    {
+        if (instances.Count() == 0)
+            return;
+        for (Mesh& mesh : model.meshes)
+        {
+            mesh.RequestTextures(FLT_MAX);
+            Item item;
+            item.shader = &shader;
+            item.mesh = &mesh;
+            item.instances = &instances;
+            item.setup = setup;
+            item.condition = m_Condition;
+            Push(item, MakeKey(pass, shader.ID, mesh.material.SortId(), mesh.VAO, depth));
+        }
+    }
+
+    // draw is called with the GL state left by the previous item and may change all of it
+    void SubmitCallback(RenderPass pass, float depth, function<void()> draw)
+    {
+        Item item;
+        item.callback = std::move(draw);
+        item.condition = m_Condition;
+        // sorted among the items without a program
+        Push(item, MakeKey(pass, 0, 0, 0, depth));
+    }
+
+    // sorts and draws the submitted items and empties the queue
+    void Execute()
+    {
+        m_Stats = RenderQueueStats();
+        m_Stats.items = m_Items.size();
+        size_t textureBindsBefore = Material::TextureBindCount();
+        RadixSort(m_Keys, m_Scratch);
+
+        GLState& state = GLState::Instance();
+        ForgetModels();
+        for (const SortEntry& entry : m_Keys)
+        {
+            const Item& item = m_Items[entry.item];
+            if (item.condition)
+                glBeginConditionalRender(item.condition, GL_QUERY_NO_WAIT);
+            if (item.callback)
+            {
+                item.callback();
+                m_Stats.draws++;
+                ForgetModels();
+                if (item.condition)
+                    glEndConditionalRender();
+                continue;
+            }
+
+            Shader& shader = *item.shader;
+            if (state.UseProgram(shader.ID))
+                m_Stats.programBinds++;
+            if (item.setup)
+                item.setup(shader);
+            if (item.hasModel)
+                UploadModel(shader, item.model);
+            item.mesh->material.Bind(shader);
+            if (state.BindVertexArray(item.mesh->VAO))
+                m_Stats.vertexArrayBinds++;
+            if (item.instances)
+                item.mesh->DrawInstances(*item.instances);
+            else
+                item.mesh->DrawRanges(&m_RangeCounts[item.firstRange], &m_RangeOffsets[item.firstRange], static_cast<GLsizei>(item.rangeCount));
+            if (item.condition)
+                glEndConditionalRender();
+            m_Stats.draws++;
+        }
+        m_Stats.textureBinds = Material::TextureBindCount() - textureBindsBefore;
+
+        m_Items.clear();
+        m_Keys.clear();
+        m_Condition = 0;
+        m_RangeCounts.clear();
+        m_RangeOffsets.clear();
+    }
+
+    const RenderQueueStats& Stats() const { return m_Stats; }
+
+private:
+    struct Item {
+        Shader* shader = nullptr;
+        Mesh* mesh = nullptr;
+        const InstanceBuffer* instances = nullptr;
+        glm::mat4 model;
+        bool hasModel = false;
+        // the ranges of the mesh in m_RangeCounts and m_RangeOffsets
+        size_t firstRange = 0, rangeCount = 0;
+        function<void(Shader&)> setup;
+        function<void()> callback;
+        // conditional render query, 0 for none
+        GLuint condition = 0;
+    };
+
+    struct SortEntry {
+        uint64_t key;
+        uint32_t item;
+    };
+
+    // the model matrix the queue last gave a program, only trusted while no one else draws
+    struct ProgramModel {
+        GLint location;
+        glm::mat4 model;
+        bool set;
+    };
+
+    vector<Item> m_Items;
+    vector<SortEntry> m_Keys, m_Scratch;
+    vector<GLsizei> m_RangeCounts;
+    vector<const void*> m_RangeOffsets;
+    unordered_map<unsigned int, ProgramModel> m_Programs;
+    RenderQueueStats m_Stats;
+    GLuint m_Condition = 0;
+
+    void Push(Item& item, uint64_t key)
+    {
+        m_Keys.push_back(SortEntry{ key, static_cast<uint32_t>(m_Items.size()) });
+        m_Items.push_back(std::move(item));
+    }
+
+    uint64_t MakeKey(RenderPass pass, unsigned int program, unsigned int material, unsigned int vertexArray, float depth) const
+    {
+        uint64_t quantized = uint64_t(glm::clamp(depth / depthRange, 0.0f, 1.0f) * 65535.0f);
+        uint64_t key = uint64_t(pass & 0xF) << 60;
+        if (pass == PASS_TRANSPARENT)
+            return key | ((0xFFFF - quantized) << 44) | (uint64_t(program & 0xFFF) << 32) | (uint64_t(material & 0xFFFF) << 16) | (vertexArray & 0xFFFF);
+        return key | (uint64_t(program & 0xFFF) << 48) | (uint64_t(material & 0xFFFF) << 32) | (uint64_t(vertexArray & 0xFFFF) << 16) | quantized;
+    }
+
+    void ForgetModels()
+    {
+        for (auto& program : m_Programs)
+            program.second.set = false;
+    }
+
+    void UploadModel(Shader& shader, const glm::mat4& model)
+    {
+        auto found = m_Programs.find(shader.ID);
+        if (found == m_Programs.end())
+            found = m_Programs.emplace(shader.ID, ProgramModel{ glGetUniformLocation(shader.ID, "model"), glm::mat4(1.0f), false }).first;
+        ProgramModel& program = found->second;
+        if (program.set && memcmp(&program.model, &model, sizeof(glm::mat4)) == 0)
+            return;
+        glUniformMatrix4fv(program.location, 1, GL_FALSE, &model[0][0]);
+        program.model = model;
+        program.set = true;
+        m_Stats.modelUploads++;
+    }
+
+    // least significant byte first, stable, so equal keys keep the order they were submitted in
+    static void RadixSort(vector<SortEntry>& entries, vector<SortEntry>& scratch)
+    {
+        scratch.resize(entries.size());
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t counts[256] = {};
+            for (const SortEntry& entry : entries)
+                counts[(entry.key >> shift) & 0xFF]++;
+            // every key has the same byte here
+            if (counts[(entries.empty() ? 0 : entries[0].key >> shift) & 0xFF] == entries.size())
+                continue;
+            size_t offset = 0;
+            for (size_t& count : counts)
+            {
+                size_t next = offset + count;
+                count = offset;
+                offset = next;
+            }
+            for (const SortEntry& entry : entries)
+                scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+            entries.swap(scratch);
+        }
+    }
+};
+#endif
@@ -0,0 +1,109 @@
+#pragma once
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "animation.h"
+#include "animator.h"
+#include "baked_animation.h"
+#include "lazy_model.h"
+#include "model.h"
+#include "profiler.h"
+#include "scene_file.h"
+#include "scene_graph.h"
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// A SceneFile brought to life: its models loaded, lazy ones registered with the AssetStreamer, an Animator or a
+// BakedAnimation for each of its animations, and its nodes in the scene graph. The rest of the program finds them by
+// the names the file gives them; a name the file doesn't have is a mistake in the file, reported and thrown.
+class Scene
+{
+public:
+    SceneFile file;
+    SceneGraph graph;
+
+    Scene() = default;
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+
+    // on the GL thread, the models upload their meshes as they load
+    bool Load(const string& path)
+    {
+        ProfileScope profile("Scene", path);
+        if (!file.Load(path))
+            return false;
+        for (const SceneModel& info : file.models)
+        {
+            ModelImportOptions options;
+            options.occluderTriangles = info.occluderTriangles;
+            if (info.lazy)
+                m_LazyModels.emplace_back(info.name, unique_ptr<LazyModel>(new LazyModel(info.path, info.loadDistance, options)));
+            else
+                m_Models.emplace_back(info.name, unique_ptr<Model>(new Model(info.path, false, options)));
+        }
+        for (const SceneAnimation& info : file.animations)
+        {
+            m_Animations.emplace_back(new Animation(info.path, &GetModel(info.model)));
+            if (info.baked)
+                m_BakedAnimations.emplace_back(info.name, unique_ptr<BakedAnimation>(new BakedAnimation(*m_Animations.back())));
+            else
+                m_Animators.emplace_back(info.name, unique_ptr<Animator>(new Animator(m_Animations.back().get())));
+        }
+        graph.Append(file.locals.data(), file.parents.data(), file.locals.size());
+        return true;
+    }
+
+    Model& GetModel(const string& name) { return Get(m_Models, name, "model"); }
+    LazyModel& GetLazyModel(const string& name) { return Get(m_LazyModels, name, "lazy model"); }
+    Animator& GetAnimator(const string& name) { return Get(m_Animators, name, "animator"); }
+    BakedAnimation& GetBakedAnimation(const string& name) { return Get(m_BakedAnimations, name, "baked animation"); }
+
+    SceneGraph::Node GetNode(const string& name) const
+    {
+        SceneGraph::Node node = file.FindNode(name);
+        if (node == SceneGraph::kNoParent)
+            Missing("node", name);
+        return node;
+    }
+
+    const SceneCrowd& GetCrowd(const string& name) const
+    {
+        for (const SceneCrowd& crowd : file.crowds)
+            if (crowd.name == name)
+                return crowd;
+        Missing("crowd", name);
+    }
+
+private:
+    template <typename T>
+    using Named = vector<pair<string, unique_ptr<T>>>;
+
+    Named<Model> m_Models;
+    Named<LazyModel> m_LazyModels;
+    Named<Animator> m_Animators;
+    Named<BakedAnimation> m_BakedAnimations;
+    // what the animators and baked animations were made from
+    vector<unique_ptr<Animation>> m_Animations;
+
+    template <typename T>
+    static T& Get(Named<T>& items, const string& name, const char* kind)
+    {
+        for (pair<string, unique_ptr<T>>& item : items)
+            if (item.first == name)
+                return *item.second;
+        Missing(kind, name);
+    }
+
+    [[noreturn]] static void Missing(const char* kind, const string& name)
+    {
+        std::cout << "SCENE:: no " << kind << " called " << name << std::endl;
+        throw runtime_error(string("scene has no ") + kind + " called " + name);
+    }
+};
+#endif
@@ -0,0 +1,473 @@
+#pragma once
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "frame_data.h"
+#include "json.h"
+#include "mapped_file.h"
+#include "scene_graph.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+// a model the scene loads; a lazy one streams in once the camera comes within loadDistance
+struct SceneModel {
+    string name;
+    string path;
+    bool lazy = false;
+    float loadDistance = 50.0f;
+    uint32_t occluderTriangles = 0;
+};
+
+// an animation of one of the scene's models, played by an Animator or baked into a texture for a crowd
+struct SceneAnimation {
+    string name;
+    string model;
+    string path;
+    bool baked = false;
+};
+
+// the members of a crowd are the nodes firstNode to firstNode + count - 1
+struct SceneCrowd {
+    string name;
+    // how much further into its animation every member is than the one before
+    float timeStep = 0.0f;
+    uint32_t firstNode = 0;
+    uint32_t count = 0;
+};
+
+// The placement of everything in the scene: the models and animations to load, the lights, and the nodes of the
+// scene graph with the crowds among them. It is written by hand as JSON, see scenes/howth_bay.json, where nodes nest
+// their children and a crowd is laid out as rows, each member a step on from the one before, or listed member by
+// member. --compile-scene turns it into the binary form, which holds the same arrays as they are in memory: loading
+// it maps the file once and copies every array out with one memcpy, so a scene of 100k instances takes milliseconds.
+// Load tells the two apart by the first bytes. The binary form is for the machine it was compiled on, it is read
+// back as written.
+class SceneFile
+{
+public:
+    vector<SceneModel> models;
+    vector<SceneAnimation> animations;
+    FrameDirLight directionalLight = FrameDirLight();
+    FramePointLight pointLight = FramePointLight();
+    FrameSpotLight spotLight = FrameSpotLight();
+    // the nodes, parents before their children: a parent is an index into locals, or SceneGraph::kNoParent
+    vector<Transform> locals;
+    vector<SceneGraph::Node> parents;
+    // the nodes with a name, crowd members have none
+    vector<pair<string, SceneGraph::Node>> nodeNames;
+    vector<SceneCrowd> crowds;
+
+    bool Load(const string& path)
+    {
+        MappedFile file(path.c_str());
+        if (!file.IsOpen())
+        {
+            std::cout << "SCENE:: can't open " << path << std::endl;
+            return false;
+        }
+        *this = SceneFile();
+        string error;
+        bool binary = file.Size() >= 4 && memcmp(file.Data(), kMagic, 4) == 0;
+        bool ok = binary ? ReadBinary(file.Data(), file.Size(), error) : ReadJson(reinterpret_cast<const char*>(file.Data()), file.Size(), error);
+        if (!ok)
+        {
+            std::cout << "SCENE:: " << path << ": " << error << std::endl;
+            *this = SceneFile();
+        }
+        return ok;
+    }
+
+    // the binary form, written under a temporary name first so a crash never leaves half a scene behind
+    bool WriteBinary(const string& path) const
+    {
+        vector<char> strings;
+        auto store = [&strings](const string& text) {
+            uint32_t offset = uint32_t(strings.size());
+            strings.insert(strings.end(), text.begin(), text.end());
+            strings.push_back('\0');
+            return offset;
+        };
+        vector<ModelRecord> modelRecords;
+        for (const SceneModel& model : models)
+            modelRecords.push_back(ModelRecord{ store(model.name), store(model.path), model.lazy ? 1u : 0u, model.loadDistance, model.occluderTriangles });
+        vector<AnimationRecord> animationRecords;
+        for (const SceneAnimation& animation : animations)
+            animationRecords.push_back(AnimationRecord{ store(animation.name), store(animation.model), store(animation.path), animation.baked ? 1u : 0u });
+        vector<NameRecord> nameRecords;
+        for (const pair<string, SceneGraph::Node>& name : nodeNames)
+            nameRecords.push_back(NameRecord{ store(name.first), name.second });
+        vector<CrowdRecord> crowdRecords;
+        for (const SceneCrowd& crowd : crowds)
+            crowdRecords.push_back(CrowdRecord{ store(crowd.name), crowd.timeStep, crowd.firstNode, crowd.count });
+
+        Header header;
+        memcpy(header.magic, kMagic, sizeof(header.magic));
+        header.version = kVersion;
+        header.modelCount = uint32_t(modelRecords.size());
+        header.animationCount = uint32_t(animationRecords.size());
+        header.nameCount = uint32_t(nameRecords.size());
+        header.crowdCount = uint32_t(crowdRecords.size());
+        header.nodeCount = uint32_t(locals.size());
+        // the records that follow stay four byte aligned in the mapping
+        strings.resize((strings.size() + 3) & ~size_t(3), '\0');
+        header.stringBytes = uint32_t(strings.size());
+
+        string temporary = path + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(&directionalLight, sizeof(directionalLight), 1, file) == 1;
+        ok = ok && fwrite(&pointLight, sizeof(pointLight), 1, file) == 1;
+        ok = ok && fwrite(&spotLight, sizeof(spotLight), 1, file) == 1;
+        ok = ok && WriteArray(file, modelRecords) && WriteArray(file, animationRecords) && WriteArray(file, nameRecords)
+            && WriteArray(file, crowdRecords) && WriteArray(file, locals) && WriteArray(file, parents) && WriteArray(file, strings);
+        ok = fclose(file) == 0 && ok;
+        remove(path.c_str());
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // the node called name, kNoParent if there is none
+    SceneGraph::Node FindNode(const string& name) const
+    {
+        for (const pair<string, SceneGraph::Node>& node : nodeNames)
+            if (node.first == name)
+                return node.second;
+        return SceneGraph::kNoParent;
+    }
+
+    const SceneModel* FindModel(const string& name) const
+    {
+        for (const SceneModel& model : models)
+            if (model.name == name)
+                return &model;
+        return nullptr;
+    }
+
+private:
+    static constexpr const char* kMagic = "SCN1";
+    static const uint32_t kVersion = 1;
+
+    // every name and path in the records is a byte offset into the string table at the end of the file
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t modelCount, animationCount, nameCount, crowdCount, nodeCount;
+        uint32_t stringBytes;
+    };
+    struct ModelRecord { uint32_t name, path, lazy; float loadDistance; uint32_t occluderTriangles; };
+    struct AnimationRecord { uint32_t name, model, path, baked; };
+    struct NameRecord { uint32_t name; int32_t node; };
+    struct CrowdRecord { uint32_t name; float timeStep; uint32_t firstNode, count; };
+
+    static_assert(sizeof(Transform) == 40 && sizeof(SceneGraph::Node) == 4, "scene nodes are written as they are in memory");
+
+    template <typename T>
+    static bool WriteArray(FILE* file, const vector<T>& items)
+    {
+        return items.empty() || fwrite(items.data(), sizeof(T), items.size(), file) == items.size();
+    }
+
+    // a cursor over the mapping, every read checks what is left
+    struct Reader {
+        const unsigned char* data;
+        size_t size;
+        size_t position = 0;
+
+        bool Read(void* out, size_t bytes)
+        {
+            if (size - position < bytes)
+                return false;
+            memcpy(out, data + position, bytes);
+            position += bytes;
+            return true;
+        }
+
+        // the count is checked against what is left before anything is allocated for it
+        template <typename T>
+        bool ReadArray(vector<T>& out, size_t count)
+        {
+            if (count > (size - position) / sizeof(T))
+                return false;
+            out.resize(count);
+            return count == 0 || Read(out.data(), count * sizeof(T));
+        }
+    };
+
+    bool ReadBinary(const unsigned char* data, size_t size, string& error)
+    {
+        Reader reader{ data, size };
+        Header header;
+        if (!reader.Read(&header, sizeof(header)) || header.version != kVersion)
+        {
+            error = "not a version " + to_string(kVersion) + " binary scene";
+            return false;
+        }
+        vector<ModelRecord> modelRecords;
+        vector<AnimationRecord> animationRecords;
+        vector<NameRecord> nameRecords;
+        vector<CrowdRecord> crowdRecords;
+        vector<char> strings;
+        bool ok = reader.Read(&directionalLight, sizeof(directionalLight)) && reader.Read(&pointLight, sizeof(pointLight))
+            && reader.Read(&spotLight, sizeof(spotLight)) && reader.ReadArray(modelRecords, header.modelCount)
+            && reader.ReadArray(animationRecords, header.animationCount) && reader.ReadArray(nameRecords, header.nameCount)
+            && reader.ReadArray(crowdRecords, header.crowdCount) && reader.ReadArray(locals, header.nodeCount)
+            && reader.ReadArray(parents, header.nodeCount) && reader.ReadArray(strings, header.stringBytes);
+        if (!ok || strings.empty() || strings.back() != '\0')
+        {
+            error = "truncated";
+            return false;
+        }
+        for (uint32_t i = 0; i < header.nodeCount; i++)
+            if (parents[i] >= SceneGraph::Node(i) || parents[i] < SceneGraph::kNoParent)
+            {
+                error = "node " + to_string(i) + " comes before its parent";
+                return false;
+            }
+
+        bool stringsValid = true;
+        auto text = [&](uint32_t offset) {
+            stringsValid = stringsValid && offset < strings.size();
+            return stringsValid ? string(&strings[offset]) : string();
+        };
+        for (const ModelRecord& record : modelRecords)
+            models.push_back(SceneModel{ text(record.name), text(record.path), record.lazy != 0, record.loadDistance, record.occluderTriangles });
+        for (const AnimationRecord& record : animationRecords)
+            animations.push_back(SceneAnimation{ text(record.name), text(record.model), text(record.path), record.baked != 0 });
+        for (const NameRecord& record : nameRecords)
+            nodeNames.emplace_back(text(record.name), record.node);
+        for (const CrowdRecord& record : crowdRecords)
+            crowds.push_back(SceneCrowd{ text(record.name), record.timeStep, record.firstNode, record.count });
+        if (!stringsValid)
+        {
+            error = "a name points past the string table";
+            return false;
+        }
+        return Validate(error);
+    }
+
+    bool ReadJson(const char* text, size_t size, string& error)
+    {
+        JsonValue root;
+        if (!JsonValue::Parse(text, size, root, error))
+            return false;
+        if (!root.IsObject())
+        {
+            error = "the scene is not an object";
+            return false;
+        }
+
+        if (const JsonValue* list = root.Find("models"))
+            for (const JsonValue& item : list->items)
+            {
+                SceneModel model;
+                model.name = item.String("name");
+                model.path = item.String("path");
+                model.lazy = item.Boolean("lazy", false);
+                model.loadDistance = float(item.Number("loadDistance", 50.0));
+                model.occluderTriangles = uint32_t(item.Number("occluderTriangles", 0.0));
+                models.push_back(model);
+            }
+        if (const JsonValue* list = root.Find("animations"))
+            for (const JsonValue& item : list->items)
+            {
+                SceneAnimation animation;
+                animation.name = item.String("name");
+                animation.model = item.String("model");
+                // most animations come in the file of the model they move
+                const SceneModel* model = FindModel(animation.model);
+                animation.path = item.String("path", model ? model->path : string());
+                animation.baked = item.Boolean("baked", false);
+                animations.push_back(animation);
+            }
+
+        if (const JsonValue* lights = root.Find("lights"))
+        {
+            if (const JsonValue* light = lights->Find("directional"))
+            {
+                directionalLight.direction = ReadVec3(light->Find("direction"), glm::vec3(0.0f, -1.0f, 0.0f));
+                directionalLight.color = ReadVec3(light->Find("color"), glm::vec3(1.0f));
+                directionalLight.ambient = ReadVec3(light->Find("ambient"), glm::vec3(0.0f));
+                directionalLight.diffuse = ReadVec3(light->Find("diffuse"), glm::vec3(0.0f));
+                directionalLight.specular = ReadVec3(light->Find("specular"), glm::vec3(0.0f));
+            }
+            if (const JsonValue* light = lights->Find("point"))
+            {
+                pointLight.position = ReadVec3(light->Find("position"), glm::vec3(0.0f));
+                pointLight.color = ReadVec3(light->Find("color"), glm::vec3(1.0f));
+                pointLight.linear = float(light->Number("linear", 0.0));
+                pointLight.quadratic = float(light->Number("quadratic", 0.0));
+                pointLight.ambient = ReadVec3(light->Find("ambient"), glm::vec3(0.0f));
+                pointLight.diffuse = ReadVec3(light->Find("diffuse"), glm::vec3(0.0f));
+                pointLight.specular = ReadVec3(light->Find("specular"), glm::vec3(0.0f));
+            }
+            if (const JsonValue* light = lights->Find("spot"))
+            {
+                spotLight.position = ReadVec3(light->Find("position"), glm::vec3(0.0f));
+                spotLight.color = ReadVec3(light->Find("color"), glm::vec3(1.0f));
+                spotLight.direction = ReadVec3(light->Find("direction"), glm::vec3(0.0f, -1.0f, 0.0f));
+                // the cone in degrees, the shaders want the cosines
+                spotLight.cutOff = glm::cos(glm::radians(float(light->Number("cutOff", 12.5))));
+                spotLight.outerCutOff = glm::cos(glm::radians(float(light->Number("outerCutOff", 15.0))));
+                spotLight.linear = float(light->Number("linear", 0.0));
+                spotLight.quadratic = float(light->Number("quadratic", 0.0));
+                spotLight.ambient = ReadVec3(light->Find("ambient"), glm::vec3(0.0f));
+                spotLight.diffuse = ReadVec3(light->Find("diffuse"), glm::vec3(0.0f));
+                spotLight.specular = ReadVec3(light->Find("specular"), glm::vec3(0.0f));
+            }
+        }
+
+        if (const JsonValue* list = root.Find("nodes"))
+            if (!ReadNodes(*list, SceneGraph::kNoParent, error))
+                return false;
+        if (const JsonValue* list = root.Find("crowds"))
+            for (const JsonValue& item : list->items)
+                if (!ReadCrowd(item, error))
+                    return false;
+        return Validate(error);
+    }
+
+    SceneGraph::Node AddNode(const Transform& local, SceneGraph::Node parent)
+    {
+        locals.push_back(local);
+        parents.push_back(parent);
+        return SceneGraph::Node(locals.size() - 1);
+    }
+
+    bool ReadNodes(const JsonValue& list, SceneGraph::Node parent, string& error)
+    {
+        for (const JsonValue& item : list.items)
+        {
+            SceneGraph::Node node = AddNode(ReadTransform(item), parent);
+            string name = item.String("name");
+            if (!name.empty())
+            {
+                if (FindNode(name) != SceneGraph::kNoParent)
+                {
+                    error = "two nodes are called " + name;
+                    return false;
+                }
+                nodeNames.emplace_back(name, node);
+            }
+            if (const JsonValue* children = item.Find("children"))
+                if (!ReadNodes(*children, node, error))
+                    return false;
+        }
+        return true;
+    }
+
+    // rows chain their members, each one placed by step in the one before it, the first by first in the crowd's
+    // parent; jitter moves every member by up to that much along each axis, the same way for the same seed
+    bool ReadCrowd(const JsonValue& item, string& error)
+    {
+        SceneCrowd crowd;
+        crowd.name = item.String("name");
+        crowd.timeStep = float(item.Number("timeStep", 0.0));
+        crowd.firstNode = uint32_t(locals.size());
+        SceneGraph::Node parent = SceneGraph::kNoParent;
+        string parentName = item.String("parent");
+        if (!parentName.empty() && (parent = FindNode(parentName)) == SceneGraph::kNoParent)
+        {
+            error = "crowd " + crowd.name + " hangs off " + parentName + ", which isn't a node";
+            return false;
+        }
+        mt19937 random(uint32_t(item.Number("seed", 0.0)));
+        uniform_real_distribution<float> spread(-1.0f, 1.0f);
+        if (const JsonValue* rows = item.Find("rows"))
+            for (const JsonValue& row : rows->items)
+            {
+                const JsonValue* first = row.Find("first");
+                const JsonValue* step = row.Find("step");
+                Transform firstLocal = first ? ReadTransform(*first) : Transform();
+                Transform stepLocal = step ? ReadTransform(*step) : Transform();
+                int count = int(row.Number("count", 1.0));
+                float jitter = float(row.Number("jitter", 0.0));
+                SceneGraph::Node previous = parent;
+                for (int i = 0; i < count; i++)
+                {
+                    Transform local = i == 0 ? firstLocal : stepLocal;
+                    if (jitter > 0.0f)
+                    {
+                        float x = spread(random), y = spread(random), z = spread(random);
+                        local.position = local.position + jitter * glm::vec3(x, y, z);
+                    }
+                    previous = AddNode(local, previous);
+                }
+            }
+        if (const JsonValue* members = item.Find("members"))
+            for (const JsonValue& member : members->items)
+                AddNode(ReadTransform(member), parent);
+        crowd.count = uint32_t(locals.size()) - crowd.firstNode;
+        crowds.push_back(crowd);
+        return true;
+    }
+
+    // the references between the parts of the scene, for either form
+    bool Validate(string& error) const
+    {
+        for (const SceneAnimation& animation : animations)
+        {
+            const SceneModel* model = FindModel(animation.model);
+            if (!model)
+            {
+                error = "animation " + animation.name + " is of " + animation.model + ", which isn't a model";
+                return false;
+            }
+            // the animation reads the model's bones when the scene loads, a lazy model has none until much later
+            if (model->lazy)
+            {
+                error = "animation " + animation.name + " is of " + animation.model + ", which is lazy";
+                return false;
+            }
+        }
+        for (const pair<string, SceneGraph::Node>& name : nodeNames)
+            if (name.second < 0 || size_t(name.second) >= locals.size())
+            {
+                error = "node " + name.first + " doesn't exist";
+                return false;
+            }
+        for (const SceneCrowd& crowd : crowds)
+            if (size_t(crowd.firstNode) + crowd.count > locals.size())
+            {
+                error = "crowd " + crowd.name + " reaches past the last node";
+                return false;
+            }
+        return true;
+    }
+
+    // a number for all three, or an array of three
+    static glm::vec3 ReadVec3(const JsonValue* value, const glm::vec3& fallback)
+    {
+        if (value && value->IsNumber())
+            return glm::vec3(float(value->number));
+        if (value && value->IsArray() && value->items.size() == 3)
+            return glm::vec3(float(value->items[0].number), float(value->items[1].number), float(value->items[2].number));
+        return fallback;
+    }
+
+    // position, rotation as angles in degrees about x, y and z, and scale
+    static Transform ReadTransform(const JsonValue& item)
+    {
+        Transform local;
+        local.position = ReadVec3(item.Find("position"), glm::vec3(0.0f));
+        local.rotation = glm::quat(glm::radians(ReadVec3(item.Find("rotation"), glm::vec3(0.0f))));
+        local.scale = ReadVec3(item.Find("scale"), glm::vec3(1.0f));
+        return local;
+    }
+};
+#endif
@@ -0,0 +1,158 @@
+#pragma once
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#ifndef GLM_ENABLE_EXPERIMENTAL
+#define GLM_ENABLE_EXPERIMENTAL
+#endif
+#include <glm/gtx/quaternion.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// where a node sits in its parent: scaled first, then rotated, then moved
+struct Transform {
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+
+    Transform() = default;
+    Transform(const glm::vec3& position, const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f))
+        : position(position), rotation(rotation), scale(scale) {}
+
+    // translate * rotate * scale, without multiplying the three out
+    glm::mat4 Matrix() const
+    {
+        glm::mat4 matrix = glm::toMat4(rotation);
+        matrix[0] *= scale.x;
+        matrix[1] *= scale.y;
+        matrix[2] *= scale.z;
+        matrix[3] = glm::vec4(position, 1.0f);
+        return matrix;
+    }
+};
+
+// what the last Update did
+struct SceneGraphStats {
+    size_t nodes = 0;
+    // local matrices rebuilt from their TRS
+    size_t localUpdates = 0;
+    // world matrices recomputed, the dirty nodes and everything below them
+    size_t worldUpdates = 0;
+};
+
+// The transforms of the scene as a hierarchy of nodes, each with a local transform in its parent and a cached world
+// matrix. The nodes live in parallel arrays in the order they were added, and since a parent has to exist before its
+// children, every parent comes before them: Update is one pass front to back, where a node is recomputed when its own
+// transform was set or its parent's world matrix changed in the same pass. Nodes nobody touches cost a flag test.
+class SceneGraph
+{
+public:
+    typedef int Node;
+    static const Node kNoParent = -1;
+
+    Node Add(const Transform& local, Node parent = kNoParent)
+    {
+        assert(parent < Node(m_Parents.size()));
+        m_Locals.push_back(local);
+        m_LocalMatrices.push_back(glm::mat4(1.0f));
+        m_WorldMatrices.push_back(glm::mat4(1.0f));
+        m_Parents.push_back(parent);
+        m_Dirty.push_back(1);
+        m_Changed.push_back(0);
+        return Node(m_Parents.size() - 1);
+    }
+
+    // count nodes at once, their parents counted from the first of them, or kNoParent; returns the first
+    Node Append(const Transform* locals, const Node* parents, size_t count)
+    {
+        Node first = Node(m_Parents.size());
+        m_Locals.insert(m_Locals.end(), locals, locals + count);
+        m_LocalMatrices.resize(m_Locals.size(), glm::mat4(1.0f));
+        m_WorldMatrices.resize(m_Locals.size(), glm::mat4(1.0f));
+        m_Parents.reserve(m_Locals.size());
+        for (size_t i = 0; i < count; i++)
+        {
+            assert(parents[i] < Node(i));
+            m_Parents.push_back(parents[i] == kNoParent ? kNoParent : first + parents[i]);
+        }
+        m_Dirty.resize(m_Locals.size(), 1);
+        m_Changed.resize(m_Locals.size(), 0);
+        return first;
+    }
+
+    size_t Size() const { return m_Parents.size(); }
+    Node Parent(Node node) const { return m_Parents[node]; }
+    const Transform& Local(Node node) const { return m_Locals[node]; }
+
+    void SetLocal(Node node, const Transform& local)
+    {
+        m_Locals[node] = local;
+        m_Dirty[node] = 1;
+    }
+
+    void SetPosition(Node node, const glm::vec3& position)
+    {
+        m_Locals[node].position = position;
+        m_Dirty[node] = 1;
+    }
+
+    void SetRotation(Node node, const glm::quat& rotation)
+    {
+        m_Locals[node].rotation = rotation;
+        m_Dirty[node] = 1;
+    }
+
+    void SetScale(Node node, const glm::vec3& scale)
+    {
+        m_Locals[node].scale = scale;
+        m_Dirty[node] = 1;
+    }
+
+    // brings the world matrices up to date with the transforms set since the last Update
+    void Update()
+    {
+        m_Stats = SceneGraphStats();
+        m_Stats.nodes = m_Parents.size();
+        for (size_t node = 0; node < m_Parents.size(); node++)
+        {
+            Node parent = m_Parents[node];
+            bool parentChanged = parent != kNoParent && m_Changed[parent];
+            m_Changed[node] = m_Dirty[node] | uint8_t(parentChanged);
+            if (!m_Changed[node])
+                continue;
+            if (m_Dirty[node])
+            {
+                m_LocalMatrices[node] = m_Locals[node].Matrix();
+                m_Dirty[node] = 0;
+                m_Stats.localUpdates++;
+            }
+            m_WorldMatrices[node] = parent == kNoParent ? m_LocalMatrices[node] : m_WorldMatrices[parent] * m_LocalMatrices[node];
+            m_Stats.worldUpdates++;
+        }
+    }
+
+    // as of the last Update
+    const glm::mat4& World(Node node) const { return m_WorldMatrices[node]; }
+    // whether the last Update moved the node
+    bool Changed(Node node) const { return m_Changed[node] != 0; }
+
+    const SceneGraphStats& Stats() const { return m_Stats; }
+
+private:
+    vector<Transform> m_Locals;
+    vector<glm::mat4> m_LocalMatrices;
+    vector<glm::mat4> m_WorldMatrices;
+    vector<Node> m_Parents;
+    // the local transform was set since the last Update
+    vector<uint8_t> m_Dirty;
+    // the world matrix was recomputed in the last Update
+    vector<uint8_t> m_Changed;
+    SceneGraphStats m_Stats;
+};
+#endif
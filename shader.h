@@ -4,6 +4,10 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "frame_data.h"
+#include "gl_state.h"
+#include "profiler.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -17,6 +21,7 @@ public:
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
     {
+        ProfileScope profile("Shader", fragmentPath);
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -41,8 +46,8 @@ public:
             vShaderFile.close();
             fShaderFile.close();
             // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            vertexCode = resolveIncludes(vShaderStream.str());
+            fragmentCode = resolveIncludes(fShaderStream.str());
             // if geometry shader path is present, also load a geometry shader
             if (geometryPath != nullptr)
             {
@@ -50,7 +55,7 @@ public:
                 std::stringstream gShaderStream;
                 gShaderStream << gShaderFile.rdbuf();
                 gShaderFile.close();
-                geometryCode = gShaderStream.str();
+                geometryCode = resolveIncludes(gShaderStream.str());
             }
         }
         catch (std::ifstream::failure& e)
@@ -60,6 +65,7 @@ public:
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
+        ProfileScope compileProfile("Shader compile");
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -81,7 +87,9 @@ public:
             glCompileShader(geometry);
             checkCompileErrors(geometry, "GEOMETRY");
         }
+        compileProfile.End();
         // shader Program
+        ProfileScope linkProfile("Shader link");
         ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
@@ -89,6 +97,10 @@ public:
             glAttachShader(ID, geometry);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        // programs that declare the per frame uniform block read it from its binding point
+        GLuint frameBlock = glGetUniformBlockIndex(ID, "FrameData");
+        if (frameBlock != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, frameBlock, FrameUniforms::kBindingPoint);
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -100,7 +112,7 @@ public:
     // ------------------------------------------------------------------------
     void use()
     {
-        glUseProgram(ID);
+        GLState::Instance().UseProgram(ID);
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
@@ -162,6 +174,33 @@ public:
     }
 
 private:
+    // replaces every #include "path" line with the file at path, relative to the working directory like the shaders
+    // ------------------------------------------------------------------------
+    std::string resolveIncludes(const std::string& code)
+    {
+        std::stringstream source(code), resolved;
+        std::string line;
+        while (std::getline(source, line))
+        {
+            size_t quote = line.find('"');
+            if (line.compare(0, 8, "#include") != 0 || quote == std::string::npos)
+            {
+                resolved << line << '\n';
+                continue;
+            }
+            std::string path = line.substr(quote + 1, line.find('"', quote + 1) - quote - 1);
+            std::ifstream included(path);
+            if (!included)
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+                continue;
+            }
+            std::stringstream includedStream;
+            includedStream << included.rdbuf();
+            resolved << resolveIncludes(includedStream.str());
+        }
+        return resolved.str();
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,392 @@
+#pragma once
+#ifndef SOFTWARE_OCCLUSION_H
+#define SOFTWARE_OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "frustum_culler.h"
+#include "mesh.h"
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SOFTWARE_OCCLUSION_SSE 1
+#endif
+
+// the triangles of a few meshes simplified down to a few hundred each for the occlusion rasterizer, in object space;
+// a Model imported with occluderTriangles builds its own while its geometry is still in memory
+struct OccluderMesh {
+    vector<glm::vec3> positions;
+    vector<unsigned int> indices;
+
+    bool Empty() const { return indices.empty(); }
+
+    // the triangles of lod, simplified further down to maxTriangles
+    void Append(const vector<Vertex>& vertices, const vector<unsigned int>& meshIndices, const MeshLod& lod, size_t maxTriangles)
+    {
+        vector<unsigned int> triangles(meshIndices.begin() + lod.indexOffset, meshIndices.begin() + lod.indexOffset + lod.indexCount);
+        if (triangles.size() / 3 > maxTriangles)
+        {
+            float error = 0.0f;
+            vector<unsigned int> simplified = MeshSimplifier::Simplify(vertices, triangles, maxTriangles * 3, FLT_MAX, &error);
+            if (!simplified.empty())
+                triangles.swap(simplified);
+        }
+        // only the vertices the hull still uses
+        unordered_map<unsigned int, unsigned int> remap;
+        for (unsigned int index : triangles)
+        {
+            auto inserted = remap.emplace(index, unsigned(positions.size()));
+            if (inserted.second)
+                positions.push_back(vertices[index].Position);
+            indices.push_back(inserted.first->second);
+        }
+    }
+};
+
+// what the last frame of the occlusion buffer did
+struct SoftwareOcclusionStats {
+    size_t occluderTriangles = 0;
+    // after near plane clipping, the triangles binned to tiles
+    size_t rasterizedTriangles = 0;
+    size_t tested = 0;
+    size_t occluded = 0;
+    double rasterizeMilliseconds = 0.0;
+    // the calling thread and the workers offered a seat
+    int threads = 1;
+};
+
+// A small depth buffer drawn on the CPU from a few big occluders, to find what they hide before anything is submitted,
+// with no GPU round trip. Begin takes the frame's view projection, AddOccluder clips the occluder's triangles at the
+// near plane and bins them to the tiles they touch, and Rasterize fills the tiles, on workers that wait between frames
+// once there are enough triangles to be worth waking them, four pixels per SSE step, keeping the nearest depth. Each
+// tile then reduces its 8x8 blocks to their farthest depth, a one level hierarchical Z: a box is hidden when its
+// nearest corner is behind that farthest depth in every block its screen rectangle touches. Occluders are meant to lie
+// inside what they stand for; simplified hulls may poke out a little, which can hide an object a frame or two early at
+// their silhouettes.
+class SoftwareOcclusionBuffer
+{
+public:
+    static const int kWidth = 256, kHeight = 128;
+    static const int kTileWidth = 64, kTileHeight = 32;
+    static const int kTilesX = kWidth / kTileWidth, kTilesY = kHeight / kTileHeight;
+    static const int kBlockSize = 8;
+    static const int kBlocksX = kWidth / kBlockSize, kBlocksY = kHeight / kBlockSize;
+    static const int kMaxThreads = 8;
+    // fewer binned triangles than this are rasterized on the calling thread alone, waking the workers costs more
+    static const size_t kMinParallelTriangles = 512;
+
+    // 1 rasterizes on the calling thread
+    int threads = std::min(kMaxThreads, int(std::max(1u, thread::hardware_concurrency())));
+
+    SoftwareOcclusionBuffer() : m_Depth(size_t(kWidth) * kHeight), m_HiZ(size_t(kBlocksX) * kBlocksY), m_Bins(kTilesX * kTilesY) {}
+    SoftwareOcclusionBuffer(const SoftwareOcclusionBuffer&) = delete;
+    SoftwareOcclusionBuffer& operator=(const SoftwareOcclusionBuffer&) = delete;
+
+    ~SoftwareOcclusionBuffer()
+    {
+        {
+            lock_guard<mutex> lock(m_WorkMutex);
+            m_Stop = true;
+        }
+        m_WorkAvailable.notify_all();
+        for (thread& worker : m_Workers)
+            worker.join();
+    }
+
+    void Begin(const glm::mat4& viewProjection)
+    {
+        m_ViewProjection = viewProjection;
+        m_Triangles.clear();
+        for (vector<uint32_t>& bin : m_Bins)
+            bin.clear();
+        m_Stats = SoftwareOcclusionStats();
+    }
+
+    void AddOccluder(const OccluderMesh& occluder, const glm::mat4& model)
+    {
+        glm::mat4 transform = m_ViewProjection * model;
+        m_Clip.resize(occluder.positions.size());
+        for (size_t i = 0; i < occluder.positions.size(); i++)
+            m_Clip[i] = transform * glm::vec4(occluder.positions[i], 1.0f);
+        for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3)
+        {
+            m_Stats.occluderTriangles++;
+            glm::vec4 polygon[4];
+            int count = ClipNear(m_Clip[occluder.indices[i]], m_Clip[occluder.indices[i + 1]], m_Clip[occluder.indices[i + 2]], polygon);
+            for (int k = 1; k + 1 < count; k++)
+                AddTriangle(polygon[0], polygon[k], polygon[k + 1]);
+        }
+    }
+
+    // fills the depth buffer and its block maxima from the binned triangles
+    void Rasterize()
+    {
+        auto start = chrono::steady_clock::now();
+        std::fill(m_Depth.begin(), m_Depth.end(), 1.0f);
+        m_NextTile = 0;
+        int helpers = std::min(threads, kTilesX * kTilesY) - 1;
+        if (helpers <= 0 || m_Triangles.size() < kMinParallelTriangles)
+        {
+            m_Stats.threads = 1;
+            RasterizeTiles();
+        }
+        else
+        {
+            m_Stats.threads = helpers + 1;
+            while (int(m_Workers.size()) < helpers)
+                m_Workers.emplace_back(&SoftwareOcclusionBuffer::WorkerLoop, this);
+            {
+                lock_guard<mutex> lock(m_WorkMutex);
+                m_Generation++;
+                m_Seats = m_Busy = helpers;
+            }
+            m_WorkAvailable.notify_all();
+            RasterizeTiles();
+            // the tiles are all taken, workers that haven't woken up yet are no longer waited for
+            unique_lock<mutex> lock(m_WorkMutex);
+            m_Busy -= m_Seats;
+            m_Seats = 0;
+            m_WorkDone.wait(lock, [this] { return m_Busy == 0; });
+        }
+        m_Stats.rasterizeMilliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // false when the world space box is hidden behind the occluders in every block it covers
+    bool IsVisible(const BoundingBox& box)
+    {
+        m_Stats.tested++;
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 point(corner & 1 ? box.maximum.x : box.minimum.x, corner & 2 ? box.maximum.y : box.minimum.y, corner & 4 ? box.maximum.z : box.minimum.z);
+            glm::vec4 clip = m_ViewProjection * glm::vec4(point, 1.0f);
+            // reaching through the near plane, it may cover anything
+            if (clip.z < -clip.w || clip.w <= kMinW)
+                return true;
+            glm::vec3 screen = ToScreen(clip);
+            minX = std::min(minX, screen.x); maxX = std::max(maxX, screen.x);
+            minY = std::min(minY, screen.y); maxY = std::max(maxY, screen.y);
+            nearest = std::min(nearest, screen.z);
+        }
+        int blockX0 = std::max(0, int(floor(minX)) / kBlockSize), blockX1 = std::min(kBlocksX - 1, int(floor(maxX)) / kBlockSize);
+        int blockY0 = std::max(0, int(floor(minY)) / kBlockSize), blockY1 = std::min(kBlocksY - 1, int(floor(maxY)) / kBlockSize);
+        // off screen is the frustum culler's business
+        if (blockX0 > blockX1 || blockY0 > blockY1 || maxX < 0.0f || maxY < 0.0f)
+            return true;
+        for (int y = blockY0; y <= blockY1; y++)
+            for (int x = blockX0; x <= blockX1; x++)
+                if (nearest <= m_HiZ[size_t(y) * kBlocksX + x])
+                    return true;
+        m_Stats.occluded++;
+        return false;
+    }
+
+    const SoftwareOcclusionStats& Stats() const { return m_Stats; }
+
+private:
+    // clip space w below which a point counts as on the camera
+    static constexpr float kMinW = 1e-5f;
+
+    // in pixels, edge functions and the depth plane set up once per triangle
+    struct ScreenTriangle {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthA, depthB, depthC;
+        int minX, minY, maxX, maxY;
+    };
+
+    glm::mat4 m_ViewProjection = glm::mat4(1.0f);
+    vector<float> m_Depth;
+    vector<float> m_HiZ;
+    vector<glm::vec4> m_Clip;
+    vector<ScreenTriangle> m_Triangles;
+    // the triangles touching each tile
+    vector<vector<uint32_t>> m_Bins;
+    atomic<int> m_NextTile{ 0 };
+    SoftwareOcclusionStats m_Stats;
+
+    // the workers, started when first needed; a Rasterize offers seats to as many as threads asks for
+    vector<thread> m_Workers;
+    mutex m_WorkMutex;
+    condition_variable m_WorkAvailable, m_WorkDone;
+    unsigned int m_Generation = 0;
+    int m_Seats = 0, m_Busy = 0;
+    bool m_Stop = false;
+
+    static glm::vec3 ToScreen(const glm::vec4& clip)
+    {
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return glm::vec3((ndc.x * 0.5f + 0.5f) * kWidth, (ndc.y * 0.5f + 0.5f) * kHeight, ndc.z * 0.5f + 0.5f);
+    }
+
+    // the part of the triangle in front of the near plane, z >= -w, as a polygon of up to four corners
+    static int ClipNear(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c, glm::vec4* out)
+    {
+        const glm::vec4 corners[3] = { a, b, c };
+        int count = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4& from = corners[i];
+            const glm::vec4& to = corners[(i + 1) % 3];
+            float fromDistance = from.z + from.w, toDistance = to.z + to.w;
+            if (fromDistance >= 0.0f)
+                out[count++] = from;
+            if ((fromDistance >= 0.0f) != (toDistance >= 0.0f))
+                out[count++] = from + (to - from) * (fromDistance / (fromDistance - toDistance));
+        }
+        return count;
+    }
+
+    void AddTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+    {
+        if (a.w <= kMinW || b.w <= kMinW || c.w <= kMinW)
+            return;
+        glm::vec3 v[3] = { ToScreen(a), ToScreen(b), ToScreen(c) };
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+        // both faces are drawn, the hull's winding isn't trusted; turn clockwise ones around
+        if (area < 0.0f)
+        {
+            std::swap(v[1], v[2]);
+            area = -area;
+        }
+        if (area < 1e-6f)
+            return;
+
+        ScreenTriangle triangle;
+        triangle.minX = std::max(0, int(floor(std::min({ v[0].x, v[1].x, v[2].x }))));
+        triangle.minY = std::max(0, int(floor(std::min({ v[0].y, v[1].y, v[2].y }))));
+        triangle.maxX = std::min(kWidth - 1, int(ceil(std::max({ v[0].x, v[1].x, v[2].x }))));
+        triangle.maxY = std::min(kHeight - 1, int(ceil(std::max({ v[0].y, v[1].y, v[2].y }))));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            return;
+        // edge i is opposite corner i, positive inside; its value at a pixel over the area is the weight of corner i
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec3& from = v[(i + 1) % 3];
+            const glm::vec3& to = v[(i + 2) % 3];
+            triangle.edgeA[i] = from.y - to.y;
+            triangle.edgeB[i] = to.x - from.x;
+            triangle.edgeC[i] = from.x * to.y - from.y * to.x;
+        }
+        // depth is affine in screen space after the divide
+        float z1 = (v[1].z - v[0].z) / area, z2 = (v[2].z - v[0].z) / area;
+        triangle.depthA = triangle.edgeA[1] * z1 + triangle.edgeA[2] * z2;
+        triangle.depthB = triangle.edgeB[1] * z1 + triangle.edgeB[2] * z2;
+        triangle.depthC = v[0].z + triangle.edgeC[1] * z1 + triangle.edgeC[2] * z2;
+
+        uint32_t index = uint32_t(m_Triangles.size());
+        m_Triangles.push_back(triangle);
+        m_Stats.rasterizedTriangles++;
+        for (int tileY = triangle.minY / kTileHeight; tileY <= triangle.maxY / kTileHeight; tileY++)
+            for (int tileX = triangle.minX / kTileWidth; tileX <= triangle.maxX / kTileWidth; tileX++)
+                m_Bins[size_t(tileY) * kTilesX + tileX].push_back(index);
+    }
+
+    void WorkerLoop()
+    {
+        unsigned int seen = 0;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(m_WorkMutex);
+                m_WorkAvailable.wait(lock, [&] { return m_Stop || (m_Generation != seen && m_Seats > 0); });
+                if (m_Stop)
+                    return;
+                seen = m_Generation;
+                m_Seats--;
+            }
+            RasterizeTiles();
+            lock_guard<mutex> lock(m_WorkMutex);
+            if (--m_Busy == 0)
+                m_WorkDone.notify_one();
+        }
+    }
+
+    void RasterizeTiles()
+    {
+        for (int tile = m_NextTile++; tile < kTilesX * kTilesY; tile = m_NextTile++)
+        {
+            int tileX = (tile % kTilesX) * kTileWidth, tileY = (tile / kTilesX) * kTileHeight;
+            for (uint32_t index : m_Bins[tile])
+                RasterizeTriangle(m_Triangles[index], tileX, tileY);
+            ReduceTile(tileX, tileY);
+        }
+    }
+
+    void RasterizeTriangle(const ScreenTriangle& triangle, int tileX, int tileY)
+    {
+        // a pixel on an edge is inside, or the edges two triangles share would leave holes; the nearest depth doesn't
+        // mind a pixel drawn twice
+        // whole groups of four from a multiple of four, the tile width is one too
+        int x0 = std::max(triangle.minX, tileX) & ~3, x1 = std::min(triangle.maxX, tileX + kTileWidth - 1);
+        int y0 = std::max(triangle.minY, tileY), y1 = std::min(triangle.maxY, tileY + kTileHeight - 1);
+        for (int y = y0; y <= y1; y++)
+        {
+            float centerY = y + 0.5f;
+            float* row = &m_Depth[size_t(y) * kWidth];
+            int x = x0;
+#ifdef SOFTWARE_OCCLUSION_SSE
+            const __m128 steps = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            __m128 rowEdge[3], edgeA[3];
+            for (int i = 0; i < 3; i++)
+            {
+                rowEdge[i] = _mm_set1_ps(triangle.edgeB[i] * centerY + triangle.edgeC[i]);
+                edgeA[i] = _mm_set1_ps(triangle.edgeA[i]);
+            }
+            __m128 rowDepth = _mm_set1_ps(triangle.depthB * centerY + triangle.depthC);
+            __m128 depthA = _mm_set1_ps(triangle.depthA);
+            const __m128 zero = _mm_setzero_ps();
+            for (; x <= x1; x += 4)
+            {
+                __m128 centerX = _mm_add_ps(_mm_set1_ps(float(x)), steps);
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[0], centerX), rowEdge[0]), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[1], centerX), rowEdge[1]), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[2], centerX), rowEdge[2]), zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+                __m128 depth = _mm_add_ps(_mm_mul_ps(depthA, centerX), rowDepth);
+                __m128 current = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(current, depth);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+            }
+#endif
+            for (; x <= x1; x++)
+            {
+                float centerX = x + 0.5f;
+                bool inside = true;
+                for (int i = 0; i < 3; i++)
+                    inside = inside && triangle.edgeA[i] * centerX + triangle.edgeB[i] * centerY + triangle.edgeC[i] >= 0.0f;
+                if (inside)
+                    row[x] = std::min(row[x], triangle.depthA * centerX + triangle.depthB * centerY + triangle.depthC);
+            }
+        }
+    }
+
+    // the farthest depth of every block of the tile
+    void ReduceTile(int tileX, int tileY)
+    {
+        for (int blockY = tileY / kBlockSize; blockY < (tileY + kTileHeight) / kBlockSize; blockY++)
+            for (int blockX = tileX / kBlockSize; blockX < (tileX + kTileWidth) / kBlockSize; blockX++)
+            {
+                float farthest = 0.0f;
+                for (int y = blockY * kBlockSize; y < (blockY + 1) * kBlockSize; y++)
+                    for (int x = blockX * kBlockSize; x < (blockX + 1) * kBlockSize; x++)
+                        farthest = std::max(farthest, m_Depth[size_t(y) * kWidth + x]);
+                m_HiZ[size_t(blockY) * kBlocksX + blockX] = farthest;
+            }
+    }
+};
+#endif
@@ -0,0 +1,147 @@
+#pragma once
+#ifndef STAGING_POOL_H
+#define STAGING_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// Recycles the large buffers images are decoded into. stb_image allocates through it (see stb_image.cpp), so a
+// decoded image lands in a buffer a previous texture handed back after its upload, instead of a fresh malloc that is
+// freed again a frame later. Blocks come in power of two size classes; small allocations go straight to malloc.
+class StagingPool
+{
+public:
+    // allocations below this go to malloc, only pixel sized buffers are worth keeping
+    static const size_t kMinPooledSize = 64 * 1024;
+    // free blocks kept around at most, the rest is returned to the system
+    static const size_t kMaxRetainedBytes = 256 * 1024 * 1024;
+
+    struct Statistics {
+        std::atomic<size_t> allocations{ 0 };
+        std::atomic<size_t> reused{ 0 };
+        std::atomic<size_t> retainedBytes{ 0 };
+    };
+
+    static void* Allocate(size_t size)
+    {
+        int sizeClass = SizeClassOf(size);
+        Pool& pool = GetPool();
+        Header* header = nullptr;
+        if (sizeClass >= 0)
+        {
+            pool.statistics.allocations++;
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            std::vector<Header*>& list = pool.freeLists[sizeClass];
+            if (!list.empty())
+            {
+                header = list.back();
+                list.pop_back();
+                pool.statistics.reused++;
+                pool.statistics.retainedBytes -= ClassSize(sizeClass);
+            }
+        }
+        if (!header)
+        {
+            header = static_cast<Header*>(malloc(sizeof(Header) + (sizeClass >= 0 ? ClassSize(sizeClass) : size)));
+            if (!header)
+                return nullptr;
+        }
+        header->sizeClass = sizeClass;
+        header->size = size;
+        return header + 1;
+    }
+
+    static void Free(void* pointer)
+    {
+        if (!pointer)
+            return;
+        Header* header = static_cast<Header*>(pointer) - 1;
+        int sizeClass = header->sizeClass;
+        if (sizeClass >= 0)
+        {
+            Pool& pool = GetPool();
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            if (pool.statistics.retainedBytes + ClassSize(sizeClass) <= kMaxRetainedBytes)
+            {
+                pool.freeLists[sizeClass].push_back(header);
+                pool.statistics.retainedBytes += ClassSize(sizeClass);
+                return;
+            }
+        }
+        free(header);
+    }
+
+    static void* Reallocate(void* pointer, size_t size)
+    {
+        if (!pointer)
+            return Allocate(size);
+        Header* header = static_cast<Header*>(pointer) - 1;
+        // the block already has room
+        if (header->sizeClass >= 0 && size <= ClassSize(header->sizeClass) && size >= kMinPooledSize)
+        {
+            header->size = size;
+            return pointer;
+        }
+        void* grown = Allocate(size);
+        if (!grown)
+            return nullptr;
+        memcpy(grown, pointer, header->size < size ? header->size : size);
+        Free(pointer);
+        return grown;
+    }
+
+    static const Statistics& GetStatistics()
+    {
+        return GetPool().statistics;
+    }
+
+private:
+    static const int kClassCount = 32;
+
+    // keeps the returned pointers 16 byte aligned
+    struct alignas(16) Header {
+        size_t size;
+        int sizeClass;
+    };
+
+    struct Pool {
+        std::mutex mutex;
+        std::vector<Header*> freeLists[kClassCount];
+        Statistics statistics;
+
+        ~Pool()
+        {
+            for (std::vector<Header*>& list : freeLists)
+                for (Header* header : list)
+                    free(header);
+        }
+    };
+
+    static Pool& GetPool()
+    {
+        static Pool pool;
+        return pool;
+    }
+
+    static size_t ClassSize(int sizeClass)
+    {
+        return kMinPooledSize << sizeClass;
+    }
+
+    // -1 for sizes left to malloc
+    static int SizeClassOf(size_t size)
+    {
+        if (size < kMinPooledSize)
+            return -1;
+        int sizeClass = 0;
+        while (ClassSize(sizeClass) < size)
+            if (++sizeClass == kClassCount)
+                return -1;
+        return sizeClass;
+    }
+};
+#endif
@@ -1,2 +1,8 @@
+#include "staging_pool.h"
+
+// decoded images and the decoder's own buffers are recycled through the pool instead of malloc
+#define STBI_MALLOC(size) StagingPool::Allocate(size)
+#define STBI_REALLOC(pointer, size) StagingPool::Reallocate(pointer, size)
+#define STBI_FREE(pointer) StagingPool::Free(pointer)
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
\ No newline at end of file
+#include "stb_image.h"
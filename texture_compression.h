@@ -0,0 +1,402 @@
+#pragma once
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <glad/glad.h>
+
+#include "mapped_file.h"
+#include "mip_chain.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+// S3TC is an extension, RGTC is core since GL 3.0; both are spelled out in case the GL header leaves them out
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1
+#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+
+// one mip level of a block compressed texture, a range of CompressedTexture::data
+struct CompressedLevel {
+    int width, height;
+    size_t offset, size;
+};
+
+// a block compressed texture with its complete mip chain, ready for glCompressedTexImage2D
+struct CompressedTexture {
+    GLenum format = 0;
+    vector<CompressedLevel> levels;
+    vector<unsigned char> data;
+};
+
+// Encodes 8 bit images into the GPU block formats and builds their mip chains:
+// BC1 (DXT1) for RGB, BC3 (DXT5) for RGBA, BC4 (RGTC1) for single channel and BC5 (RGTC2) for normal maps, which keep
+// only X and Y and have Z rebuilt in the shader. Endpoints are fitted to the bounding box of each 4x4 block with a
+// small inset (van Waveren, "Real-Time DXT Compression"), which is fast enough to run on the loader threads.
+class TextureCompressor
+{
+public:
+    // block format for an image with the given channels, 0 if it's left uncompressed
+    static GLenum ChooseFormat(int channels, bool normalMap, bool s3tcSupported)
+    {
+        if (normalMap && channels >= 2)
+            return GL_COMPRESSED_RG_RGTC2;
+        if (channels == 1)
+            return GL_COMPRESSED_RED_RGTC1;
+        if (!s3tcSupported)
+            return 0;
+        if (channels == 3)
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        if (channels == 4)
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        return 0;
+    }
+
+    static size_t BlockBytes(GLenum format)
+    {
+        return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+    }
+
+    // compresses pixels (width * height * channels bytes) into format, with every mip level down to 1x1 if mipmaps;
+    // srgb colour is averaged in linear light for the smaller levels
+    static void Compress(const unsigned char* pixels, int width, int height, int channels, GLenum format, bool mipmaps, bool srgb, CompressedTexture& out)
+    {
+        out.format = format;
+        out.levels.clear();
+        out.data.clear();
+
+        // levels are built from the previous one, the first one is the image itself
+        vector<unsigned char> level, next;
+        const unsigned char* source = pixels;
+        for (;;)
+        {
+            CompressedLevel compressed;
+            compressed.width = width;
+            compressed.height = height;
+            compressed.offset = out.data.size();
+            compressed.size = size_t((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+            out.data.resize(compressed.offset + compressed.size);
+            CompressLevel(source, width, height, channels, format, &out.data[compressed.offset]);
+            out.levels.push_back(compressed);
+
+            if (!mipmaps || (width == 1 && height == 1))
+                break;
+            next.resize(size_t(std::max(1, width / 2)) * std::max(1, height / 2) * channels);
+            MipChainBuilder::Downsample(source, width, height, channels, srgb, next.data());
+            level.swap(next);
+            source = level.data();
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+    }
+
+    // BC1 colour block of 16 RGBA pixels, always in the opaque four colour mode
+    static void EncodeBC1Block(const unsigned char block[16 * 4], unsigned char out[8])
+    {
+        unsigned char minColor[3] = { 255, 255, 255 }, maxColor[3] = { 0, 0, 0 };
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+            {
+                minColor[c] = std::min(minColor[c], block[i * 4 + c]);
+                maxColor[c] = std::max(maxColor[c], block[i * 4 + c]);
+            }
+        // pull the endpoints in by 1/16 of the range, the interpolated colours then cover the block better
+        for (int c = 0; c < 3; c++)
+        {
+            int inset = (maxColor[c] - minColor[c]) >> 4;
+            minColor[c] = (unsigned char)std::min(255, minColor[c] + inset);
+            maxColor[c] = (unsigned char)std::max(0, maxColor[c] - inset);
+        }
+
+        uint16_t color0 = To565(maxColor), color1 = To565(minColor);
+        if (color0 < color1)
+            std::swap(color0, color1);
+        uint32_t indices = 0;
+        if (color0 != color1)
+        {
+            int palette[4][3];
+            From565(color0, palette[0]);
+            From565(color1, palette[1]);
+            for (int c = 0; c < 3; c++)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestDistance = INT32_MAX;
+                for (int p = 0; p < 4; p++)
+                {
+                    int distance = 0;
+                    for (int c = 0; c < 3; c++)
+                    {
+                        int d = block[i * 4 + c] - palette[p][c];
+                        distance += d * d;
+                    }
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= uint32_t(best) << (i * 2);
+            }
+        }
+        out[0] = color0 & 0xFF; out[1] = color0 >> 8;
+        out[2] = color1 & 0xFF; out[3] = color1 >> 8;
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = (indices >> (i * 8)) & 0xFF;
+    }
+
+    // BC4 block of 16 single channel values, in the eight value mode; also the alpha half of BC3 and both halves of BC5
+    static void EncodeBC4Block(const unsigned char values[16], unsigned char out[8])
+    {
+        unsigned char minValue = 255, maxValue = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            minValue = std::min(minValue, values[i]);
+            maxValue = std::max(maxValue, values[i]);
+        }
+        out[0] = maxValue;
+        out[1] = minValue;
+        uint64_t indices = 0;
+        if (maxValue != minValue)
+        {
+            int palette[8];
+            palette[0] = maxValue;
+            palette[1] = minValue;
+            for (int p = 1; p < 7; p++)
+                palette[p + 1] = ((7 - p) * maxValue + p * minValue) / 7;
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestDistance = INT32_MAX;
+                for (int p = 0; p < 8; p++)
+                {
+                    int distance = std::abs(values[i] - palette[p]);
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= uint64_t(best) << (i * 3);
+            }
+        }
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (indices >> (i * 8)) & 0xFF;
+    }
+
+private:
+    static void CompressLevel(const unsigned char* pixels, int width, int height, int channels, GLenum format, unsigned char* out)
+    {
+        size_t blockBytes = BlockBytes(format);
+        unsigned char block[16 * 4];
+        unsigned char values[16];
+        for (int by = 0; by < height; by += 4)
+            for (int bx = 0; bx < width; bx += 4)
+            {
+                // gather the block as RGBA, pixels beyond the edge repeat the last row and column
+                for (int y = 0; y < 4; y++)
+                    for (int x = 0; x < 4; x++)
+                    {
+                        const unsigned char* p = &pixels[(size_t(std::min(by + y, height - 1)) * width + std::min(bx + x, width - 1)) * channels];
+                        unsigned char* b = &block[(y * 4 + x) * 4];
+                        b[0] = p[0];
+                        b[1] = channels > 1 ? p[1] : 0;
+                        b[2] = channels > 2 ? p[2] : 0;
+                        b[3] = channels > 3 ? p[3] : 255;
+                    }
+
+                switch (format)
+                {
+                case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+                    EncodeBC1Block(block, out);
+                    break;
+                case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+                    for (int i = 0; i < 16; i++)
+                        values[i] = block[i * 4 + 3];
+                    EncodeBC4Block(values, out);
+                    EncodeBC1Block(block, out + 8);
+                    break;
+                case GL_COMPRESSED_RED_RGTC1:
+                    for (int i = 0; i < 16; i++)
+                        values[i] = block[i * 4];
+                    EncodeBC4Block(values, out);
+                    break;
+                case GL_COMPRESSED_RG_RGTC2:
+                    for (int channel = 0; channel < 2; channel++)
+                    {
+                        for (int i = 0; i < 16; i++)
+                            values[i] = block[i * 4 + channel];
+                        EncodeBC4Block(values, out + channel * 8);
+                    }
+                    break;
+                }
+                out += blockBytes;
+            }
+    }
+
+    static uint16_t To565(const unsigned char color[3])
+    {
+        return uint16_t(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+    }
+
+    static void From565(uint16_t color, int out[3])
+    {
+        int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+        out[0] = (r << 3) | (r >> 2);
+        out[1] = (g << 2) | (g >> 4);
+        out[2] = (b << 3) | (b >> 2);
+    }
+};
+
+// On-disk cache of compressed textures, one file next to each source image (source path + ".txc"). The header
+// records the size and modification time of the source and the settings it was encoded with; a cache file that
+// doesn't match is ignored and rewritten. The layout mirrors KTX: a header, then every mip level as size + blocks.
+class TextureCache
+{
+public:
+    // what the cache entry of a source image must have been encoded with
+    struct Key {
+        uint64_t sourceSize = 0;
+        int64_t sourceTime = 0;
+        uint32_t format = 0;
+        uint32_t flags = 0;
+    };
+
+    // false if the source doesn't exist
+    static bool MakeKey(const string& sourcePath, GLenum format, uint32_t flags, Key& key)
+    {
+        struct stat info;
+        if (stat(sourcePath.c_str(), &info) != 0)
+            return false;
+        key.sourceSize = uint64_t(info.st_size);
+        key.sourceTime = int64_t(info.st_mtime);
+        key.format = format;
+        key.flags = flags;
+        return true;
+    }
+
+    static string CachePath(const string& sourcePath)
+    {
+        return sourcePath + ".txc";
+    }
+
+    static bool Read(const string& sourcePath, const Key& key, CompressedTexture& out)
+    {
+        MappedFile file(CachePath(sourcePath).c_str());
+        return file.IsOpen() && ReadMapped(file, key, out);
+    }
+
+    // best effort, a read-only asset folder simply means the texture gets encoded again next run
+    static bool Write(const string& sourcePath, const Key& key, const CompressedTexture& texture)
+    {
+        string path = CachePath(sourcePath);
+        // written under a temporary name first, a crash half way never leaves a truncated cache file behind
+        string temporary = path + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (!file)
+            return false;
+        Header header;
+        memcpy(header.magic, kMagic, sizeof(header.magic));
+        header.version = kVersion;
+        header.key = key;
+        header.levelCount = uint32_t(texture.levels.size());
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        for (const CompressedLevel& level : texture.levels)
+        {
+            uint32_t info[3] = { uint32_t(level.width), uint32_t(level.height), uint32_t(level.size) };
+            ok = ok && fwrite(info, sizeof(info), 1, file) == 1;
+            ok = ok && fwrite(&texture.data[level.offset], 1, level.size, file) == level.size;
+        }
+        ok = fclose(file) == 0 && ok;
+        remove(path.c_str());
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // reads only levels first to first + count - 1 of a cache entry, the levels before are skipped over
+    static bool ReadLevels(const string& sourcePath, const Key& key, int first, int count, CompressedTexture& out)
+    {
+        MappedFile file(CachePath(sourcePath).c_str());
+        return file.IsOpen() && ReadMapped(file, key, out, first, count);
+    }
+
+private:
+    static constexpr const char* kMagic = "TXC1";
+    static const uint32_t kVersion = 1;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        Key key;
+        uint32_t levelCount;
+    };
+
+    // the level table is walked in the mapping and the wanted levels are copied out in one go, there is no stdio
+    // buffer in between; out is only touched once every wanted level is known to be in the file
+    static bool ReadMapped(const MappedFile& file, const Key& key, CompressedTexture& out, int first = 0, int count = INT32_MAX)
+    {
+        const unsigned char* data = file.Data();
+        size_t size = file.Size();
+        Header header;
+        if (size < sizeof(header))
+            return false;
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, kMagic, sizeof(header.magic)) != 0 || header.version != kVersion)
+            return false;
+        if (header.key.sourceSize != key.sourceSize || header.key.sourceTime != key.sourceTime
+            || header.key.format != key.format || header.key.flags != key.flags || header.levelCount == 0)
+            return false;
+
+        size_t position = sizeof(header);
+        vector<CompressedLevel> levels;
+        vector<size_t> sources;
+        size_t total = 0;
+        for (uint32_t i = 0; i < header.levelCount && int(i) - first < count; i++)
+        {
+            uint32_t info[3];
+            if (size - position < sizeof(info))
+                return false;
+            memcpy(info, data + position, sizeof(info));
+            position += sizeof(info);
+            if (size - position < info[2])
+                return false;
+            if (int(i) >= first)
+            {
+                levels.push_back(CompressedLevel{ int(info[0]), int(info[1]), total, info[2] });
+                sources.push_back(position);
+                total += info[2];
+            }
+            position += info[2];
+        }
+        if (levels.empty())
+            return false;
+        out.format = key.format;
+        out.levels.swap(levels);
+        out.data.resize(total);
+        for (size_t i = 0; i < out.levels.size(); i++)
+            memcpy(&out.data[out.levels[i].offset], data + sources[i], out.levels[i].size);
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,798 @@
+#pragma once
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+#include "mapped_file.h"
+#include "profiler.h"
+#include "stb_image.h"
+#include "texture_compression.h"
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// how a texture is sampled and what it shows until its image arrives
+struct TextureLoadOptions {
+    GLenum wrap = GL_REPEAT;
+    GLenum minFilter = GL_LINEAR_MIPMAP_LINEAR;
+    bool generateMipmaps = true;
+    bool flipVertically = true;
+    // channels to decode to, 0 keeps the channels of the file
+    int channels = 0;
+    // encode to a GPU block format, cached next to the source file after the first run
+    bool compress = true;
+    // two channel BC5 for normal maps, the shaders rebuild Z
+    bool normalMap = false;
+    // keep only the mip levels the view asks for resident, see TextureLoader::RequestResolution; needs compress
+    bool stream = false;
+    // colour data is sRGB encoded, its mip levels are averaged in linear light; off for normals, heights and masks
+    bool srgb = true;
+    // colour of the 1x1 placeholder, mid grey by default; normal maps want a flat normal (128, 128, 255)
+    unsigned char placeholder[4] = { 128, 128, 128, 255 };
+};
+
+// Loads textures without blocking the render thread. Load2D and LoadCubemap return a texture name right away that
+// holds a 1x1 placeholder; a pool of worker threads decodes the files and ProcessUploads, called once per frame on
+// the GL thread, uploads a bounded amount of decoded pixels through a pixel buffer object, so large images stream in
+// over a few frames instead of stalling one.
+// Streamed textures start with only their mip tail resident. Every frame the draws report how many pixels each
+// texture covers on screen, and the loader reads the finer levels that resolution needs back from the texture cache,
+// within streamingBudgetBytes, clamping the sampled range with GL_TEXTURE_BASE_LEVEL. Levels no longer needed are
+// dropped again, textures that weren't drawn for a while fall back to their tail.
+class TextureLoader
+{
+public:
+    // pixels uploaded per ProcessUploads call, a single larger texture still goes through on its own
+    size_t uploadBudgetBytes = 16 * 1024 * 1024;
+    // stage uploads in a pixel buffer object, the driver copies them to the texture asynchronously
+    bool usePixelBuffers = true;
+    // video memory the finer levels of streamed textures may take, their mip tails always stay resident
+    size_t streamingBudgetBytes = 256 * 1024 * 1024;
+    // levels up to this size are loaded with the texture and never dropped
+    int streamingTailSize = 256;
+    // frames a streamed texture may go unrequested before it falls back to its tail
+    unsigned int streamingEvictFrames = 120;
+    // build the mip levels of uncompressed textures on the decode threads instead of with glGenerateMipmap, which
+    // software GL stacks run slowly on the GL thread
+    bool cpuMipmaps = true;
+
+    static TextureLoader& Instance()
+    {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    unsigned int Load2D(const string& path, const TextureLoadOptions& options = TextureLoadOptions())
+    {
+        return Queue(GL_TEXTURE_2D, vector<string>{ path }, options);
+    }
+
+    // faces in the order +X, -X, +Y, -Y, +Z, -Z; the cubemap is uploaded once all six are decoded
+    unsigned int LoadCubemap(const vector<string>& faces, const TextureLoadOptions& options)
+    {
+        return Queue(GL_TEXTURE_CUBE_MAP, faces, options);
+    }
+
+    // a draw with texture covering about pixels on screen (across its larger side), the finest level that still has
+    // at least one texel per pixel will be streamed in; called from the draws, on the GL thread
+    void RequestResolution(unsigned int texture, float pixels)
+    {
+        auto found = m_Streamed.find(texture);
+        if (found == m_Streamed.end())
+            return;
+        StreamedTexture& streamed = found->second;
+        int level = 0;
+        float size = float(std::max(streamed.width, streamed.height));
+        while (level + 1 < streamed.levelCount && size * 0.5f >= pixels)
+        {
+            size *= 0.5f;
+            level++;
+        }
+        if (streamed.lastRequestFrame != m_Frame || level < streamed.wantedLevel)
+            streamed.wantedLevel = level;
+        streamed.lastRequestFrame = m_Frame;
+    }
+
+    // layers of a GL_TEXTURE_2D_ARRAY, which all need the same size and channels; uploaded once every layer is decoded
+    unsigned int LoadArray(const vector<string>& layers, const TextureLoadOptions& options)
+    {
+        return Queue(GL_TEXTURE_2D_ARRAY, layers, options);
+    }
+
+    // uploads decoded textures until the frame's budget is spent, must run on the thread owning the GL context
+    void ProcessUploads()
+    {
+        UpdateStreaming();
+        m_Frame++;
+
+        size_t uploadedBytes = 0;
+        while (uploadedBytes < uploadBudgetBytes)
+        {
+            Request* request = nullptr;
+            {
+                lock_guard<mutex> lock(m_Mutex);
+                if (m_Ready.empty())
+                    break;
+                request = m_Ready.front();
+                // the budget is checked before the upload, but the first texture of a frame always goes
+                if (uploadedBytes > 0 && uploadedBytes + request->decodedBytes > uploadBudgetBytes)
+                    break;
+                m_Ready.pop_front();
+            }
+            if (request->released)
+            {
+                Retire(request);
+                continue;
+            }
+            if (request->firstLevel >= 0)
+                UploadLevels(*request);
+            else
+                Upload(*request);
+            uploadedBytes += request->decodedBytes;
+            m_UploadedBytes += request->decodedBytes;
+            if (request->firstLevel < 0)
+                m_ResidentBytes[request->id] += request->decodedBytes;
+            m_UploadedUncompressedBytes += request->uncompressedBytes;
+            if (request->firstLevel < 0)
+                m_UploadedTextures++;
+            Retire(request);
+        }
+    }
+
+    // deletes texture and forgets its streaming state; a load still in flight for it is dropped when it finishes
+    void Release(unsigned int texture)
+    {
+        auto found = m_Streamed.find(texture);
+        if (found != m_Streamed.end())
+        {
+            for (int level = found->second.residentLevel; level < found->second.tailLevel; level++)
+                m_StreamedResidentBytes -= LevelBytes(found->second, level);
+            m_Streamed.erase(found);
+        }
+        m_ResidentBytes.erase(texture);
+        {
+            lock_guard<mutex> lock(m_Mutex);
+            for (unique_ptr<Request>& request : m_Requests)
+                if (request->id == texture)
+                    request->released = true;
+        }
+        GLState::Instance().ForgetTexture(texture);
+        glDeleteTextures(1, &texture);
+    }
+
+    // textures still waiting to be decoded or uploaded
+    size_t PendingCount()
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        return m_Requests.size();
+    }
+
+    size_t UploadedTextures() const { return m_UploadedTextures; }
+    size_t UploadedBytes() const { return m_UploadedBytes; }
+    // what the uploaded textures would take as uncompressed RGB(A) with their mip chains
+    size_t UploadedUncompressedBytes() const { return m_UploadedUncompressedBytes; }
+    // video memory held by the levels of streamed textures finer than their tails
+    size_t StreamedResidentBytes() const { return m_StreamedResidentBytes; }
+
+    // video memory of texture as uploaded, with its streamed levels as they come and go; mipmaps GL generates itself
+    // aren't counted, and a texture still loading has only its placeholder
+    size_t ResidentBytes(unsigned int texture) const
+    {
+        auto found = m_ResidentBytes.find(texture);
+        return found != m_ResidentBytes.end() ? found->second : 0;
+    }
+
+    ~TextureLoader()
+    {
+        {
+            lock_guard<mutex> lock(m_Mutex);
+            m_Stop = true;
+        }
+        m_WorkAvailable.notify_all();
+        for (thread& worker : m_Workers)
+            worker.join();
+        // the GL context is gone by now, only the CPU side of unfinished requests is freed
+        for (unique_ptr<Request>& request : m_Requests)
+            for (DecodedImage& image : request->images)
+                stbi_image_free(image.pixels);
+    }
+
+private:
+    struct DecodedImage {
+        int width = 0, height = 0, channels = 0;
+        unsigned char* pixels = nullptr;
+        // filled instead of pixels when the image is block compressed
+        CompressedTexture compressed;
+        // the compressed levels are in the texture cache and can be read back from it
+        bool cached = false;
+        TextureCache::Key key;
+        // levels below pixels when they were built on the CPU
+        MipChain mips;
+    };
+
+    struct Request {
+        unsigned int id;
+        GLenum target;
+        vector<string> paths;
+        TextureLoadOptions options;
+        vector<DecodedImage> images;
+        size_t remaining;
+        size_t decodedBytes = 0;
+        size_t uncompressedBytes = 0;
+        // >= 0 for a request streaming levelCount levels from firstLevel on into an already loaded texture
+        int firstLevel = -1;
+        int levelCount = 0;
+        // cpuMipmaps when the request was queued, the workers don't read the loader's settings
+        bool cpuMipmaps = false;
+        // the texture was deleted while loading, nothing is uploaded
+        bool released = false;
+    };
+
+    // a texture with some of its finer mip levels not resident
+    struct StreamedTexture {
+        string path;
+        TextureCache::Key key;
+        GLenum format;
+        int width, height;
+        int levelCount;
+        // levels below this one aren't ever dropped
+        int tailLevel;
+        // finest level on the GPU, the texture's GL_TEXTURE_BASE_LEVEL
+        int residentLevel;
+        // finest level the draws asked for in the last frame they asked
+        int wantedLevel;
+        unsigned int lastRequestFrame = 0;
+        bool loading = false;
+        // finest level that can be loaded, raised if reading levels back from the cache fails
+        int finestLevel = 0;
+        // the finer levels when there is no cache file to read them back from
+        CompressedTexture memoryCopy;
+    };
+
+    struct DecodeJob {
+        Request* request;
+        size_t image;
+    };
+
+    mutex m_Mutex;
+    condition_variable m_WorkAvailable;
+    deque<DecodeJob> m_Jobs;
+    deque<Request*> m_Ready;
+    vector<unique_ptr<Request>> m_Requests;
+    vector<thread> m_Workers;
+    bool m_Stop = false;
+    unsigned int m_PixelBuffer = 0;
+    size_t m_UploadedTextures = 0;
+    size_t m_UploadedBytes = 0;
+    size_t m_UploadedUncompressedBytes = 0;
+    bool m_S3tcSupported = false;
+    // streaming state, only touched on the GL thread
+    unordered_map<unsigned int, StreamedTexture> m_Streamed;
+    size_t m_StreamedResidentBytes = 0;
+    // per texture, for ResidentBytes
+    unordered_map<unsigned int, size_t> m_ResidentBytes;
+    unsigned int m_Frame = 0;
+
+    TextureLoader()
+    {
+        // RGTC is core, the S3TC formats for colour textures need the extension
+        GLint extensionCount = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+        for (GLint i = 0; i < extensionCount; i++)
+        {
+            const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (extension && strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0)
+                m_S3tcSupported = true;
+        }
+
+        // leave a core to the render thread
+        unsigned int workerCount = std::max(1u, std::min(4u, thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 1u));
+        for (unsigned int i = 0; i < workerCount; i++)
+            m_Workers.emplace_back(&TextureLoader::WorkerLoop, this);
+    }
+
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    unsigned int Queue(GLenum target, const vector<string>& paths, const TextureLoadOptions& options)
+    {
+        unique_ptr<Request> request(new Request());
+        glGenTextures(1, &request->id);
+        request->target = target;
+        request->paths = paths;
+        request->options = options;
+        request->images.resize(paths.size());
+        request->remaining = paths.size();
+        request->cpuMipmaps = cpuMipmaps;
+        CreatePlaceholder(*request);
+
+        unsigned int id = request->id;
+        {
+            lock_guard<mutex> lock(m_Mutex);
+            for (size_t i = 0; i < paths.size(); i++)
+                m_Jobs.push_back(DecodeJob{ request.get(), i });
+            m_Requests.push_back(std::move(request));
+        }
+        m_WorkAvailable.notify_all();
+        return id;
+    }
+
+    void WorkerLoop()
+    {
+        Profiler::Instance().SetThreadName("texture decode");
+        for (;;)
+        {
+            DecodeJob job;
+            {
+                unique_lock<mutex> lock(m_Mutex);
+                m_WorkAvailable.wait(lock, [this] { return m_Stop || !m_Jobs.empty(); });
+                if (m_Stop)
+                    return;
+                job = m_Jobs.front();
+                m_Jobs.pop_front();
+            }
+
+            Request& request = *job.request;
+            DecodedImage& image = request.images[job.image];
+            if (request.firstLevel >= 0)
+            {
+                if (!TextureCache::ReadLevels(request.paths[0], image.key, request.firstLevel, request.levelCount, image.compressed))
+                    cout << "Texture levels failed to load from cache: " << request.paths[0] << endl;
+                lock_guard<mutex> lock(m_Mutex);
+                request.decodedBytes = image.compressed.data.size();
+                m_Ready.push_back(&request);
+                continue;
+            }
+            Decode(request.paths[job.image], request.options, request.cpuMipmaps, image);
+
+            size_t uncompressed = size_t(image.width) * image.height * image.channels;
+            if (request.options.generateMipmaps)
+                uncompressed = uncompressed * 4 / 3;
+            lock_guard<mutex> lock(m_Mutex);
+            request.decodedBytes += image.compressed.format ? image.compressed.data.size()
+                : size_t(image.width) * image.height * image.channels + image.mips.data.size();
+            request.uncompressedBytes += uncompressed;
+            if (--request.remaining == 0)
+                m_Ready.push_back(&request);
+        }
+    }
+
+    // loads the compressed texture from the cache, or decodes the file and compresses it when the cache is missing
+    // or stale; falls back to plain pixels if the image can't be compressed, with their mip levels if cpuMipmaps
+    void Decode(const string& path, const TextureLoadOptions& options, bool cpuMipmaps, DecodedImage& image)
+    {
+        // the flip flag is global in stb_image, set it for this thread only
+        stbi_set_flip_vertically_on_load_thread(options.flipVertically ? 1 : 0);
+
+        ProfileScope profile("Texture decode", path);
+        // stb_image reads straight from the mapped pages, only the pages it touches are read from disk and a cache
+        // hit reads no more than the header
+        MappedFile source(path.c_str());
+        if (!source.IsOpen() || source.Size() > size_t(INT_MAX))
+        {
+            cout << "Texture failed to load at path: " << path << endl;
+            return;
+        }
+        const stbi_uc* bytes = source.Data();
+        int length = int(source.Size());
+
+        GLenum format = 0;
+        if (options.compress)
+        {
+            // the header tells the channels without decoding, enough to pick the format and look up the cache
+            int fileChannels = 0;
+            if (stbi_info_from_memory(bytes, length, &image.width, &image.height, &fileChannels))
+            {
+                image.channels = options.channels ? options.channels : fileChannels;
+                format = TextureCompressor::ChooseFormat(image.channels, options.normalMap, m_S3tcSupported);
+            }
+            uint32_t flags = (options.flipVertically ? 1u : 0u) | (options.generateMipmaps ? 2u : 0u) | uint32_t(image.channels) << 2
+                | (options.srgb ? 32u : 0u);
+            if (format && !TextureCache::MakeKey(path, format, flags, image.key))
+                format = 0;
+            ProfileScope cacheProfile("TextureCache read");
+            if (format && TextureCache::Read(path, image.key, image.compressed))
+            {
+                image.cached = true;
+                return;
+            }
+        }
+
+        ProfileScope loadProfile("stbi_load");
+        int fileChannels = 0;
+        image.pixels = stbi_load_from_memory(bytes, length, &image.width, &image.height, &fileChannels, options.channels);
+        loadProfile.End();
+        image.channels = options.channels ? options.channels : fileChannels;
+        if (!image.pixels)
+        {
+            cout << "Texture failed to load at path: " << path << endl;
+            return;
+        }
+        if (format)
+        {
+            ProfileScope compressProfile("Texture compress");
+            TextureCompressor::Compress(image.pixels, image.width, image.height, image.channels, format, options.generateMipmaps, options.srgb, image.compressed);
+            image.cached = TextureCache::Write(path, image.key, image.compressed);
+            stbi_image_free(image.pixels);
+            image.pixels = nullptr;
+        }
+        else if (options.generateMipmaps && cpuMipmaps)
+        {
+            ProfileScope mipProfile("Mip chain");
+            MipChainBuilder::Build(image.pixels, image.width, image.height, image.channels, options.srgb, image.mips);
+        }
+    }
+
+    void CreatePlaceholder(const Request& request)
+    {
+        GLState::Instance().BindTexture(request.target, request.id);
+        if (request.target == GL_TEXTURE_CUBE_MAP)
+        {
+            for (unsigned int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, request.options.placeholder);
+        }
+        else if (request.target == GL_TEXTURE_2D_ARRAY)
+        {
+            vector<unsigned char> layers;
+            for (size_t i = 0; i < request.paths.size(); i++)
+                layers.insert(layers.end(), request.options.placeholder, request.options.placeholder + 4);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, GLsizei(request.paths.size()), 0, GL_RGBA, GL_UNSIGNED_BYTE, layers.data());
+        }
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, request.options.placeholder);
+        SetParameters(request);
+    }
+
+    void SetParameters(const Request& request)
+    {
+        glTexParameteri(request.target, GL_TEXTURE_WRAP_S, request.options.wrap);
+        glTexParameteri(request.target, GL_TEXTURE_WRAP_T, request.options.wrap);
+        if (request.target == GL_TEXTURE_CUBE_MAP)
+            glTexParameteri(request.target, GL_TEXTURE_WRAP_R, request.options.wrap);
+        glTexParameteri(request.target, GL_TEXTURE_MIN_FILTER, request.options.minFilter);
+        glTexParameteri(request.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    static GLenum FormatForChannels(int channels)
+    {
+        switch (channels)
+        {
+        case 1: return GL_RED;
+        case 2: return GL_RG;
+        case 3: return GL_RGB;
+        default: return GL_RGBA;
+        }
+    }
+
+    // copies data into the pixel buffer and leaves it bound; returns the pointer to hand to glTexImage2D, which is an
+    // offset into the bound buffer, or data itself when there's no pixel buffer to stage into
+    const unsigned char* Stage(const unsigned char* data, size_t size)
+    {
+        if (usePixelBuffers)
+        {
+            if (!m_PixelBuffer)
+                glGenBuffers(1, &m_PixelBuffer);
+            GLState::Instance().BindBuffer(GL_PIXEL_UNPACK_BUFFER, m_PixelBuffer);
+            // orphan the previous storage, so the copy doesn't wait for the last upload to finish
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (staging)
+            {
+                memcpy(staging, data, size);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                return nullptr;
+            }
+        }
+        GLState::Instance().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return data;
+    }
+
+    // uploads the CPU built levels 1 and below, staged together like a compressed chain
+    void UploadMips(GLenum target, const MipChain& mips, GLenum format)
+    {
+        const unsigned char* source = Stage(mips.data.data(), mips.data.size());
+        for (size_t i = 0; i < mips.levels.size(); i++)
+        {
+            const MipLevel& l = mips.levels[i];
+            glTexImage2D(target, GLint(i + 1), format, l.width, l.height, 0, format, GL_UNSIGNED_BYTE, source + l.offset);
+        }
+        GLState::Instance().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // uploads the given levels of compressed, the first of them as level firstLevel of target
+    void UploadCompressed(GLenum target, const CompressedTexture& compressed, size_t first, size_t count, int firstLevel)
+    {
+        size_t begin = compressed.levels[first].offset;
+        size_t end = compressed.levels[first + count - 1].offset + compressed.levels[first + count - 1].size;
+        const unsigned char* source = Stage(&compressed.data[begin], end - begin);
+        for (size_t i = first; i < first + count; i++)
+        {
+            const CompressedLevel& l = compressed.levels[i];
+            glCompressedTexImage2D(target, firstLevel + GLint(i - first), compressed.format, l.width, l.height, 0, GLsizei(l.size), source + (l.offset - begin));
+        }
+        GLState::Instance().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    void Upload(Request& request)
+    {
+        // a texture whose file failed keeps its placeholder
+        for (const DecodedImage& image : request.images)
+            if (!image.pixels && !image.compressed.format)
+                return;
+
+        ProfileScope profile("glTexImage2D", request.paths[0]);
+        GLState::Instance().BindTexture(request.target, request.id);
+        // rows of RGB images are not 4 byte aligned in general
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        const CompressedTexture& compressed = request.images[0].compressed;
+        if (request.options.stream && request.target == GL_TEXTURE_2D && compressed.levels.size() > 1)
+            UploadStreamed(request, request.images[0]);
+        else if (request.target == GL_TEXTURE_2D_ARRAY)
+            UploadArray(request);
+        else
+        {
+            for (size_t i = 0; i < request.images.size(); i++)
+            {
+                const DecodedImage& image = request.images[i];
+                GLenum target = request.target == GL_TEXTURE_CUBE_MAP ? GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i) : GL_TEXTURE_2D;
+                if (image.compressed.format)
+                {
+                    // the whole precomputed mip chain goes up as is
+                    UploadCompressed(target, image.compressed, 0, image.compressed.levels.size(), 0);
+                    continue;
+                }
+                GLenum format = FormatForChannels(image.channels);
+                const unsigned char* source = Stage(image.pixels, size_t(image.width) * image.height * image.channels);
+                glTexImage2D(target, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, source);
+                GLState::Instance().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                if (!image.mips.levels.empty())
+                    UploadMips(target, image.mips, format);
+            }
+            const MipChain& mips = request.images[0].mips;
+            if (compressed.format)
+                glTexParameteri(request.target, GL_TEXTURE_MAX_LEVEL, GLint(compressed.levels.size()) - 1);
+            else if (!mips.levels.empty())
+                glTexParameteri(request.target, GL_TEXTURE_MAX_LEVEL, GLint(mips.levels.size()));
+            else if (request.options.generateMipmaps)
+                glGenerateMipmap(request.target);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        SetParameters(request);
+    }
+
+    // all layers go up level by level, each level as one contiguous block of every layer
+    void UploadArray(Request& request)
+    {
+        const DecodedImage& first = request.images[0];
+        for (const DecodedImage& image : request.images)
+            if (image.width != first.width || image.height != first.height || image.channels != first.channels
+                || image.compressed.format != first.compressed.format || image.compressed.levels.size() != first.compressed.levels.size())
+            {
+                cout << "Texture array layers differ in size or format: " << request.paths[0] << endl;
+                return;
+            }
+
+        GLsizei layerCount = GLsizei(request.images.size());
+        vector<unsigned char> level;
+        if (first.compressed.format)
+        {
+            for (size_t l = 0; l < first.compressed.levels.size(); l++)
+            {
+                const CompressedLevel& info = first.compressed.levels[l];
+                level.clear();
+                for (const DecodedImage& image : request.images)
+                    level.insert(level.end(), image.compressed.data.begin() + info.offset, image.compressed.data.begin() + info.offset + info.size);
+                const unsigned char* source = Stage(level.data(), level.size());
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, GLint(l), first.compressed.format, info.width, info.height, layerCount, 0, GLsizei(level.size()), source);
+                GLState::Instance().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, GLint(first.compressed.levels.size()) - 1);
+            return;
+        }
+
+        size_t layerSize = size_t(first.width) * first.height * first.channels;
+        for (const DecodedImage& image : request.images)
+            level.insert(level.end(), image.pixels, image.pixels + layerSize);
+        GLenum format = FormatForChannels(first.channels);
+        const unsigned char* source = Stage(level.data(), level.size());
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, first.width, first.height, layerCount, 0, format, GL_UNSIGNED_BYTE, source);
+        GLState::Instance().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!first.mips.levels.empty())
+        {
+            for (size_t l = 0; l < first.mips.levels.size(); l++)
+            {
+                const MipLevel& info = first.mips.levels[l];
+                level.clear();
+                for (const DecodedImage& image : request.images)
+                    level.insert(level.end(), image.mips.data.begin() + info.offset, image.mips.data.begin() + info.offset + info.size);
+                source = Stage(level.data(), level.size());
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, GLint(l + 1), format, info.width, info.height, layerCount, 0, format, GL_UNSIGNED_BYTE, source);
+                GLState::Instance().BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, GLint(first.mips.levels.size()));
+        }
+        else if (request.options.generateMipmaps)
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+
+    // uploads only the mip tail of a streamed texture and starts tracking it
+    void UploadStreamed(Request& request, DecodedImage& image)
+    {
+        const CompressedTexture& compressed = image.compressed;
+        StreamedTexture streamed;
+        streamed.path = request.paths[0];
+        streamed.key = image.key;
+        streamed.format = compressed.format;
+        streamed.width = compressed.levels[0].width;
+        streamed.height = compressed.levels[0].height;
+        streamed.levelCount = int(compressed.levels.size());
+        streamed.tailLevel = 0;
+        while (streamed.tailLevel + 1 < streamed.levelCount
+            && std::max(compressed.levels[streamed.tailLevel].width, compressed.levels[streamed.tailLevel].height) > streamingTailSize)
+            streamed.tailLevel++;
+        streamed.residentLevel = streamed.tailLevel;
+        streamed.wantedLevel = streamed.tailLevel;
+        // without a cache file the finer levels can't be read back later, they stay in memory instead
+        if (!image.cached)
+        {
+            streamed.memoryCopy.format = compressed.format;
+            streamed.memoryCopy.levels.assign(compressed.levels.begin(), compressed.levels.begin() + streamed.tailLevel);
+            streamed.memoryCopy.data.assign(compressed.data.begin(), compressed.data.begin() + compressed.levels[streamed.tailLevel].offset);
+        }
+
+        UploadCompressed(GL_TEXTURE_2D, compressed, streamed.tailLevel, streamed.levelCount - streamed.tailLevel, streamed.tailLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, streamed.tailLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, streamed.levelCount - 1);
+        request.decodedBytes = compressed.data.size() - compressed.levels[streamed.tailLevel].offset;
+        m_Streamed[request.id] = std::move(streamed);
+    }
+
+    // the finer levels of a streamed texture arrived from the cache
+    void UploadLevels(Request& request)
+    {
+        auto found = m_Streamed.find(request.id);
+        if (found == m_Streamed.end())
+            return;
+        StreamedTexture& streamed = found->second;
+        streamed.loading = false;
+        const CompressedTexture& compressed = request.images[0].compressed;
+        if (int(compressed.levels.size()) != request.levelCount)
+        {
+            // the cache file went missing or changed, stay with what is resident
+            streamed.finestLevel = streamed.residentLevel;
+            return;
+        }
+
+        GLState::Instance().BindTexture(GL_TEXTURE_2D, request.id);
+        UploadCompressed(GL_TEXTURE_2D, compressed, 0, compressed.levels.size(), request.firstLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, request.firstLevel);
+        streamed.residentLevel = request.firstLevel;
+        m_StreamedResidentBytes += compressed.data.size();
+        m_ResidentBytes[request.id] += compressed.data.size();
+    }
+
+    static size_t LevelBytes(const StreamedTexture& streamed, int level)
+    {
+        int width = std::max(1, streamed.width >> level), height = std::max(1, streamed.height >> level);
+        return size_t((width + 3) / 4) * ((height + 3) / 4) * TextureCompressor::BlockBytes(streamed.format);
+    }
+
+    // drops the levels nobody asks for anymore and queues loads for the ones that are missing, within the budget
+    void UpdateStreaming()
+    {
+        vector<pair<unsigned int, StreamedTexture*>> missing;
+        for (auto& entry : m_Streamed)
+        {
+            StreamedTexture& streamed = entry.second;
+            if (m_Frame - streamed.lastRequestFrame > streamingEvictFrames)
+                streamed.wantedLevel = streamed.tailLevel;
+            int wanted = std::max(std::min(streamed.wantedLevel, streamed.tailLevel), streamed.finestLevel);
+            if (!streamed.loading && wanted > streamed.residentLevel)
+            {
+                GLState::Instance().BindTexture(GL_TEXTURE_2D, entry.first);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, wanted);
+                // redefining a level outside the base..max range as empty frees its storage
+                for (int level = streamed.residentLevel; level < wanted; level++)
+                {
+                    m_StreamedResidentBytes -= LevelBytes(streamed, level);
+                    m_ResidentBytes[entry.first] -= LevelBytes(streamed, level);
+                    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                }
+                streamed.residentLevel = wanted;
+            }
+            else if (!streamed.loading && wanted < streamed.residentLevel)
+                missing.push_back(make_pair(entry.first, &streamed));
+        }
+
+        // the textures missing the most detail first
+        std::sort(missing.begin(), missing.end(), [](const pair<unsigned int, StreamedTexture*>& a, const pair<unsigned int, StreamedTexture*>& b) {
+            return a.second->residentLevel - a.second->wantedLevel > b.second->residentLevel - b.second->wantedLevel;
+        });
+        size_t budgetLeft = streamingBudgetBytes > m_StreamedResidentBytes ? streamingBudgetBytes - m_StreamedResidentBytes : 0;
+        for (auto& entry : missing)
+        {
+            StreamedTexture* streamed = entry.second;
+            // the finest level that still fits, every level between it and the resident one comes along
+            int first = streamed->residentLevel;
+            size_t bytes = 0;
+            while (first > std::max(streamed->wantedLevel, streamed->finestLevel) && bytes + LevelBytes(*streamed, first - 1) <= budgetLeft)
+                bytes += LevelBytes(*streamed, --first);
+            if (first == streamed->residentLevel)
+                continue;
+            budgetLeft -= bytes;
+            QueueLevels(entry.first, *streamed, first, streamed->residentLevel - first);
+        }
+        if (!missing.empty())
+            GLState::Instance().BindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void QueueLevels(unsigned int id, StreamedTexture& streamed, int first, int count)
+    {
+        unique_ptr<Request> request(new Request());
+        request->id = id;
+        request->target = GL_TEXTURE_2D;
+        request->paths.push_back(streamed.path);
+        request->images.resize(1);
+        request->images[0].key = streamed.key;
+        request->remaining = 1;
+        request->firstLevel = first;
+        request->levelCount = count;
+        streamed.loading = true;
+
+        lock_guard<mutex> lock(m_Mutex);
+        if (!streamed.memoryCopy.levels.empty())
+        {
+            // already in memory, straight to the upload queue
+            CompressedTexture& levels = request->images[0].compressed;
+            levels.format = streamed.format;
+            size_t begin = streamed.memoryCopy.levels[first].offset;
+            for (int i = first; i < first + count; i++)
+            {
+                CompressedLevel level = streamed.memoryCopy.levels[i];
+                level.offset -= begin;
+                levels.levels.push_back(level);
+            }
+            size_t end = streamed.memoryCopy.levels[first + count - 1].offset + streamed.memoryCopy.levels[first + count - 1].size;
+            levels.data.assign(streamed.memoryCopy.data.begin() + begin, streamed.memoryCopy.data.begin() + end);
+            request->decodedBytes = levels.data.size();
+            m_Ready.push_back(request.get());
+        }
+        else
+            m_Jobs.push_back(DecodeJob{ request.get(), 0 });
+        m_Requests.push_back(std::move(request));
+        m_WorkAvailable.notify_one();
+    }
+
+    void Retire(Request* request)
+    {
+        for (DecodedImage& image : request->images)
+        {
+            stbi_image_free(image.pixels);
+            image.pixels = nullptr;
+            CompressedTexture().levels.swap(image.compressed.levels);
+            vector<unsigned char>().swap(image.compressed.data);
+            vector<unsigned char>().swap(image.mips.data);
+        }
+        lock_guard<mutex> lock(m_Mutex);
+        for (size_t i = 0; i < m_Requests.size(); i++)
+            if (m_Requests[i].get() == request)
+            {
+                m_Requests.erase(m_Requests.begin() + i);
+                break;
+            }
+    }
+};
+#endif